@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "hotrod-c.h"
+#include "hotrod-codec.h"
+#include "murmurHash3.h"
+#include "benchmark/benchmark.h"
+
+// In memory stream, rewound at every iteration so each run decodes the same bytes
+typedef struct {
+    uint8_t *buff;
+    int pos;
+} memStream;
+
+static void memReader(void *ctx, uint8_t *val, int len) {
+    memStream *ms = (memStream*)ctx;
+    memcpy(val, ms->buff+ms->pos, len);
+    ms->pos += len;
+}
+
+static void memWriter(void *ctx, uint8_t *val, int len) {
+    memStream *ms = (memStream*)ctx;
+    memcpy(ms->buff+ms->pos, val, len);
+    ms->pos += len;
+}
+
+static void initHeader(requestHeader *hdr, byteArray cacheName) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = 0xA0;
+    hdr->messageId = 1;
+    hdr->version = 30;
+    hdr->cacheName = cacheName;
+    hdr->clientIntelligence = CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE;
+    hdr->topologyId = 2;
+}
+
+// Topology in wire format: servers "10.0.x.y":11222 and segments with 2 owners each
+static std::vector<uint8_t> encodeTopology(int serversNum, int segmentsNum) {
+    std::vector<uint8_t> data(16+serversNum*24+segmentsNum*11);
+    uint8_t *curs = data.data();
+    writeVInt(&curs, 3);
+    writeVInt(&curs, serversNum);
+    for (int i=0; i<serversNum; i++) {
+        char addr[16];
+        int len = snprintf(addr, sizeof(addr), "10.0.%d.%d", i/256, i%256);
+        writeBytes(&curs, (uint8_t*)addr, len);
+        writeShort(&curs, 11222);
+    }
+    writeByte(&curs, 0x03);
+    writeVInt(&curs, segmentsNum);
+    for (int i=0; i<segmentsNum; i++) {
+        writeByte(&curs, 2);
+        writeVInt(&curs, i%serversNum);
+        writeVInt(&curs, (i+1)%serversNum);
+    }
+    data.resize(curs-data.data());
+    return data;
+}
+
+static void BM_WriteRequestHeader(benchmark::State& state) {
+    std::vector<uint8_t> name(state.range(0), 'c');
+    requestHeader hdr;
+    initHeader(&hdr, {(int)name.size(), name.data()});
+    std::vector<uint8_t> buff(name.size()+64);
+    for (auto _ : state) {
+        hdr.messageId++;
+        benchmark::DoNotOptimize(writeRequestHeader(buff.data(), &hdr));
+    }
+}
+BENCHMARK(BM_WriteRequestHeader)->Arg(0)->Arg(16)->Arg(128);
+
+static void BM_WriteVInt(benchmark::State& state) {
+    uint32_t val = state.range(0);
+    uint8_t buff[8];
+    for (auto _ : state) {
+        uint8_t *curs = buff;
+        writeVInt(&curs, val);
+        benchmark::DoNotOptimize(curs);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_WriteVInt)->Arg(1)->Arg(300)->Arg(70000)->Arg(0x7fffffff);
+
+static void BM_ReadVInt(benchmark::State& state) {
+    uint8_t buff[8];
+    uint8_t *curs = buff;
+    writeVInt(&curs, state.range(0));
+    memStream ms = {buff, 0};
+    for (auto _ : state) {
+        ms.pos = 0;
+        benchmark::DoNotOptimize(readVInt(&ms, memReader));
+    }
+}
+BENCHMARK(BM_ReadVInt)->Arg(1)->Arg(300)->Arg(70000)->Arg(0x7fffffff);
+
+static void BM_ReadResponseHeader(benchmark::State& state) {
+    uint8_t buff[] = {0xA1, 0x81, 0x01, 0x04, 0x00, 0x00};
+    memStream ms = {buff, 0};
+    requestHeader rqh;
+    initHeader(&rqh, {0, nullptr});
+    responseHeader rsh;
+    topologyInfo tInfo;
+    for (auto _ : state) {
+        ms.pos = 0;
+        readResponseHeader(&ms, memReader, &rsh, &rqh, &tInfo);
+        benchmark::DoNotOptimize(rsh.messageId);
+    }
+}
+BENCHMARK(BM_ReadResponseHeader);
+
+static void BM_ReadNewTopology(benchmark::State& state) {
+    std::vector<uint8_t> data = encodeTopology(state.range(0), state.range(1));
+    memStream ms = {data.data(), 0};
+    requestHeader rqh;
+    initHeader(&rqh, {0, nullptr});
+    responseHeader rsh;
+    topologyInfo tInfo;
+    for (auto _ : state) {
+        ms.pos = 0;
+        readNewTopology(&ms, memReader, &rsh, &rqh, &tInfo);
+        freeTopology(&tInfo);
+    }
+    state.SetBytesProcessed(state.iterations()*data.size());
+}
+BENCHMARK(BM_ReadNewTopology)->Args({3, 256})->Args({16, 4096})->Args({64, 16384});
+
+static void BM_LoadTopologySnapshot(benchmark::State& state) {
+    std::vector<uint8_t> data = encodeTopology(state.range(0), state.range(1));
+    memStream ms = {data.data(), 0};
+    requestHeader rqh;
+    initHeader(&rqh, {0, nullptr});
+    responseHeader rsh;
+    topologyInfo tInfo, loaded;
+    readNewTopology(&ms, memReader, &rsh, &rqh, &tInfo);
+    std::vector<uint8_t> snapshot(topologySnapshotSize(&tInfo));
+    writeTopologySnapshot(snapshot.data(), &tInfo);
+    for (auto _ : state) {
+        loadTopologySnapshot(snapshot.data(), snapshot.size(), &loaded);
+        releaseTopologySnapshot(&loaded);
+    }
+    freeTopology(&tInfo);
+}
+BENCHMARK(BM_LoadTopologySnapshot)->Args({3, 256})->Args({16, 4096})->Args({64, 16384});
+
+static void BM_WriteGet(benchmark::State& state) {
+    requestHeader hdr;
+    initHeader(&hdr, {0, nullptr});
+    std::vector<uint8_t> key(state.range(0), 'k');
+    byteArray keyArr = {(int)key.size(), key.data()};
+    std::vector<uint8_t> buff(key.size()+64);
+    memStream ms = {buff.data(), 0};
+    for (auto _ : state) {
+        ms.pos = 0;
+        writeGet(&ms, memWriter, &hdr, &keyArr);
+    }
+}
+BENCHMARK(BM_WriteGet)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_HashVoidPtr(benchmark::State& state) {
+    std::vector<uint8_t> key(state.range(0), 'k');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashVoidPtr(key.data(), key.size()));
+    }
+    state.SetBytesProcessed(state.iterations()*key.size());
+}
+BENCHMARK(BM_HashVoidPtr)->Arg(4)->Arg(16)->Arg(64)->Arg(256)->Arg(4096);
+
+static void BM_MurmurHash3_x64_64(benchmark::State& state) {
+    std::vector<uint8_t> key(state.range(0), 'k');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(MurmurHash3_x64_64(key.data(), key.size(), 9001));
+    }
+    state.SetBytesProcessed(state.iterations()*key.size());
+}
+BENCHMARK(BM_MurmurHash3_x64_64)->Arg(4)->Arg(16)->Arg(64)->Arg(256)->Arg(4096);
+
+static void BM_Hash32(benchmark::State& state) {
+    uint32_t key = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hash32(key++));
+    }
+}
+BENCHMARK(BM_Hash32);
+
+static void BM_GetServerListVoidPtr(benchmark::State& state) {
+    std::vector<uint8_t> data = encodeTopology(16, state.range(0));
+    memStream ms = {data.data(), 0};
+    requestHeader rqh;
+    initHeader(&rqh, {0, nullptr});
+    responseHeader rsh;
+    topologyInfo tInfo;
+    readNewTopology(&ms, memReader, &rsh, &rqh, &tInfo);
+    uint64_t key = 0;
+    for (auto _ : state) {
+        key++;
+        benchmark::DoNotOptimize(getServerListVoidPtr(&tInfo, &key, sizeof(key)));
+    }
+    freeTopology(&tInfo);
+}
+BENCHMARK(BM_GetServerListVoidPtr)->Arg(256)->Arg(4096);
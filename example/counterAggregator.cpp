@@ -0,0 +1,211 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "counterAggregator.h"
+#include "murmurHash3.h"
+
+struct counterHandle {
+    char *name;
+    int nameLen;
+    int64_t delta;      ///< pending delta, updated atomically
+    counterAggregator *agg;
+};
+
+struct counterAggregator {
+    hotrodClient *client;
+    int flushIntervalMs;
+    int64_t flushThreshold;
+    pthread_rwlock_t lock;              ///< protects the fields below, handles live until destroy
+    counterHandle **counters;
+    int countersNum;
+    int countersCapacity;
+    int *index;                         ///< open addressing table of counter indexes, -1 if free
+    int indexSize;                      ///< power of two, twice countersCapacity
+    pthread_mutex_t flushLock;          ///< protects stopping and flushRequested
+    pthread_cond_t wakeUp;
+    int stopping;
+    int flushRequested;
+    pthread_t thread;
+};
+
+/**
+ * Slot of name in the index, the one holding its counter or the free one to insert it
+ */
+static int indexSlot(counterAggregator *agg, const char *name, int nameLen) {
+    int mask = agg->indexSize-1;
+    int slot = hashVoidPtr(name, nameLen) & mask;
+    while (agg->index[slot] >= 0) {
+        const counterHandle *c = agg->counters[agg->index[slot]];
+        if (c->nameLen == nameLen && memcmp(c->name, name, nameLen) == 0) {
+            break;
+        }
+        slot = (slot+1) & mask;
+    }
+    return slot;
+}
+
+static void growCounters(counterAggregator *agg) {
+    agg->countersCapacity *= 2;
+    agg->counters = (counterHandle**)realloc(agg->counters, sizeof(counterHandle*)*agg->countersCapacity);
+    free(agg->index);
+    agg->indexSize = 2*agg->countersCapacity;
+    agg->index = (int*)malloc(sizeof(int)*agg->indexSize);
+    memset(agg->index, -1, sizeof(int)*agg->indexSize);
+    for (int i=0; i<agg->countersNum; i++) {
+        agg->index[indexSlot(agg, agg->counters[i]->name, agg->counters[i]->nameLen)] = i;
+    }
+}
+
+counterHandle *counterGet(counterAggregator *agg, const char *name) {
+    int nameLen = strlen(name);
+    pthread_rwlock_rdlock(&agg->lock);
+    int slot = indexSlot(agg, name, nameLen);
+    counterHandle *counter = agg->index[slot] >= 0 ? agg->counters[agg->index[slot]] : nullptr;
+    pthread_rwlock_unlock(&agg->lock);
+    if (counter != nullptr) {
+        return counter;
+    }
+    pthread_rwlock_wrlock(&agg->lock);
+    // Another thread may have added it meanwhile
+    slot = indexSlot(agg, name, nameLen);
+    if (agg->index[slot] >= 0) {
+        counter = agg->counters[agg->index[slot]];
+        pthread_rwlock_unlock(&agg->lock);
+        return counter;
+    }
+    if (agg->countersNum == agg->countersCapacity) {
+        growCounters(agg);
+        slot = indexSlot(agg, name, nameLen);
+    }
+    counter = (counterHandle*)malloc(sizeof(counterHandle));
+    counter->name = (char*)malloc(nameLen+1);
+    memcpy(counter->name, name, nameLen+1);
+    counter->nameLen = nameLen;
+    counter->delta = 0;
+    counter->agg = agg;
+    agg->counters[agg->countersNum] = counter;
+    agg->index[slot] = agg->countersNum++;
+    pthread_rwlock_unlock(&agg->lock);
+    return counter;
+}
+
+static int reachesThreshold(int64_t pending, int64_t threshold) {
+    return pending >= threshold || -pending >= threshold;
+}
+
+void counterHandleAdd(counterHandle *counter, int64_t delta) {
+    counterAggregator *agg = counter->agg;
+    int64_t before = __atomic_fetch_add(&counter->delta, delta, __ATOMIC_RELAXED);
+    // Only the increment crossing the threshold wakes the flusher, the following ones
+    // would find a flush already requested
+    if (agg->flushThreshold > 0 && reachesThreshold(before+delta, agg->flushThreshold)
+            && !reachesThreshold(before, agg->flushThreshold)) {
+        pthread_mutex_lock(&agg->flushLock);
+        agg->flushRequested = 1;
+        pthread_cond_signal(&agg->wakeUp);
+        pthread_mutex_unlock(&agg->flushLock);
+    }
+}
+
+void counterAdd(counterAggregator *agg, const char *name, int64_t delta) {
+    counterHandleAdd(counterGet(agg, name), delta);
+}
+
+int counterFlush(counterAggregator *agg) {
+    pthread_rwlock_rdlock(&agg->lock);
+    int countersNum = agg->countersNum;
+    counterHandle **counters = (counterHandle**)malloc(sizeof(counterHandle*)*(countersNum > 0 ? countersNum : 1));
+    memcpy(counters, agg->counters, sizeof(counterHandle*)*countersNum);
+    pthread_rwlock_unlock(&agg->lock);
+    int res = 0;
+    for (int i=0; i<countersNum; i++) {
+        counterHandle *counter = counters[i];
+        int64_t delta = __atomic_exchange_n(&counter->delta, 0, __ATOMIC_RELAXED);
+        if (delta == 0) {
+            continue;
+        }
+        byteArray name = {counter->nameLen, (uint8_t*)counter->name};
+        int status = clientCounterAddAndGet(agg->client, &name, delta, nullptr);
+        if (status != OK_STATUS) {
+            res = status;
+        }
+        if (status < 0) {
+            // Increments added meanwhile stayed below the threshold, with the delta kept
+            // they may cross it and must not wait for the interval
+            counterHandleAdd(counter, delta);
+        }
+    }
+    free(counters);
+    return res;
+}
+
+static void *flushCounters(void *arg) {
+    counterAggregator *agg = (counterAggregator*)arg;
+    pthread_mutex_lock(&agg->flushLock);
+    while (!agg->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += agg->flushIntervalMs/1000;
+        deadline.tv_nsec += (agg->flushIntervalMs%1000)*1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!agg->stopping && !agg->flushRequested) {
+            if (pthread_cond_timedwait(&agg->wakeUp, &agg->flushLock, &deadline) != 0) {
+                break;
+            }
+        }
+        agg->flushRequested = 0;
+        pthread_mutex_unlock(&agg->flushLock);
+        counterFlush(agg);
+        pthread_mutex_lock(&agg->flushLock);
+    }
+    pthread_mutex_unlock(&agg->flushLock);
+    return nullptr;
+}
+
+counterAggregator *createCounterAggregator(hotrodClient *client, int flushIntervalMs, int64_t flushThreshold) {
+    counterAggregator *agg = (counterAggregator*)malloc(sizeof(counterAggregator));
+    agg->client = client;
+    agg->flushIntervalMs = flushIntervalMs;
+    agg->flushThreshold = flushThreshold;
+    agg->stopping = 0;
+    agg->flushRequested = 0;
+    agg->countersNum = 0;
+    agg->countersCapacity = 16;
+    agg->counters = (counterHandle**)malloc(sizeof(counterHandle*)*agg->countersCapacity);
+    agg->indexSize = 2*agg->countersCapacity;
+    agg->index = (int*)malloc(sizeof(int)*agg->indexSize);
+    memset(agg->index, -1, sizeof(int)*agg->indexSize);
+    pthread_rwlock_init(&agg->lock, nullptr);
+    pthread_mutex_init(&agg->flushLock, nullptr);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&agg->wakeUp, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_create(&agg->thread, nullptr, flushCounters, agg);
+    return agg;
+}
+
+void destroyCounterAggregator(counterAggregator *agg) {
+    pthread_mutex_lock(&agg->flushLock);
+    agg->stopping = 1;
+    pthread_cond_signal(&agg->wakeUp);
+    pthread_mutex_unlock(&agg->flushLock);
+    pthread_join(agg->thread, nullptr);
+    counterFlush(agg);
+    for (int i=0; i<agg->countersNum; i++) {
+        free(agg->counters[i]->name);
+        free(agg->counters[i]);
+    }
+    free(agg->counters);
+    free(agg->index);
+    pthread_cond_destroy(&agg->wakeUp);
+    pthread_mutex_destroy(&agg->flushLock);
+    pthread_rwlock_destroy(&agg->lock);
+    free(agg);
+}
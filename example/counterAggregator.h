@@ -0,0 +1,64 @@
+#ifndef COUNTER_AGGREGATOR_H
+#define COUNTER_AGGREGATOR_H
+
+#include "hotrodClient.h"
+
+/** @file */
+
+/**
+ * Client side aggregation of counter increments
+ *
+ * counterAdd only accumulates the delta in memory; a background thread sends the
+ * accumulated delta of each counter as a single COUNTER_ADD_AND_GET every flushIntervalMs,
+ * or earlier when a counter accumulates flushThreshold in absolute value. Many increments
+ * cost one network operation, at the price of the counter on the server lagging behind
+ * by up to an interval.
+ * A delta whose flush fails on the transport is kept for the next flush and counts towards
+ * flushThreshold with the increments added meanwhile, a delta refused
+ * by the server (e.g. the counter is not defined) is dropped.
+ */
+typedef struct counterAggregator counterAggregator;
+
+/**
+ * The pending delta of one counter, valid until the aggregator is destroyed
+ */
+typedef struct counterHandle counterHandle;
+
+/**
+ * createCounterAggregator starts the flush thread, flushThreshold 0 flushes only on interval
+ */
+counterAggregator *createCounterAggregator(hotrodClient *client, int flushIntervalMs, int64_t flushThreshold);
+
+/**
+ * counterGet finds or adds the counter name, thread safe
+ *
+ * Hot paths should look the handle up once and keep it: counterHandleAdd then costs a
+ * single atomic add, without hashing the name nor taking a lock.
+ */
+counterHandle *counterGet(counterAggregator *agg, const char *name);
+
+/**
+ * counterHandleAdd adds delta to the pending delta of counter, thread safe
+ */
+void counterHandleAdd(counterHandle *counter, int64_t delta);
+
+/**
+ * counterAdd adds delta to the pending delta of the counter name, thread safe
+ *
+ * Same as counterHandleAdd(counterGet(agg, name), delta).
+ */
+void counterAdd(counterAggregator *agg, const char *name, int64_t delta);
+
+/**
+ * counterFlush sends the pending deltas of all the counters now
+ *
+ * @return 0 or the status of the last flush that failed
+ */
+int counterFlush(counterAggregator *agg);
+
+/**
+ * destroyCounterAggregator stops the flush thread, flushes the pending deltas and releases agg
+ */
+void destroyCounterAggregator(counterAggregator *agg);
+
+#endif // COUNTER_AGGREGATOR_H
@@ -0,0 +1,1116 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hotrodClient.h"
+#include "hotrodTrace.h"
+
+static const int CONNECT_TIMEOUT_MS = 1000;
+static const int GET_ALL_WINDOW = 64;      ///< GETs in flight on a connection, bounded so the server never blocks writing
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int homeShard(hotrodClient *client) {
+    int cpu = sched_getcpu();
+    return (cpu < 0 ? 0 : cpu) % client->shardsNum;
+}
+
+static uint64_t nextMessageId(hotrodClient *client) {
+    return __atomic_add_fetch(&client->messageId, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Index of the server addr:port in the client servers, or -1
+ */
+static int findServer(hotrodClient *client, const byteArray *addr, uint16_t port) {
+    for (int i=0; i<client->serversNum; i++) {
+        clientServer *server = client->servers[i];
+        if (server->port == port && (int)strlen(server->addr) == addr->len && memcmp(server->addr, addr->buff, addr->len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Map the servers of the topology of cache to the client servers, the new ones are added
+ * and connected in parallel, shard by shard. The caller holds the topology lock for write.
+ */
+static void mapServers(hotrodClient *client, hotrodCache *cache) {
+    int serversNum = cache->tInfo.serversNum;
+    cache->slots = (uint32_t*)malloc(sizeof(uint32_t)*serversNum);
+    topologyInfo added;
+    memset(&added, 0, sizeof(added));
+    added.servers = (byteArray*)malloc(sizeof(byteArray)*serversNum);
+    added.ports = (uint16_t*)malloc(sizeof(uint16_t)*serversNum);
+    int first = client->serversNum;
+    for (int i=0; i<serversNum; i++) {
+        int slot = findServer(client, &cache->tInfo.servers[i], cache->tInfo.ports[i]);
+        if (slot < 0) {
+            slot = client->serversNum++;
+            client->servers = (clientServer**)realloc(client->servers, sizeof(clientServer*)*client->serversNum);
+            clientServer *server = (clientServer*)malloc(sizeof(clientServer));
+            const byteArray *addr = &cache->tInfo.servers[i];
+            server->addr = (char*)malloc(addr->len+1);
+            memcpy(server->addr, addr->buff, addr->len);
+            server->addr[addr->len] = 0;
+            server->port = cache->tInfo.ports[i];
+            server->conns = (clientConnection*)malloc(sizeof(clientConnection)*client->shardsNum);
+            for (int s=0; s<client->shardsNum; s++) {
+                clientConnection *conn = &server->conns[s];
+                pthread_mutex_init(&conn->lock, nullptr);
+                memset(&conn->ctx, 0, sizeof(conn->ctx));
+                conn->ctx.socket = -1;
+                conn->errors = 0;
+                if (client->metrics != nullptr) {
+                    conn->ctx.counters = &client->metrics[s].transport;
+                }
+            }
+            client->servers[slot] = server;
+            added.servers[added.serversNum] = *addr;
+            added.ports[added.serversNum] = server->port;
+            added.serversNum++;
+        }
+        cache->slots[i] = slot;
+    }
+    if (added.serversNum > 0) {
+        int *socks = (int*)malloc(sizeof(int)*added.serversNum);
+        for (int s=0; s<client->shardsNum; s++) {
+            connectServers(&added, socks, CONNECT_TIMEOUT_MS);
+            for (int i=0; i<added.serversNum; i++) {
+                client->servers[first+i]->conns[s].ctx.socket = socks[i];
+            }
+        }
+        free(socks);
+    }
+    free(added.servers);
+    free(added.ports);
+}
+
+static void closeServers(hotrodClient *client) {
+    for (int i=0; i<client->serversNum; i++) {
+        clientServer *server = client->servers[i];
+        for (int s=0; s<client->shardsNum; s++) {
+            if (server->conns[s].ctx.socket >= 0) {
+                close(server->conns[s].ctx.socket);
+            }
+            pthread_mutex_destroy(&server->conns[s].lock);
+        }
+        free(server->conns);
+        free(server->addr);
+        free(server);
+    }
+    free(client->servers);
+}
+
+/**
+ * Install a topology of cache received in a response if it is newer than the current one
+ *
+ * Responses racing on other connections can bring an older topology after a newer one
+ * has been applied, ids grow with every change of the topology of a cache so the stale
+ * one is dropped. The connections to the servers already known are kept.
+ */
+static void applyTopology(hotrodCache *cache, topologyInfo *newTopology) {
+    hotrodClient *client = cache->client;
+    pthread_rwlock_wrlock(&client->topologyLock);
+    if (cache->tInfo.serversNum == 0 || (int32_t)(newTopology->topologyId - cache->tInfo.topologyId) > 0) {
+        freeTopology(&cache->tInfo);
+        free(cache->slots);
+        cache->tInfo = *newTopology;
+        mapServers(client, cache);
+        HOTROD_TRACE3(topology__applied, cache->tInfo.topologyId, cache->tInfo.serversNum, cache->tInfo.segmentsNum);
+        if (client->metrics != nullptr) {
+            __atomic_add_fetch(&client->metrics[0].topologyChanges, 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        freeTopology(newTopology);
+    }
+    pthread_rwlock_unlock(&client->topologyLock);
+}
+
+/**
+ * Client server of the index-th server of the topology of cache, the caller holds the topology lock
+ *
+ * A cache without a topology yet uses the first server of the client.
+ */
+static uint32_t serverSlot(hotrodCache *cache, uint32_t server) {
+    return cache->tInfo.serversNum > 0 ? cache->slots[server] : 0;
+}
+
+/**
+ * Lock a connection to the client server slot, preferring the shard of the current cpu
+ */
+static clientConnection *acquireConnection(hotrodClient *client, uint32_t slot) {
+    clientConnection *conns = client->servers[slot]->conns;
+    int home = homeShard(client);
+    for (int i=0; i<client->shardsNum; i++) {
+        clientConnection *conn = &conns[(home+i) % client->shardsNum];
+        if (pthread_mutex_trylock(&conn->lock) == 0) {
+            return conn;
+        }
+    }
+    clientConnection *conn = &conns[home];
+    pthread_mutex_lock(&conn->lock);
+    return conn;
+}
+
+/**
+ * Reconnect a connection closed after a transport error
+ */
+static int ensureConnected(hotrodClient *client, clientConnection *conn, uint32_t slot) {
+    if (conn->ctx.socket >= 0) {
+        return 1;
+    }
+    clientServer *server = client->servers[slot];
+    conn->ctx.socket = getSocket(server->addr, server->port);
+    return conn->ctx.socket >= 0;
+}
+
+static uint32_t decodeKey32(const void *key) {
+    const uint8_t *b = (const uint8_t*)key;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+/**
+ * Primary owner of key in the topology of cache, the caller holds the topology lock
+ *
+ * hash32() of the little endian value of a 4 bytes key is the hash of its bytes.
+ */
+static uint32_t primaryOwner(hotrodCache *cache, const void *key, int keyLen) {
+    if (key == nullptr || cache->tInfo.segmentsNum == 0) {
+        return 0;
+    }
+    if (keyLen == INT_KEY32_SIZE) {
+        return getServerList32(&cache->tInfo, decodeKey32(key))[0];
+    }
+    return getServerListVoidPtr(&cache->tInfo, key, keyLen)[0];
+}
+
+/**
+ * Account a response, or a failure of the transport, in the metrics of the shard
+ */
+static void recordResponse(clientMetrics *m, uint8_t opCode, uint64_t start, int res) {
+    if (res != -ENOTCONN) {
+        // opCode has been set by the operation
+        metricsRecordLatency(m, opCode, nowNs()-start);
+    }
+    __atomic_add_fetch(&m->requests, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&m->inFlight, 1, __ATOMIC_RELAXED);
+    if (res < 0) {
+        __atomic_add_fetch(&m->transportErrors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int cacheExecute(hotrodCache *cache, const void *key, int keyLen, clientOperation op, void *opArgs) {
+    hotrodClient *client = cache->client;
+    requestHeader hdr = cache->hdr;
+    responseHeader rsh;
+    topologyInfo newTopology;
+    int res;
+    rsh.topologyChanged = 0;
+    pthread_rwlock_rdlock(&client->topologyLock);
+    hdr.topologyId = cache->tInfo.topologyId;
+    hdr.messageId = nextMessageId(client);
+    uint32_t server = primaryOwner(cache, key, keyLen);
+    uint32_t slot = serverSlot(cache, server);
+    HOTROD_TRACE2(client__request, hdr.messageId, server);
+    clientConnection *conn = acquireConnection(client, slot);
+    clientMetrics *m = nullptr;
+    uint64_t start = 0;
+    if (client->metrics != nullptr) {
+        m = &client->metrics[homeShard(client)];
+        __atomic_add_fetch(&m->inFlight, 1, __ATOMIC_RELAXED);
+        start = nowNs();
+    }
+    if (!ensureConnected(client, conn, slot)) {
+        res = -ENOTCONN;
+    } else {
+        conn->ctx.hasError = 0;
+        op(&conn->ctx, &hdr, &rsh, &newTopology, opArgs);
+        if (conn->ctx.hasError) {
+            // The stream is out of sync, drop the connection
+            res = -conn->ctx.hasError;
+            close(conn->ctx.socket);
+            conn->ctx.socket = -1;
+            rsh.topologyChanged = 0;
+        } else {
+            res = rsh.status;
+            if (rsh.error.buff != nullptr) {
+                free(rsh.error.buff);
+            }
+        }
+    }
+    HOTROD_TRACE4(client__response, hdr.messageId, hdr.opCode, server, res);
+    if (res < 0) {
+        __atomic_add_fetch(&conn->errors, 1, __ATOMIC_RELAXED);
+    }
+    if (m != nullptr) {
+        recordResponse(m, hdr.opCode, start, res);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    pthread_rwlock_unlock(&client->topologyLock);
+    if (rsh.topologyChanged) {
+        applyTopology(cache, &newTopology);
+    }
+    return res;
+}
+
+int clientExecute(hotrodClient *client, const void *key, int keyLen, clientOperation op, void *opArgs) {
+    return cacheExecute(&client->defaultCache, key, keyLen, op, opArgs);
+}
+
+uint32_t cachePrimaryOwner(hotrodCache *cache, const void *key, int keyLen) {
+    pthread_rwlock_rdlock(&cache->client->topologyLock);
+    uint32_t server = primaryOwner(cache, key, keyLen);
+    pthread_rwlock_unlock(&cache->client->topologyLock);
+    return server;
+}
+
+uint32_t clientPrimaryOwner(hotrodClient *client, const void *key, int keyLen) {
+    return cachePrimaryOwner(&client->defaultCache, key, keyLen);
+}
+
+hotrodCache *openCache(hotrodClient *client, const char *name) {
+    int len = strlen(name);
+    // The name lives right after the handle, one allocation per cache
+    hotrodCache *cache = (hotrodCache*)malloc(sizeof(hotrodCache)+len);
+    cache->client = client;
+    cache->hdr = client->hdr;
+    cache->hdr.cacheName.buff = (uint8_t*)(cache+1);
+    cache->hdr.cacheName.len = len;
+    memcpy(cache->hdr.cacheName.buff, name, len);
+    // Topology id 0 makes the server send the topology of the cache with the first response
+    memset(&cache->tInfo, 0, sizeof(cache->tInfo));
+    cache->slots = nullptr;
+    return cache;
+}
+
+void closeCache(hotrodCache *cache) {
+    freeTopology(&cache->tInfo);
+    free(cache->slots);
+    free(cache);
+}
+
+hotrodClient *createClient(const char *addr, uint16_t port, const requestHeader *hdr, int shardsNum) {
+    int sock = getSocket(addr, port);
+    if (sock < 0) {
+        return nullptr;
+    }
+    hotrodClient *client = (hotrodClient*)malloc(sizeof(hotrodClient));
+    client->hdr = *hdr;
+    client->defaultCache.client = client;
+    client->defaultCache.hdr = *hdr;
+    client->servers = nullptr;
+    client->serversNum = 0;
+    client->messageId = hdr->messageId;
+    client->shardsNum = shardsNum > 0 ? shardsNum : sysconf(_SC_NPROCESSORS_ONLN);
+    client->metrics = nullptr;
+    client->codec = nullptr;
+    client->compressThreshold = 0;
+    pthread_rwlock_init(&client->topologyLock, nullptr);
+
+    streamCtx ctx = {};
+    ctx.socket = sock;
+    requestHeader pingHdr = *hdr;
+    responseHeader rsh;
+    mediaType keyMt, valueMt;
+    // An unknown topology id makes the server send its topology
+    pingHdr.topologyId = 0;
+    writePing(&ctx, writer, &pingHdr);
+    readPing(&ctx, reader, &rsh, &pingHdr, &client->defaultCache.tInfo, &keyMt, &valueMt);
+    close(sock);
+    if (ctx.hasError || !rsh.topologyChanged) {
+        pthread_rwlock_destroy(&client->topologyLock);
+        free(client);
+        return nullptr;
+    }
+    mapServers(client, &client->defaultCache);
+    return client;
+}
+
+void destroyClient(hotrodClient *client) {
+    closeServers(client);
+    if (client->metrics != nullptr) {
+        for (int s=0; s<client->shardsNum; s++) {
+            freeMetrics(&client->metrics[s]);
+        }
+        free(client->metrics);
+    }
+    freeTopology(&client->defaultCache.tInfo);
+    free(client->defaultCache.slots);
+    pthread_rwlock_destroy(&client->topologyLock);
+    free(client);
+}
+
+void enableClientMetrics(hotrodClient *client) {
+    pthread_rwlock_wrlock(&client->topologyLock);
+    if (client->metrics == nullptr) {
+        client->metrics = (clientMetrics*)calloc(client->shardsNum, sizeof(clientMetrics));
+        for (int i=0; i<client->serversNum; i++) {
+            for (int s=0; s<client->shardsNum; s++) {
+                client->servers[i]->conns[s].ctx.counters = &client->metrics[s].transport;
+            }
+        }
+        enableAllocationCounting(1);
+    }
+    pthread_rwlock_unlock(&client->topologyLock);
+}
+
+int getClientMetrics(hotrodClient *client, clientMetrics *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    pthread_rwlock_rdlock(&client->topologyLock);
+    if (client->metrics == nullptr) {
+        pthread_rwlock_unlock(&client->topologyLock);
+        return -1;
+    }
+    for (int s=0; s<client->shardsNum; s++) {
+        metricsMerge(snapshot, &client->metrics[s]);
+    }
+    snapshot->serversNum = client->serversNum;
+    snapshot->serverErrors = (uint64_t*)calloc(client->serversNum, sizeof(uint64_t));
+    for (int i=0; i<client->serversNum; i++) {
+        for (int s=0; s<client->shardsNum; s++) {
+            // Read without the connection lock, a counter can be one request behind
+            snapshot->serverErrors[i] += __atomic_load_n(&client->servers[i]->conns[s].errors, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_rwlock_unlock(&client->topologyLock);
+    snapshot->allocations = allocationCount();
+    return 0;
+}
+
+typedef struct {
+    const byteArray *key;
+    const byteArray *value;
+    valueBuffer *buf;
+} keyValueArgs;
+
+/**
+ * Keep in buf->len the size of a value that didn't fit buf, decodeReadValue reports it
+ *
+ * A value read always fits its buffer, so a len greater than the capacity can't be mistaken.
+ */
+static void keepValueSize(valueBuffer *buf, uint32_t size) {
+    if (size > (uint32_t)buf->capacity) {
+        buf->len = size;
+    }
+}
+
+static void getOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    keyValueArgs *args = (keyValueArgs*)opArgs;
+    writeGet(ctx, writer, hdr, (byteArray*)args->key);
+    keepValueSize(args->buf, readGetInto(ctx, reader, rsh, hdr, newTopology, args->buf));
+}
+
+static uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Replace a framed value read from the server with the original one
+ *
+ * @return res, -ENOBUFS if the value or the original one doesn't fit a buffer that is not
+ *         growable, value->len is then the size needed, or -EBADMSG if the value can't be decoded
+ */
+static int decodeReadValue(hotrodClient *client, valueBuffer *value, int res) {
+    if (res != OK_STATUS) {
+        return res;
+    }
+    if (value->len > value->capacity) {
+        return -ENOBUFS;
+    }
+    if (!isFramedValue(value->buff, value->len)) {
+        return res;
+    }
+    uint64_t start = cpuNs();
+    int len = decodeValue(value);
+    if (client->metrics != nullptr) {
+        clientMetrics *m = &client->metrics[homeShard(client)];
+        __atomic_add_fetch(&m->decompressedValues, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&m->decompressNs, cpuNs()-start, __ATOMIC_RELAXED);
+    }
+    if (len == -ENOBUFS) {
+        return len;
+    }
+    return len < 0 ? -EBADMSG : res;
+}
+
+/**
+ * Compress a value to write as configured by setClientCompression
+ *
+ * @return value or framedArr pointing to the encoded value in framed
+ */
+static const byteArray *encodeWriteValue(hotrodClient *client, const byteArray *value, valueBuffer *framed, byteArray *framedArr) {
+    const byteArray *res = value;
+    int compress = client->codec != nullptr && value->len >= client->compressThreshold;
+    uint64_t start = compress ? cpuNs() : 0;
+    if (encodeValue(client->codec, client->compressThreshold, value, framed)) {
+        framedArr->len = framed->len;
+        framedArr->buff = framed->buff;
+        res = framedArr;
+    }
+    if (compress && client->metrics != nullptr) {
+        clientMetrics *m = &client->metrics[homeShard(client)];
+        __atomic_add_fetch(&m->compressNs, cpuNs()-start, __ATOMIC_RELAXED);
+        if (res != value && framed->buff[2] != 0) {
+            __atomic_add_fetch(&m->compressedValues, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&m->compressInBytes, value->len, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&m->compressOutBytes, framed->len, __ATOMIC_RELAXED);
+        }
+    }
+    return res;
+}
+
+int cacheGet(hotrodCache *cache, const byteArray *key, valueBuffer *value) {
+    hotrodClient *client = cache->client;
+    keyValueArgs args = {key, nullptr, value};
+    int res = cacheExecute(cache, key->buff, key->len, getOperation, &args);
+    return decodeReadValue(client, value, res);
+}
+
+int clientGet(hotrodClient *client, const byteArray *key, valueBuffer *value) {
+    return cacheGet(&client->defaultCache, key, value);
+}
+
+typedef struct {
+    uint8_t opCode;
+    const byteArray *key;
+    const byteArray *value;
+    const writeOptions *opts;
+} writeArgs;
+
+/**
+ * Run a PUT, REPLACE or REMOVE with the flags and expiration of the options
+ */
+static void writeOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    writeArgs *args = (writeArgs*)opArgs;
+    const entryExpiration *exp = nullptr;
+    valueBuffer *previous = nullptr;
+    if (args->opts != nullptr) {
+        exp = args->opts->expiration;
+        previous = args->opts->previous;
+        hdr->flags |= args->opts->flags | (previous != nullptr ? FORCE_RETURN_VALUE : 0);
+    }
+    switch (args->opCode) {
+        case PUT_REQUEST:
+            writePutWithExpiration(ctx, writer, hdr, (byteArray*)args->key, (byteArray*)args->value, exp);
+        break;
+        case REPLACE_REQUEST:
+            writeReplace(ctx, writer, hdr, (byteArray*)args->key, (byteArray*)args->value, exp);
+        break;
+        case REMOVE_REQUEST:
+            writeRemove(ctx, writer, hdr, (byteArray*)args->key);
+        break;
+    }
+    // All of them answer with a status and the previous value if asked for
+    int len = readConditional(ctx, reader, rsh, hdr, newTopology, previous);
+    if (previous != nullptr) {
+        keepValueSize(previous, len);
+    }
+}
+
+static int cacheWrite(hotrodCache *cache, uint8_t opCode, const byteArray *key, const byteArray *value, const writeOptions *opts) {
+    hotrodClient *client = cache->client;
+    valueBuffer framed = {0, 0, nullptr, 1};
+    byteArray framedArr;
+    writeArgs args = {opCode, key, value, opts};
+    if (value != nullptr) {
+        args.value = encodeWriteValue(client, value, &framed, &framedArr);
+    }
+    int res = cacheExecute(cache, key->buff, key->len, writeOperation, &args);
+    free(framed.buff);
+    // The previous value only tells whether the operation was executed
+    if (res == SUCCESS_WITH_PREVIOUS_STATUS) {
+        res = OK_STATUS;
+    } else if (res == NOT_EXECUTED_WITH_PREVIOUS_STATUS) {
+        res = NOT_PUT_REMOVED_REPLACED_STATUS;
+    }
+    if (opts != nullptr && opts->previous != nullptr) {
+        int decoded = decodeReadValue(client, opts->previous, OK_STATUS);
+        if (decoded < 0) {
+            res = decoded;
+        }
+    }
+    return res;
+}
+
+int cachePut(hotrodCache *cache, const byteArray *key, const byteArray *value) {
+    return cacheWrite(cache, PUT_REQUEST, key, value, nullptr);
+}
+
+int clientPut(hotrodClient *client, const byteArray *key, const byteArray *value) {
+    return cachePut(&client->defaultCache, key, value);
+}
+
+int cachePutWithOptions(hotrodCache *cache, const byteArray *key, const byteArray *value, const writeOptions *opts) {
+    return cacheWrite(cache, PUT_REQUEST, key, value, opts);
+}
+
+int clientPutWithOptions(hotrodClient *client, const byteArray *key, const byteArray *value, const writeOptions *opts) {
+    return cachePutWithOptions(&client->defaultCache, key, value, opts);
+}
+
+int cacheReplace(hotrodCache *cache, const byteArray *key, const byteArray *value, const writeOptions *opts) {
+    return cacheWrite(cache, REPLACE_REQUEST, key, value, opts);
+}
+
+int clientReplace(hotrodClient *client, const byteArray *key, const byteArray *value, const writeOptions *opts) {
+    return cacheReplace(&client->defaultCache, key, value, opts);
+}
+
+int cacheRemove(hotrodCache *cache, const byteArray *key, const writeOptions *opts) {
+    return cacheWrite(cache, REMOVE_REQUEST, key, nullptr, opts);
+}
+
+int clientRemove(hotrodClient *client, const byteArray *key, const writeOptions *opts) {
+    return cacheRemove(&client->defaultCache, key, opts);
+}
+
+void setClientCompression(hotrodClient *client, const valueCodec *codec, int threshold) {
+    client->codec = codec;
+    client->compressThreshold = threshold;
+}
+
+typedef struct {
+    const byteArray *key;
+    int fd;
+    off_t offset;
+    uint32_t len;
+} keyFileArgs;
+
+static void putFileOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    keyFileArgs *args = (keyFileArgs*)opArgs;
+    writePutHeader(ctx, writer, hdr, (byteArray*)args->key, args->len, nullptr);
+    sendFileRange((streamCtx*)ctx, args->fd, args->offset, args->len);
+    if (((streamCtx*)ctx)->hasError) {
+        // The server still waits for the missing value bytes, no response will come
+        return;
+    }
+    readPut(ctx, reader, rsh, hdr, newTopology, nullptr);
+}
+
+static void getFileOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    keyFileArgs *args = (keyFileArgs*)opArgs;
+    writeGet(ctx, writer, hdr, (byteArray*)args->key);
+    int len = readGetValueLength(ctx, reader, rsh, hdr, newTopology);
+    args->len = len < 0 ? 0 : len;
+    if (len > 0) {
+        recvToFile((streamCtx*)ctx, args->fd, args->offset, len);
+    }
+}
+
+int cachePutFile(hotrodCache *cache, const byteArray *key, int fd, off_t offset, uint32_t len) {
+    keyFileArgs args = {key, fd, offset, len};
+    return cacheExecute(cache, key->buff, key->len, putFileOperation, &args);
+}
+
+int clientPutFile(hotrodClient *client, const byteArray *key, int fd, off_t offset, uint32_t len) {
+    return cachePutFile(&client->defaultCache, key, fd, offset, len);
+}
+
+int cacheGetFile(hotrodCache *cache, const byteArray *key, int fd, off_t offset, uint32_t *len) {
+    keyFileArgs args = {key, fd, offset, 0};
+    int res = cacheExecute(cache, key->buff, key->len, getFileOperation, &args);
+    *len = args.len;
+    return res;
+}
+
+int clientGetFile(hotrodClient *client, const byteArray *key, int fd, off_t offset, uint32_t *len) {
+    return cacheGetFile(&client->defaultCache, key, fd, offset, len);
+}
+
+typedef struct {
+    const byteArray *name;
+    const counterConfiguration *conf;
+    int64_t delta;
+    int64_t value;
+} counterArgs;
+
+static void counterCreateOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    counterArgs *args = (counterArgs*)opArgs;
+    writeCounterCreate(ctx, writer, hdr, args->name, args->conf);
+    readCounterCreate(ctx, reader, rsh, hdr, newTopology);
+}
+
+static void counterAddAndGetOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    counterArgs *args = (counterArgs*)opArgs;
+    writeCounterAddAndGet(ctx, writer, hdr, args->name, args->delta);
+    readCounterValue(ctx, reader, rsh, hdr, newTopology, &args->value);
+}
+
+static void counterGetOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    counterArgs *args = (counterArgs*)opArgs;
+    writeCounterGet(ctx, writer, hdr, args->name);
+    readCounterValue(ctx, reader, rsh, hdr, newTopology, &args->value);
+}
+
+// Counters are not owned by a segment, any server can serve them
+
+int clientCounterCreate(hotrodClient *client, const byteArray *name, const counterConfiguration *conf) {
+    counterArgs args = {name, conf, 0, 0};
+    return clientExecute(client, nullptr, 0, counterCreateOperation, &args);
+}
+
+int clientCounterAddAndGet(hotrodClient *client, const byteArray *name, int64_t delta, int64_t *value) {
+    counterArgs args = {name, nullptr, delta, 0};
+    int res = clientExecute(client, nullptr, 0, counterAddAndGetOperation, &args);
+    if (res == OK_STATUS && value != nullptr) {
+        *value = args.value;
+    }
+    return res;
+}
+
+int clientCounterGet(hotrodClient *client, const byteArray *name, int64_t *value) {
+    counterArgs args = {name, nullptr, 0, 0};
+    int res = clientExecute(client, nullptr, 0, counterGetOperation, &args);
+    if (res == OK_STATUS) {
+        *value = args.value;
+    }
+    return res;
+}
+
+typedef struct {
+    const byteArray *key;
+    const byteArray *value;
+    valueBuffer *buf;
+    uint64_t version;
+    entryMetadata *metadata;
+} versionedArgs;
+
+static void getWithVersionOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    versionedArgs *args = (versionedArgs*)opArgs;
+    writeGetWithVersion(ctx, writer, hdr, (byteArray*)args->key);
+    keepValueSize(args->buf, readGetWithVersion(ctx, reader, rsh, hdr, newTopology, &args->version, args->buf));
+}
+
+static void getWithMetadataOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    versionedArgs *args = (versionedArgs*)opArgs;
+    writeGetWithMetadata(ctx, writer, hdr, (byteArray*)args->key);
+    keepValueSize(args->buf, readGetWithMetadata(ctx, reader, rsh, hdr, newTopology, args->metadata, args->buf));
+}
+
+static void putIfAbsentOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    versionedArgs *args = (versionedArgs*)opArgs;
+    writePutIfAbsent(ctx, writer, hdr, (byteArray*)args->key, (byteArray*)args->value, nullptr);
+    readConditional(ctx, reader, rsh, hdr, newTopology, nullptr);
+}
+
+static void replaceIfUnmodifiedOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    versionedArgs *args = (versionedArgs*)opArgs;
+    writeReplaceIfUnmodified(ctx, writer, hdr, (byteArray*)args->key, (byteArray*)args->value, args->version, nullptr);
+    readConditional(ctx, reader, rsh, hdr, newTopology, nullptr);
+}
+
+static void removeIfUnmodifiedOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    versionedArgs *args = (versionedArgs*)opArgs;
+    writeRemoveIfUnmodified(ctx, writer, hdr, (byteArray*)args->key, args->version);
+    readConditional(ctx, reader, rsh, hdr, newTopology, nullptr);
+}
+
+int cacheGetWithVersion(hotrodCache *cache, const byteArray *key, valueBuffer *value, uint64_t *version) {
+    hotrodClient *client = cache->client;
+    versionedArgs args = {key, nullptr, value, 0, nullptr};
+    int res = cacheExecute(cache, key->buff, key->len, getWithVersionOperation, &args);
+    if (res == OK_STATUS) {
+        *version = args.version;
+    }
+    return decodeReadValue(client, value, res);
+}
+
+int clientGetWithVersion(hotrodClient *client, const byteArray *key, valueBuffer *value, uint64_t *version) {
+    return cacheGetWithVersion(&client->defaultCache, key, value, version);
+}
+
+int cacheGetWithMetadata(hotrodCache *cache, const byteArray *key, valueBuffer *value, entryMetadata *metadata) {
+    hotrodClient *client = cache->client;
+    versionedArgs args = {key, nullptr, value, 0, metadata};
+    int res = cacheExecute(cache, key->buff, key->len, getWithMetadataOperation, &args);
+    return decodeReadValue(client, value, res);
+}
+
+int clientGetWithMetadata(hotrodClient *client, const byteArray *key, valueBuffer *value, entryMetadata *metadata) {
+    return cacheGetWithMetadata(&client->defaultCache, key, value, metadata);
+}
+
+int cachePutIfAbsent(hotrodCache *cache, const byteArray *key, const byteArray *value) {
+    hotrodClient *client = cache->client;
+    valueBuffer framed = {0, 0, nullptr, 1};
+    byteArray framedArr;
+    versionedArgs args = {key, encodeWriteValue(client, value, &framed, &framedArr), nullptr, 0, nullptr};
+    int res = cacheExecute(cache, key->buff, key->len, putIfAbsentOperation, &args);
+    free(framed.buff);
+    return res;
+}
+
+int clientPutIfAbsent(hotrodClient *client, const byteArray *key, const byteArray *value) {
+    return cachePutIfAbsent(&client->defaultCache, key, value);
+}
+
+int cacheReplaceIfUnmodified(hotrodCache *cache, const byteArray *key, const byteArray *value, uint64_t version) {
+    hotrodClient *client = cache->client;
+    valueBuffer framed = {0, 0, nullptr, 1};
+    byteArray framedArr;
+    versionedArgs args = {key, encodeWriteValue(client, value, &framed, &framedArr), nullptr, version, nullptr};
+    int res = cacheExecute(cache, key->buff, key->len, replaceIfUnmodifiedOperation, &args);
+    free(framed.buff);
+    return res;
+}
+
+int clientReplaceIfUnmodified(hotrodClient *client, const byteArray *key, const byteArray *value, uint64_t version) {
+    return cacheReplaceIfUnmodified(&client->defaultCache, key, value, version);
+}
+
+int cacheRemoveIfUnmodified(hotrodCache *cache, const byteArray *key, uint64_t version) {
+    versionedArgs args = {key, nullptr, nullptr, version, nullptr};
+    return cacheExecute(cache, key->buff, key->len, removeIfUnmodifiedOperation, &args);
+}
+
+int clientRemoveIfUnmodified(hotrodClient *client, const byteArray *key, uint64_t version) {
+    return cacheRemoveIfUnmodified(&client->defaultCache, key, version);
+}
+
+int cacheUpdate(hotrodCache *cache, const byteArray *key, updateFunction update, void *arg, int maxAttempts) {
+    valueBuffer current = {0, 0, nullptr, 1};
+    valueBuffer next = {0, 0, nullptr, 1};
+    int res = NOT_PUT_REMOVED_REPLACED_STATUS;
+    for (int i=0; i<maxAttempts && res == NOT_PUT_REMOVED_REPLACED_STATUS; i++) {
+        uint64_t version = 0;
+        res = cacheGetWithVersion(cache, key, &current, &version);
+        if (res != OK_STATUS && res != KEY_DOES_NOT_EXIST_STATUS) {
+            break;
+        }
+        int exists = res == OK_STATUS;
+        if (!update(exists ? &current : nullptr, &next, arg)) {
+            res = -ECANCELED;
+            break;
+        }
+        byteArray nextArr = {next.len, next.buff};
+        if (exists) {
+            res = cacheReplaceIfUnmodified(cache, key, &nextArr, version);
+        } else {
+            res = cachePutIfAbsent(cache, key, &nextArr);
+        }
+        // A key removed after the read is retried as an insert
+        if (res == KEY_DOES_NOT_EXIST_STATUS) {
+            res = NOT_PUT_REMOVED_REPLACED_STATUS;
+        }
+    }
+    free(current.buff);
+    free(next.buff);
+    return res;
+}
+
+int clientUpdate(hotrodClient *client, const byteArray *key, updateFunction update, void *arg, int maxAttempts) {
+    return cacheUpdate(&client->defaultCache, key, update, arg, maxAttempts);
+}
+
+void encodeKey32(uint32_t key, uint8_t *buff) {
+    for (int i=0; i<INT_KEY32_SIZE; i++) {
+        buff[i] = key >> 8*i;
+    }
+}
+
+void encodeKey64(uint64_t key, uint8_t *buff) {
+    for (int i=0; i<INT_KEY64_SIZE; i++) {
+        buff[i] = key >> 8*i;
+    }
+}
+
+int cacheGet32(hotrodCache *cache, uint32_t key, valueBuffer *value) {
+    uint8_t buff[INT_KEY32_SIZE];
+    encodeKey32(key, buff);
+    byteArray keyArr = {INT_KEY32_SIZE, buff};
+    return cacheGet(cache, &keyArr, value);
+}
+
+int cachePut32(hotrodCache *cache, uint32_t key, const byteArray *value) {
+    uint8_t buff[INT_KEY32_SIZE];
+    encodeKey32(key, buff);
+    byteArray keyArr = {INT_KEY32_SIZE, buff};
+    return cachePut(cache, &keyArr, value);
+}
+
+int cacheGet64(hotrodCache *cache, uint64_t key, valueBuffer *value) {
+    uint8_t buff[INT_KEY64_SIZE];
+    encodeKey64(key, buff);
+    byteArray keyArr = {INT_KEY64_SIZE, buff};
+    return cacheGet(cache, &keyArr, value);
+}
+
+int cachePut64(hotrodCache *cache, uint64_t key, const byteArray *value) {
+    uint8_t buff[INT_KEY64_SIZE];
+    encodeKey64(key, buff);
+    byteArray keyArr = {INT_KEY64_SIZE, buff};
+    return cachePut(cache, &keyArr, value);
+}
+
+typedef struct {
+    hotrodClient *client;
+    const uint32_t *keys32;     ///< nullptr for 64 bit keys
+    const uint64_t *keys64;
+    const int *indexes;         ///< of the keys of one owner
+    int count;
+    valueBuffer *values;
+    int *statuses;
+} getAllArgs;
+
+static void encodeKeyAt(const getAllArgs *args, int i, byteArray *key) {
+    if (args->keys32 != nullptr) {
+        encodeKey32(args->keys32[i], key->buff);
+        key->len = INT_KEY32_SIZE;
+    } else {
+        encodeKey64(args->keys64[i], key->buff);
+        key->len = INT_KEY64_SIZE;
+    }
+}
+
+/**
+ * Pipeline the GETs of the keys of one owner, the responses arrive in order
+ */
+static void getAllOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    getAllArgs *args = (getAllArgs*)opArgs;
+    streamCtx *sc = (streamCtx*)ctx;
+    uint8_t buff[INT_KEY64_SIZE];
+    byteArray key = {0, buff};
+    int sent = 0;
+    int received = 0;
+    int changed = 0;
+    topologyInfo latest;
+    // No delay: a refill leaves only when flushed, before its first response is read
+    corkStream(sc, 16*1024, 0);
+    for (; received < args->count && !sc->hasError; received++) {
+        // Refill the window when half empty, so the GETs leave in a few large writes
+        if (sent-received <= GET_ALL_WINDOW/2) {
+            for (; sent < args->count && sent-received < GET_ALL_WINDOW; sent++) {
+                if (sent > 0) {
+                    hdr->messageId = nextMessageId(args->client);
+                }
+                encodeKeyAt(args, args->indexes[sent], &key);
+                writeGet(ctx, corkedWriter, hdr, &key);
+            }
+            flushStream(sc);
+        }
+        int i = args->indexes[received];
+        keepValueSize(&args->values[i], readGetInto(ctx, reader, rsh, hdr, newTopology, &args->values[i]));
+        if (sc->hasError) {
+            break;
+        }
+        args->statuses[i] = rsh->status;
+        free(rsh->error.buff);
+        rsh->error.buff = nullptr;
+        // Every response after a change brings the topology again, the last one wins
+        if (rsh->topologyChanged) {
+            if (changed) {
+                freeTopology(&latest);
+            }
+            latest = *newTopology;
+            changed = 1;
+        }
+    }
+    for (; received < args->count; received++) {
+        args->statuses[args->indexes[received]] = -sc->hasError;
+    }
+    uncorkStream(sc);
+    rsh->topologyChanged = changed;
+    if (changed) {
+        *newTopology = latest;
+    }
+}
+
+static int getAll(hotrodCache *cache, const uint32_t *keys32, const uint64_t *keys64, int keysNum, valueBuffer *values, int *statuses) {
+    hotrodClient *client = cache->client;
+    if (keysNum <= 0) {
+        return OK_STATUS;
+    }
+    getAllArgs args = {client, keys32, keys64, nullptr, 0, values, statuses};
+    // Counting sort of the key indexes by owner
+    pthread_rwlock_rdlock(&client->topologyLock);
+    int serversNum = cache->tInfo.serversNum > 0 ? cache->tInfo.serversNum : 1;
+    int *owners = (int*)malloc(sizeof(int)*(keysNum*2+serversNum+1));
+    int *indexes = owners+keysNum;
+    int *starts = indexes+keysNum;
+    memset(starts, 0, sizeof(int)*(serversNum+1));
+    if (cache->tInfo.segmentsNum == 0) {
+        memset(owners, 0, sizeof(int)*keysNum);
+    } else if (keys32 != nullptr) {
+        for (int i=0; i<keysNum; i++) {
+            owners[i] = getServerList32(&cache->tInfo, keys32[i])[0];
+        }
+    } else {
+        uint8_t buff[INT_KEY64_SIZE];
+        for (int i=0; i<keysNum; i++) {
+            encodeKey64(keys64[i], buff);
+            owners[i] = getServerListVoidPtr(&cache->tInfo, buff, INT_KEY64_SIZE)[0];
+        }
+    }
+    pthread_rwlock_unlock(&client->topologyLock);
+    for (int i=0; i<keysNum; i++) {
+        starts[owners[i]+1]++;
+    }
+    for (int s=0; s<serversNum; s++) {
+        starts[s+1] += starts[s];
+    }
+    for (int i=0; i<keysNum; i++) {
+        indexes[starts[owners[i]]++] = i;
+    }
+    // starts[s] is now the end of the group of s
+    int res = OK_STATUS;
+    for (int s=0, first=0; s<serversNum; first=starts[s++]) {
+        args.indexes = indexes+first;
+        args.count = starts[s]-first;
+        if (args.count == 0) {
+            continue;
+        }
+        // The group is routed with its first key
+        uint8_t buff[INT_KEY64_SIZE];
+        byteArray key = {0, buff};
+        encodeKeyAt(&args, args.indexes[0], &key);
+        int groupRes = cacheExecute(cache, key.buff, key.len, getAllOperation, &args);
+        if (groupRes == -ENOTCONN) {
+            for (int j=0; j<args.count; j++) {
+                statuses[args.indexes[j]] = groupRes;
+            }
+        }
+        if (groupRes < 0 && res == OK_STATUS) {
+            res = groupRes;
+        }
+    }
+    free(owners);
+    for (int i=0; i<keysNum; i++) {
+        if (statuses[i] == OK_STATUS) {
+            statuses[i] = decodeReadValue(client, &values[i], OK_STATUS);
+        }
+    }
+    return res;
+}
+
+int cacheGetAll32(hotrodCache *cache, const uint32_t *keys, int keysNum, valueBuffer *values, int *statuses) {
+    return getAll(cache, keys, nullptr, keysNum, values, statuses);
+}
+
+int cacheGetAll64(hotrodCache *cache, const uint64_t *keys, int keysNum, valueBuffer *values, int *statuses) {
+    return getAll(cache, nullptr, keys, keysNum, values, statuses);
+}
+
+typedef struct {
+    const byteArray *scriptName;
+    const execParam *params;
+    int paramsNum;
+    valueBuffer *result;
+} execArgs;
+
+static void execOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    execArgs *args = (execArgs*)opArgs;
+    writeExec(ctx, writer, hdr, args->scriptName, args->params, args->paramsNum);
+    readExecInto(ctx, reader, rsh, hdr, newTopology, args->result);
+}
+
+int cacheExec(hotrodCache *cache, const byteArray *key, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *result) {
+    execArgs args = {scriptName, params, paramsNum, result};
+    if (key == nullptr) {
+        return cacheExecute(cache, nullptr, 0, execOperation, &args);
+    }
+    return cacheExecute(cache, key->buff, key->len, execOperation, &args);
+}
+
+int clientExec(hotrodClient *client, const byteArray *key, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *result) {
+    return cacheExec(&client->defaultCache, key, scriptName, params, paramsNum, result);
+}
+
+int cacheExecAll(hotrodCache *cache, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *results, int *statuses, int maxServers) {
+    hotrodClient *client = cache->client;
+    pthread_rwlock_rdlock(&client->topologyLock);
+    int serversNum = cache->tInfo.serversNum > 0 ? cache->tInfo.serversNum : 1;
+    if (serversNum > maxServers) {
+        pthread_rwlock_unlock(&client->topologyLock);
+        return -ENOSPC;
+    }
+    clientConnection **conns = (clientConnection**)malloc(sizeof(clientConnection*)*serversNum);
+    requestHeader *hdrs = (requestHeader*)malloc(sizeof(requestHeader)*serversNum);
+    int *order = (int*)malloc(sizeof(int)*serversNum);
+    // Connections are locked in client server order, whatever the topology of the cache,
+    // so two broadcasts can't wait for each other
+    for (int s=0; s<serversNum; s++) {
+        int j = s;
+        for (; j > 0 && serverSlot(cache, order[j-1]) > serverSlot(cache, s); j--) {
+            order[j] = order[j-1];
+        }
+        order[j] = s;
+    }
+    clientMetrics *m = client->metrics != nullptr ? &client->metrics[homeShard(client)] : nullptr;
+    uint64_t start = nowNs();
+    for (int i=0; i<serversNum; i++) {
+        int s = order[i];
+        uint32_t slot = serverSlot(cache, s);
+        conns[s] = acquireConnection(client, slot);
+        hdrs[s] = cache->hdr;
+        hdrs[s].topologyId = cache->tInfo.topologyId;
+        hdrs[s].messageId = nextMessageId(client);
+        statuses[s] = OK_STATUS;
+        if (m != nullptr) {
+            __atomic_add_fetch(&m->inFlight, 1, __ATOMIC_RELAXED);
+        }
+        if (!ensureConnected(client, conns[s], slot)) {
+            statuses[s] = -ENOTCONN;
+            continue;
+        }
+        conns[s]->ctx.hasError = 0;
+        writeExec(&conns[s]->ctx, writer, &hdrs[s], scriptName, params, paramsNum);
+    }
+    int changed = 0;
+    topologyInfo latest;
+    for (int s=0; s<serversNum; s++) {
+        clientConnection *conn = conns[s];
+        if (statuses[s] == OK_STATUS) {
+            responseHeader rsh;
+            topologyInfo newTopology;
+            rsh.topologyChanged = 0;
+            readExecInto(&conn->ctx, reader, &rsh, &hdrs[s], &newTopology, &results[s]);
+            if (conn->ctx.hasError) {
+                statuses[s] = -conn->ctx.hasError;
+                close(conn->ctx.socket);
+                conn->ctx.socket = -1;
+            } else {
+                statuses[s] = rsh.status;
+                free(rsh.error.buff);
+                if (rsh.topologyChanged) {
+                    if (changed) {
+                        freeTopology(&latest);
+                    }
+                    latest = newTopology;
+                    changed = 1;
+                }
+            }
+        } else {
+            results[s].len = 0;
+        }
+        if (statuses[s] < 0) {
+            __atomic_add_fetch(&conn->errors, 1, __ATOMIC_RELAXED);
+        }
+        if (m != nullptr) {
+            recordResponse(m, EXEC_REQUEST, start, statuses[s]);
+        }
+        pthread_mutex_unlock(&conn->lock);
+    }
+    pthread_rwlock_unlock(&client->topologyLock);
+    if (changed) {
+        applyTopology(cache, &latest);
+    }
+    free(order);
+    free(conns);
+    free(hdrs);
+    return serversNum;
+}
+
+int clientExecAll(hotrodClient *client, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *results, int *statuses, int maxServers) {
+    return cacheExecAll(&client->defaultCache, scriptName, params, paramsNum, results, statuses, maxServers);
+}
@@ -0,0 +1,375 @@
+#ifndef HOTROD_CLIENT_H
+#define HOTROD_CLIENT_H
+
+#include <pthread.h>
+#include "hotrod-c.h"
+#include "socketTransport.h"
+#include "hotrodMetrics.h"
+#include "valueCodec.h"
+
+/** @file */
+
+/**
+ * A connection of the client, used by one request at time
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    streamCtx ctx;          ///< socket is -1 until connected
+    uint64_t errors;        ///< transport errors seen on this connection
+} clientConnection;
+
+/**
+ * A server of the cluster and the connections of the client to it
+ */
+typedef struct {
+    char *addr;
+    uint16_t port;
+    clientConnection *conns;    ///< shardsNum connections, socket -1 until connected
+} clientServer;
+
+typedef struct hotrodClient hotrodClient;
+
+/**
+ * A cache of the cluster, served by the connections of its client
+ *
+ * All the caches of a client share its connections and metrics: the connections are kept
+ * per server address, so they and their buffers don't grow with the number of caches.
+ * Topologies are per cache on the server side, each cache keeps its own one with its id
+ * and routes with it; a server of its topology is mapped to the connections of the client
+ * to that address. Opening a cache costs no connection and no I/O: the topology comes with
+ * the response to the first request, sent meanwhile to the first server of the client.
+ */
+typedef struct {
+    hotrodClient *client;
+    requestHeader hdr;      ///< template of the requests of this cache, never modified
+    topologyInfo tInfo;     ///< serversNum is 0 until the first topology is received
+    uint32_t *slots;        ///< index in the client servers of each server of tInfo
+} hotrodCache;
+
+/**
+ * A thread safe client that many application threads can share
+ *
+ * The client keeps shardsNum connections to every server of the topologies of its caches.
+ * A thread uses the shard of the cpu it is running on, so threads on different cores don't
+ * contend for the same connection; if its connection is busy it borrows a free one from the
+ * other shards before waiting.
+ * Requests are built from a private copy of the header template and message ids are
+ * generated atomically, the topology of a cache is replaced under a write lock when a
+ * response brings a new one. Servers are only added: a server that left all the topologies
+ * keeps its slot, its connections are closed at the first error.
+ */
+struct hotrodClient {
+    requestHeader hdr;              ///< template for all the requests, never modified
+    uint64_t messageId;             ///< last message id, updated atomically
+    pthread_rwlock_t topologyLock;  ///< held for read by every request, protects servers and the cache topologies
+    clientServer **servers;
+    int serversNum;
+    int shardsNum;
+    clientMetrics *metrics;         ///< one block per shard, nullptr when metrics are disabled
+    const valueCodec *codec;        ///< compression of the put values, nullptr disables it
+    int compressThreshold;          ///< values shorter than this are not compressed
+    hotrodCache defaultCache;       ///< the cache of hdr, used by the client* operations
+};
+
+/**
+ * clientOperation writes a request and reads its response on a client connection
+ *
+ * hdr is a private copy of the client header with messageId and topologyId set,
+ * a new topology in the response must be read in newTopology.
+ */
+typedef void (*clientOperation)(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs);
+
+/**
+ * createClient bootstraps a client from a server of the cluster
+ *
+ * The server is pinged to get the topology and then all the servers are connected in parallel.
+ * shardsNum is the number of connections per server, 0 means one per online cpu.
+ *
+ * @return the client or nullptr if the bootstrap server is not available
+ */
+hotrodClient *createClient(const char *addr, uint16_t port, const requestHeader *hdr, int shardsNum);
+
+/**
+ * destroyClient closes all the connections and releases the client
+ *
+ * No other thread must be using the client.
+ */
+void destroyClient(hotrodClient *client);
+
+/**
+ * clientExecute runs an operation on the primary owner of key
+ *
+ * A nullptr key runs the operation on any server.
+ *
+ * @return the response status or a negative errno if the transport failed
+ */
+int clientExecute(hotrodClient *client, const void *key, int keyLen, clientOperation op, void *opArgs);
+
+/**
+ * clientPrimaryOwner returns the server that clientExecute would pick for key
+ *
+ * The result is an index in the servers of the current topology of the default cache.
+ */
+uint32_t clientPrimaryOwner(hotrodClient *client, const void *key, int keyLen);
+
+/**
+ * cachePrimaryOwner is clientPrimaryOwner on the topology of cache
+ */
+uint32_t cachePrimaryOwner(hotrodCache *cache, const void *key, int keyLen);
+
+/**
+ * openCache returns a handle to the cache name, served by the connections of client
+ *
+ * The handle is thread safe and must be released with closeCache before the client is destroyed.
+ */
+hotrodCache *openCache(hotrodClient *client, const char *name);
+
+/**
+ * closeCache releases a handle returned by openCache
+ */
+void closeCache(hotrodCache *cache);
+
+/**
+ * cacheExecute runs an operation on the primary owner of key, as clientExecute, on cache
+ */
+int cacheExecute(hotrodCache *cache, const void *key, int keyLen, clientOperation op, void *opArgs);
+
+/**
+ * clientGet reads the value of key into a reusable buffer, @see readGetInto
+ *
+ * Compressed values are decompressed in value, @see setClientCompression.
+ *
+ * @return the response status or a negative errno, -EBADMSG if a compressed value can't be decoded,
+ *         -ENOBUFS if value is not growable and the value doesn't fit; value->len is then the
+ *         size needed, a compressed value can need more once decompressed
+ */
+int clientGet(hotrodClient *client, const byteArray *key, valueBuffer *value);
+
+/**
+ * clientPut stores value under key
+ */
+int clientPut(hotrodClient *client, const byteArray *key, const byteArray *value);
+
+/**
+ * Options of clientPutWithOptions, clientReplace and clientRemove
+ */
+typedef struct {
+    const entryExpiration *expiration;  ///< nullptr for entries that never expire
+    uint32_t flags;                     ///< RequestFlags added to the ones of the client header
+    valueBuffer *previous;              ///< if not nullptr receives the previous value, empty if none, as clientGet
+} writeOptions;
+
+/**
+ * clientPutWithOptions stores value under key, nullptr opts is the same as clientPut
+ */
+int clientPutWithOptions(hotrodClient *client, const byteArray *key, const byteArray *value, const writeOptions *opts);
+
+/**
+ * clientReplace replaces the value of key only if it has one
+ *
+ * @return OK_STATUS, NOT_PUT_REMOVED_REPLACED_STATUS if key has no value or a negative errno
+ */
+int clientReplace(hotrodClient *client, const byteArray *key, const byteArray *value, const writeOptions *opts);
+
+/**
+ * clientRemove removes key, opts->expiration is ignored
+ *
+ * @return OK_STATUS, KEY_DOES_NOT_EXIST_STATUS if key has no value or a negative errno
+ */
+int clientRemove(hotrodClient *client, const byteArray *key, const writeOptions *opts);
+
+/**
+ * clientGetWithVersion reads the value of key and its version, as clientGet
+ */
+int clientGetWithVersion(hotrodClient *client, const byteArray *key, valueBuffer *value, uint64_t *version);
+
+/**
+ * clientGetWithMetadata reads the value of key, its version and expiration, as clientGet
+ */
+int clientGetWithMetadata(hotrodClient *client, const byteArray *key, valueBuffer *value, entryMetadata *metadata);
+
+/**
+ * clientPutIfAbsent stores value under key if key has no value
+ *
+ * @return OK_STATUS, NOT_PUT_REMOVED_REPLACED_STATUS if key has a value or a negative errno
+ */
+int clientPutIfAbsent(hotrodClient *client, const byteArray *key, const byteArray *value);
+
+/**
+ * clientReplaceIfUnmodified replaces the value of key if its version is still version
+ *
+ * @return OK_STATUS, NOT_PUT_REMOVED_REPLACED_STATUS if the value has been modified,
+ * KEY_DOES_NOT_EXIST_STATUS if it has been removed or a negative errno
+ */
+int clientReplaceIfUnmodified(hotrodClient *client, const byteArray *key, const byteArray *value, uint64_t version);
+
+/**
+ * clientRemoveIfUnmodified removes key if its version is still version, as clientReplaceIfUnmodified
+ */
+int clientRemoveIfUnmodified(hotrodClient *client, const byteArray *key, uint64_t version);
+
+/**
+ * updateFunction computes the new value of a key for clientUpdate
+ *
+ * current is nullptr if the key has no value. The new value is written in next,
+ * a growable buffer.
+ *
+ * @return 1 to write next, 0 to give up the update
+ */
+typedef int (*updateFunction)(const valueBuffer *current, valueBuffer *next, void *arg);
+
+/**
+ * clientUpdate applies update to the value of key with optimistic concurrency
+ *
+ * Each attempt reads the value with its version and writes the new value only if the
+ * version didn't change meanwhile (or the key is still absent), so concurrent updaters
+ * need no lock. update may be called more than once and must have no side effects.
+ *
+ * @return OK_STATUS, NOT_PUT_REMOVED_REPLACED_STATUS if maxAttempts attempts conflicted,
+ * -ECANCELED if update gave up or a negative errno
+ */
+int clientUpdate(hotrodClient *client, const byteArray *key, updateFunction update, void *arg, int maxAttempts);
+
+/**
+ * setClientCompression compresses the values of clientPut with codec
+ *
+ * Values of at least threshold bytes are compressed and stored framed, @see valueCodec.
+ * Reads decode any framed value whatever the setting. A nullptr codec disables compression.
+ * Values of clientPutFile and clientGetFile are transferred as they are.
+ * Must be called before the client is shared between threads.
+ */
+void setClientCompression(hotrodClient *client, const valueCodec *codec, int threshold);
+
+/**
+ * clientPutFile stores len bytes of fd from offset under key, without copying them in memory
+ *
+ * @see writePutHeader, sendFileRange
+ */
+int clientPutFile(hotrodClient *client, const byteArray *key, int fd, off_t offset, uint32_t len);
+
+/**
+ * clientGetFile writes the value of key in fd at offset
+ *
+ * To read a value into an mmap region, pass the region to clientGet() as a valueBuffer
+ * that is not growable.
+ *
+ * @return the response status or a negative errno, len is the value size (0 on a miss)
+ */
+int clientGetFile(hotrodClient *client, const byteArray *key, int fd, off_t offset, uint32_t *len);
+
+/**
+ * clientCounterCreate defines a counter, @see writeCounterCreate
+ */
+int clientCounterCreate(hotrodClient *client, const byteArray *name, const counterConfiguration *conf);
+
+/**
+ * clientCounterAddAndGet adds delta to a counter, value is set to the new value if not nullptr
+ *
+ * For frequent increments whose result is not needed @see counterAggregator.
+ */
+int clientCounterAddAndGet(hotrodClient *client, const byteArray *name, int64_t delta, int64_t *value);
+
+/**
+ * clientCounterGet reads the value of a counter
+ */
+int clientCounterGet(hotrodClient *client, const byteArray *name, int64_t *value);
+
+/**
+ * clientExec runs the server task scriptName with params on the primary owner of key
+ *
+ * A nullptr key runs the task on any server. The result is read in the reusable buffer
+ * result, as a value by clientGet but never decompressed.
+ *
+ * @return the response status or a negative errno
+ */
+int clientExec(hotrodClient *client, const byteArray *key, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *result);
+
+/**
+ * clientExecAll runs the server task scriptName with params on every server of the topology
+ *
+ * The request is written to a connection of every server before any response is read, so
+ * the tasks run in parallel and the call lasts as much as the slowest server. The result
+ * and the status, or a negative errno, of the i-th server of the topology are read in
+ * results[i] and statuses[i]. A cache that has no topology yet runs it on one server.
+ *
+ * @return the number of servers, -ENOSPC without running anything if they are more than maxServers
+ */
+int clientExecAll(hotrodClient *client, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *results, int *statuses, int maxServers);
+
+/**
+ * @name Cache operations
+ * The operations of the client on a cache opened with openCache, each one behaves as
+ * the client operation with the same name. The client operations run on the cache of
+ * the client header.
+ */
+/**@{*/
+int cacheGet(hotrodCache *cache, const byteArray *key, valueBuffer *value);
+int cachePut(hotrodCache *cache, const byteArray *key, const byteArray *value);
+int cachePutWithOptions(hotrodCache *cache, const byteArray *key, const byteArray *value, const writeOptions *opts);
+int cacheReplace(hotrodCache *cache, const byteArray *key, const byteArray *value, const writeOptions *opts);
+int cacheRemove(hotrodCache *cache, const byteArray *key, const writeOptions *opts);
+int cacheGetWithVersion(hotrodCache *cache, const byteArray *key, valueBuffer *value, uint64_t *version);
+int cacheGetWithMetadata(hotrodCache *cache, const byteArray *key, valueBuffer *value, entryMetadata *metadata);
+int cachePutIfAbsent(hotrodCache *cache, const byteArray *key, const byteArray *value);
+int cacheReplaceIfUnmodified(hotrodCache *cache, const byteArray *key, const byteArray *value, uint64_t version);
+int cacheRemoveIfUnmodified(hotrodCache *cache, const byteArray *key, uint64_t version);
+int cacheUpdate(hotrodCache *cache, const byteArray *key, updateFunction update, void *arg, int maxAttempts);
+int cachePutFile(hotrodCache *cache, const byteArray *key, int fd, off_t offset, uint32_t len);
+int cacheGetFile(hotrodCache *cache, const byteArray *key, int fd, off_t offset, uint32_t *len);
+int cacheExec(hotrodCache *cache, const byteArray *key, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *result);
+int cacheExecAll(hotrodCache *cache, const byteArray *scriptName, const execParam *params, int paramsNum, valueBuffer *results, int *statuses, int maxServers);
+/**@}*/
+
+/**
+ * @name Integer keys
+ * Integer keys are sent as their 4 or 8 bytes in little endian order, encoded on the stack,
+ * for caches whose key media type is application/octet-stream. hash32() hashes an int as
+ * its little endian bytes, so 32 bit keys (and any other 4 bytes key) are routed with it,
+ * skipping the generic hash, on the owners the server finds hashing the key bytes.
+ * Values are compressed and decompressed as in the byteArray operations.
+ */
+/**@{*/
+const int INT_KEY32_SIZE = 4;
+const int INT_KEY64_SIZE = 8;
+void encodeKey32(uint32_t key, uint8_t *buff);
+void encodeKey64(uint64_t key, uint8_t *buff);
+int cacheGet32(hotrodCache *cache, uint32_t key, valueBuffer *value);
+int cachePut32(hotrodCache *cache, uint32_t key, const byteArray *value);
+int cacheGet64(hotrodCache *cache, uint64_t key, valueBuffer *value);
+int cachePut64(hotrodCache *cache, uint64_t key, const byteArray *value);
+/**@}*/
+
+/**
+ * cacheGetAll32 reads the values of keysNum keys
+ *
+ * The keys are grouped by primary owner with one pass under the topology lock, then the GETs
+ * of every owner are pipelined on one of its connections with a bounded window of requests in
+ * flight, the groups one after the other. The value of keys[i] is read in values[i] and its status,
+ * or a negative errno if it couldn't be read, in statuses[i]; -ENOBUFS as for clientGet.
+ *
+ * @return OK_STATUS or the first negative errno of the transport
+ */
+int cacheGetAll32(hotrodCache *cache, const uint32_t *keys, int keysNum, valueBuffer *values, int *statuses);
+
+/**
+ * cacheGetAll64 is cacheGetAll32 for 64 bit keys
+ */
+int cacheGetAll64(hotrodCache *cache, const uint64_t *keys, int keysNum, valueBuffer *values, int *statuses);
+
+/**
+ * enableClientMetrics starts recording the client metrics
+ *
+ * Until enabled, metrics cost a pointer check per request.
+ */
+void enableClientMetrics(hotrodClient *client);
+
+/**
+ * getClientMetrics fills snapshot with the metrics of all the shards
+ *
+ * The snapshot must be released with freeMetrics().
+ *
+ * @return 0 or -1 if metrics are not enabled
+ */
+int getClientMetrics(hotrodClient *client, clientMetrics *snapshot);
+
+#endif // HOTROD_CLIENT_H
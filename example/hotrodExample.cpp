@@ -1,92 +1,19 @@
 #include <iostream>
-#include <errno.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <netdb.h>
-#include <fcntl.h>
-#include <poll.h>
 
 #include "hotrod-c.h"
-#include "murmurHash3.h"
+#include "socketTransport.h"
+#include "hotrodClient.h"
+#include "topologyFile.h"
 
 using namespace std;
 
-typedef struct {
-    int socket;
-    int hasError;
-} streamCtx;
-
-void reader(void *ctx, uint8_t *val, int len) {
-    streamCtx *sc = (streamCtx*)ctx;
-    int count = read( sc->socket , val, len);
-    if (!sc->hasError) {
-        sc->hasError=errno;
-    }
-}
-
-void writer(void *ctx, uint8_t *val, int len) {
-    streamCtx *sc = (streamCtx*)ctx;
-    int count = send(sc->socket, val, len, MSG_NOSIGNAL);
-    printf("Oh dear, %d %s\n", errno, strerror(errno));
-    if (!sc->hasError) {
-        sc->hasError=errno;
-    }
-}
-
-void cleaner(void *ctx) {
-    streamCtx *sc = (streamCtx*)ctx;
-    close(sc->socket);
-}
-
-int getSocket(const char * addr, uint16_t port);
-
-
-uint32_t getNormalizedHash32(uint32_t objectId) {
-    return hash32(objectId) & 0x7fffffff;
-}
-
-uint32_t getNormalizedHashVoidPtr(const void *key, int size) {
-     return hashVoidPtr(key,size) & 0x7fffffff;
-}
-
-uint32_t getSegment32(uint32_t objectId, unsigned int numSegments) {
-    uint32_t segmentSize = (uint32_t)(0x7FFFFFFFUL/numSegments)+1;
-    uint32_t hash = getNormalizedHash32(objectId);
-    return hash/segmentSize;
-}
-
-uint32_t getSegmentVoidPtr(void *key, int size, unsigned int numSegments) {
-    uint32_t segmentSize = (uint32_t)(0x7FFFFFFFUL/numSegments)+1;
-    uint32_t hash = getNormalizedHashVoidPtr(key, size);
-    return hash/segmentSize;
-}
-
-uint32_t* getServerListVoidPtr(topologyInfo *t, void *key, int size) {
-    uint32_t seg = getSegmentVoidPtr(key, size, t->segmentsNum);
-    return t->ownersPerSegment[seg];
-}
-
-uint8_t getServerListSizeVoidPtr(topologyInfo *t, void *key, int size) {
-    uint32_t seg = getSegmentVoidPtr(key, size, t->segmentsNum);
-    return t->ownersNumPerSegment[seg];
-}
-
-uint32_t* getServerList32(topologyInfo *t, uint32_t objectId) {
-    uint32_t seg = getSegment32(objectId, t->segmentsNum);
-    return t->ownersPerSegment[seg];
-}
-
-uint8_t getServerListSize32(topologyInfo *t, uint32_t objectId) {
-    uint32_t seg = getSegment32(objectId, t->segmentsNum);
-    return t->ownersNumPerSegment[seg];
-}
-
+const char *TOPOLOGY_FILE = "hotrod-topology.bin";
 
 int main() {
     int sock = getSocket("127.0.0.1",11222);
-    streamCtx ctx = {sock, 0};
+    streamCtx ctx = {};
+    ctx.socket = sock;
     requestHeader rqh, rqPutH;
     responseHeader rsh, rshPing;
     byteArray keyArr, valArr, res;
@@ -121,89 +48,128 @@ int main() {
     rqPutH.keyMediaType = mt;
     rqPutH.valueMediaType = mt;
 
-    topologyInfo tInfo;
+    topologyInfo tInfo, newTopology;
+    int hasNewTopology = 0;
     mediaType keyMt, valueMt;
 
-    writePing(&ctx, writer, &rqPutH);
-    readPing(&ctx, reader, &rshPing, &rqPutH, &tInfo, &keyMt, &valueMt);
+    // Warm start: route with the last known topology, the first response
+    // will bring the new one if the cluster has changed meanwhile
+    size_t snapshotLen = 0;
+    void *snapshot = mapTopology(TOPOLOGY_FILE, &tInfo, &snapshotLen);
+    int *socks = nullptr;
+    if (snapshot != nullptr) {
+        socks = (int*)malloc(sizeof(int)*tInfo.serversNum);
+        if (connectServers(&tInfo, socks, 1000) == 0) {
+            // Stale snapshot, no server is there anymore
+            free(socks);
+            socks = nullptr;
+            unmapTopology(snapshot, snapshotLen, &tInfo);
+            snapshot = nullptr;
+        }
+    }
+    if (socks == nullptr) {
+        writePing(&ctx, writer, &rqPutH);
+        readPing(&ctx, reader, &rshPing, &rqPutH, &tInfo, &keyMt, &valueMt);
+        if (rshPing.topologyChanged) {
+            saveTopology(TOPOLOGY_FILE, &tInfo);
+        }
+        // Connect and warm up all the servers as soon as the topology is known,
+        // so routing always finds a ready connection
+        socks = (int*)malloc(sizeof(int)*tInfo.serversNum);
+        connectServers(&tInfo, socks, 1000);
+    }
+    // Stop the servers from attaching the same topology to every response
+    rqh.topologyId = tInfo.topologyId;
+    rqPutH.topologyId = tInfo.topologyId;
+    warmUpServers(&tInfo, socks, &rqPutH);
 
     printf("Storing entry (%s,%s)\n",key, value);
 
     uint32_t* vect = getServerListVoidPtr(&tInfo, keyArr.buff, keyArr.len);
-
-    char* str = (char *)malloc(keyArr.len+1);
-    memcpy(str, tInfo.servers[vect[0]].buff,tInfo.servers[vect[0]].len);
-    str[tInfo.servers[vect[0]].len]=0;
-    int sock1 = getSocket(str, tInfo.ports[vect[0]]);
-    streamCtx ctx1 = {sock1, 0};
-
-    writePut(&ctx1, writer, &rqPutH, &keyArr, &valArr);
-    if (ctx.hasError) {
+    if (socks[vect[0]] < 0) {
+        printf("owner server not reachable\n");
+        exit(1);
+    }
+    streamCtx ctx1 = {};
+    ctx1.socket = socks[vect[0]];
+    // Put and get are pipelined: both requests leave in one send when readPut
+    // flushes the corked stream
+    corkStream(&ctx1, 16*1024, 50);
+
+    writePut(&ctx1, corkedWriter, &rqPutH, &keyArr, &valArr);
+    writeGet(&ctx1, corkedWriter, &rqh, &keyArr);
+    if (ctx1.hasError) {
         // Handle here transport error case
-        printf("writer error! %s\n", ctx1.hasError, strerror(ctx1.hasError));
+        printf("writer error! %d %s\n", ctx1.hasError, strerror(ctx1.hasError));
         exit(ctx1.hasError);
     }
-    readPut(&ctx1, reader, &rsh, &rqPutH, &tInfo, &res);
+    // A new topology is read aside: tInfo still describes the servers of socks
+    readPut(&ctx1, reader, &rsh, &rqPutH, &newTopology, &res);
     if (ctx1.hasError) {
         // Handle here transport error case
-        printf("reader error! %d %s\n", ctx.hasError, strerror(ctx.hasError));
+        printf("reader error! %d %s\n", ctx1.hasError, strerror(ctx1.hasError));
         exit(ctx1.hasError);
     }
+    if (rsh.topologyChanged) {
+        // The snapshot was stale, keep the new topology for the next start
+        saveTopology(TOPOLOGY_FILE, &newTopology);
+        hasNewTopology = 1;
+        rqh.topologyId = newTopology.topologyId;
+        rqPutH.topologyId = newTopology.topologyId;
+    }
     if (rsh.error.buff!=nullptr) {
         printf("hotrod error: %.*s\n", rsh.error.len, rsh.error.buff);
         // Handle here hotrod error case
         free(rsh.error.buff);
     }
-    writeGet(&ctx1, writer, &rqh, &keyArr);
-    if (ctx1.hasError) {
-        // Handle here transport error case
-        printf("writer error! %d %s\n", ctx1.hasError, strerror(ctx1.hasError));
-        exit(ctx1.hasError);
-    }
-    readGet(&ctx1, reader, &rsh, &rqh, &tInfo, &res);
+    topologyInfo getTopology;
+    readGet(&ctx1, reader, &rsh, &rqh, &getTopology, &res);
     if (ctx1.hasError) {
         // Handle here transport error case
         printf("reader error! %d %s\n", ctx1.hasError, strerror(ctx1.hasError));
         exit(ctx1.hasError);
     }
+    if (rsh.topologyChanged) {
+        // The get left with the old topology id as well, the latest topology wins
+        if (hasNewTopology) {
+            freeTopology(&newTopology);
+        }
+        newTopology = getTopology;
+        hasNewTopology = 1;
+        saveTopology(TOPOLOGY_FILE, &newTopology);
+    }
     if (rsh.error.buff!=nullptr) {
         printf("hotrod error: %.*s\n", rsh.error.len, rsh.error.buff);
         // Handle here the error case
         free(rsh.error.buff);
     } else {
         printf("Read entry (%s,%.*s)\n",key, res.len, res.buff);
+        free(res.buff);
     }
-    cleaner(&ctx1);
-    cleaner(&ctx);
-  return 0;
-}
-
-
-
-int getSocket(const char* str, uint16_t port) {
-    int sock = 0, valread;
-    struct sockaddr_in serv_addr;
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
-    { 
-        printf("\n Socket creation error \n"); 
-        return -1; 
-    } 
-   	int flags = fcntl(sock, F_GETFL, 0);
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-
-    // Convert IPv4 and IPv6 addresses from text to binary form 
-    if(inet_pton(AF_INET, str, &serv_addr.sin_addr)<=0)
-    { 
-        printf("\nInvalid address/ Address not supported \n"); 
-        return -1; 
+    uncorkStream(&ctx1);
+    // socks has one entry per server of tInfo, whatever topology came later
+    closeServers(&tInfo, socks);
+    free(socks);
+    if (snapshot != nullptr) {
+        unmapTopology(snapshot, snapshotLen, &tInfo);
+    } else {
+        freeTopology(&tInfo);
+    }
+    if (hasNewTopology) {
+        freeTopology(&newTopology);
     }
+    cleaner(&ctx);
 
-    connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-    if (sock < 0)
-    { 
-        printf("\nConnection Failed \n"); 
-        return -1; 
+    // Same get through the thread safe client, that can be shared by all the application threads
+    hotrodClient *client = createClient("127.0.0.1", 11222, &rqh, 0);
+    if (client != nullptr) {
+        valueBuffer buf = {0, 0, nullptr, 1};
+        if (clientGet(client, &keyArr, &buf) == 0) {
+            printf("Read entry with client (%s,%.*s)\n", key, buf.len, buf.buff);
+        }
+        free(buf.buff);
+        destroyClient(client);
     }
-    return sock;
+  return 0;
 }
+
@@ -0,0 +1,486 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hotrod-c.h"
+#include "socketTransport.h"
+
+/** @file
+ * Bulk loader: seeds a cache with the records of a file.
+ *
+ * The file is memory mapped and parsed by the main thread, which routes every record to
+ * the primary owner of its key and hands the records to the server in batches. Each server
+ * is written by its own threads and connections, every connection keeps up to --pipeline
+ * puts in flight, written with corkedWriter so many puts leave with one syscall.
+ * Records point into the mapping, keys and values are never copied.
+ *
+ * Input formats:
+ * - binary: records of 4 bytes big endian key length, key, 4 bytes big endian value length, value
+ * - text: one record per line, key and value split by the first separator (tab by default)
+ */
+
+static const int BATCH_RECORDS = 1024;
+static const int QUEUE_BATCHES = 8;     ///< batches waiting per connection, bounds the parser lead
+
+typedef struct {
+    uint8_t *key;
+    uint32_t keyLen;
+    uint8_t *value;
+    uint32_t valueLen;
+} loadRecord;
+
+typedef struct {
+    int count;
+    loadRecord records[BATCH_RECORDS];
+} recordBatch;
+
+/**
+ * Bounded queue of the batches of a server, shared by its writer threads
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    recordBatch **batches;
+    int capacity;
+    int head;
+    int count;
+    int closed;                 ///< no more batches will be pushed
+} batchQueue;
+
+typedef struct {
+    const char *host;
+    uint16_t port;
+    const char *cacheName;
+    const char *input;
+    int text;
+    char separator;
+    int connections;
+    int pipeline;
+} loaderConfig;
+
+typedef struct {
+    uint64_t written;           ///< records stored
+    uint64_t failed;            ///< records refused by the server
+    uint64_t lost;              ///< records not stored because the connection failed
+    uint64_t bytes;             ///< key and value bytes stored
+} serverStats;
+
+typedef struct {
+    const loaderConfig *config;
+    const topologyInfo *tInfo;
+    const requestHeader *hdr;
+    int server;
+    batchQueue *queue;
+    serverStats stats;
+} writerState;
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void initQueue(batchQueue *q, int capacity) {
+    pthread_mutex_init(&q->lock, nullptr);
+    pthread_cond_init(&q->notEmpty, nullptr);
+    pthread_cond_init(&q->notFull, nullptr);
+    q->batches = (recordBatch**)malloc(sizeof(recordBatch*)*capacity);
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+}
+
+static void destroyQueue(batchQueue *q) {
+    free(q->batches);
+    pthread_cond_destroy(&q->notFull);
+    pthread_cond_destroy(&q->notEmpty);
+    pthread_mutex_destroy(&q->lock);
+}
+
+static void pushBatch(batchQueue *q, recordBatch *batch) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity) {
+        pthread_cond_wait(&q->notFull, &q->lock);
+    }
+    q->batches[(q->head+q->count) % q->capacity] = batch;
+    q->count++;
+    pthread_cond_signal(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * @return the next batch or nullptr when the queue is closed and empty
+ */
+static recordBatch *popBatch(batchQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) {
+        pthread_cond_wait(&q->notEmpty, &q->lock);
+    }
+    recordBatch *batch = nullptr;
+    if (q->count > 0) {
+        batch = q->batches[q->head];
+        q->head = (q->head+1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->notFull);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return batch;
+}
+
+static void closeQueue(batchQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int connectServer(const topologyInfo *tInfo, int server) {
+    char addr[256];
+    int len = tInfo->servers[server].len < (int)sizeof(addr)-1 ? tInfo->servers[server].len : (int)sizeof(addr)-1;
+    memcpy(addr, tInfo->servers[server].buff, len);
+    addr[len] = 0;
+    return getSocket(addr, tInfo->ports[server]);
+}
+
+/**
+ * Write the records of a batch keeping up to pipeline puts in flight
+ *
+ * @return the number of records whose response has been read
+ */
+static int writeBatch(writerState *w, streamCtx *ctx, requestHeader *hdr, const recordBatch *batch) {
+    int sent = 0;
+    int received = 0;
+    while (received < batch->count && !ctx->hasError) {
+        while (sent < batch->count && sent-received < w->config->pipeline) {
+            loadRecord *r = (loadRecord*)&batch->records[sent++];
+            byteArray key = {(int)r->keyLen, r->key};
+            byteArray value = {(int)r->valueLen, r->value};
+            hdr->messageId++;
+            writePut(ctx, corkedWriter, hdr, &key, &value);
+        }
+        responseHeader rsh;
+        topologyInfo newTopology;
+        // reader flushes the corked puts before waiting for the first response
+        readPut(ctx, reader, &rsh, hdr, &newTopology, nullptr);
+        if (ctx->hasError) {
+            break;
+        }
+        if (rsh.topologyChanged) {
+            // Non owners forward the writes, the load goes on with the initial routing
+            freeTopology(&newTopology);
+        }
+        free(rsh.error.buff);
+        const loadRecord *r = &batch->records[received++];
+        if (rsh.status == OK_STATUS) {
+            w->stats.written++;
+            w->stats.bytes += r->keyLen+r->valueLen;
+        } else {
+            w->stats.failed++;
+        }
+    }
+    return received;
+}
+
+static void *writeRecords(void *arg) {
+    writerState *w = (writerState*)arg;
+    requestHeader hdr = *w->hdr;
+    streamCtx ctx = {};
+    ctx.socket = -1;
+    recordBatch *batch;
+    while ((batch = popBatch(w->queue)) != nullptr) {
+        if (ctx.socket < 0) {
+            // A failed connection is retried once per batch
+            memset(&ctx, 0, sizeof(ctx));
+            ctx.socket = connectServer(w->tInfo, w->server);
+            if (ctx.socket >= 0) {
+                corkStream(&ctx, 64*1024, 1000);
+            }
+        }
+        int done = ctx.socket >= 0 ? writeBatch(w, &ctx, &hdr, batch) : 0;
+        w->stats.lost += batch->count-done;
+        if (ctx.socket >= 0 && ctx.hasError) {
+            uncorkStream(&ctx);
+            close(ctx.socket);
+            ctx.socket = -1;
+        }
+        free(batch);
+    }
+    if (ctx.socket >= 0) {
+        uncorkStream(&ctx);
+        close(ctx.socket);
+    }
+    return nullptr;
+}
+
+static uint32_t readLength(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * Parse the next record from *pos
+ *
+ * @return 1 if a record has been parsed, 0 at the end of the input, -1 for a malformed record
+ */
+static int nextRecord(const loaderConfig *config, uint8_t **pos, uint8_t *end, loadRecord *r) {
+    uint8_t *p = *pos;
+    if (!config->text) {
+        if (p == end) {
+            return 0;
+        }
+        // A truncated record ends the input
+        *pos = end;
+        if (end-p < 4 || (uint64_t)(end-p-4) < readLength(p)+4ULL) {
+            return -1;
+        }
+        r->keyLen = readLength(p);
+        r->key = p+4;
+        p += 4+r->keyLen;
+        if ((uint64_t)(end-p-4) < readLength(p)) {
+            return -1;
+        }
+        r->valueLen = readLength(p);
+        r->value = p+4;
+        *pos = p+4+r->valueLen;
+        return 1;
+    }
+    for (;;) {
+        if (p == end) {
+            *pos = p;
+            return 0;
+        }
+        uint8_t *eol = (uint8_t*)memchr(p, '\n', end-p);
+        uint8_t *next = eol != nullptr ? eol+1 : end;
+        uint8_t *lineEnd = eol != nullptr ? eol : end;
+        if (lineEnd > p && lineEnd[-1] == '\r') {
+            lineEnd--;
+        }
+        if (lineEnd == p) {
+            p = next;
+            continue;
+        }
+        *pos = next;
+        uint8_t *sep = (uint8_t*)memchr(p, config->separator, lineEnd-p);
+        if (sep == nullptr) {
+            return -1;
+        }
+        r->key = p;
+        r->keyLen = sep-p;
+        r->value = sep+1;
+        r->valueLen = lineEnd-sep-1;
+        return 1;
+    }
+}
+
+/**
+ * Get the topology of the cluster from the bootstrap server
+ */
+static int bootstrapTopology(const loaderConfig *config, requestHeader *hdr, topologyInfo *tInfo) {
+    int sock = getSocket(config->host, config->port);
+    if (sock < 0) {
+        return -1;
+    }
+    streamCtx ctx = {};
+    ctx.socket = sock;
+    responseHeader rsh;
+    mediaType keyMt, valueMt;
+    // An unknown topology id makes the server send its topology
+    hdr->topologyId = 0;
+    writePing(&ctx, writer, hdr);
+    readPing(&ctx, reader, &rsh, hdr, tInfo, &keyMt, &valueMt);
+    close(sock);
+    if (ctx.hasError || !rsh.topologyChanged) {
+        return -1;
+    }
+    hdr->topologyId = tInfo->topologyId;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s --server host:port [options] file\n"
+           "  --server host:port     bootstrap server of the cluster to load\n"
+           "  --cache name           cache to load, default is the default cache\n"
+           "  --format f             binary or text (binary)\n"
+           "  --separator c          key/value separator of the text format (tab)\n"
+           "  --connections n        connections per server (2)\n"
+           "  --pipeline n           puts in flight per connection (128)\n", prog);
+}
+
+int main(int argc, char **argv) {
+    loaderConfig config = {nullptr, 0, nullptr, nullptr, 0, '\t', 2, 128};
+    static struct option options[] = {
+        {"server", required_argument, nullptr, 'S'},
+        {"cache", required_argument, nullptr, 'C'},
+        {"format", required_argument, nullptr, 'f'},
+        {"separator", required_argument, nullptr, 's'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"pipeline", required_argument, nullptr, 'P'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+    char host[256];
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'S': {
+                const char *colon = strrchr(optarg, ':');
+                if (colon == nullptr || colon-optarg >= (int)sizeof(host)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                memcpy(host, optarg, colon-optarg);
+                host[colon-optarg] = 0;
+                config.host = host;
+                config.port = atoi(colon+1);
+            }
+            break;
+            case 'C': config.cacheName = optarg; break;
+            case 'f': config.text = strcmp(optarg, "text") == 0; break;
+            case 's': config.separator = optarg[0]; break;
+            case 'c': config.connections = atoi(optarg); break;
+            case 'P': config.pipeline = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (config.host == nullptr || optind != argc-1 || config.connections < 1 || config.pipeline < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    config.input = argv[optind];
+
+    int fd = open(config.input, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("can't open %s: %s\n", config.input, strerror(errno));
+        return 1;
+    }
+    uint8_t *data = nullptr;
+    if (st.st_size > 0) {
+        data = (uint8_t*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            printf("can't map %s: %s\n", config.input, strerror(errno));
+            return 1;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    requestHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = 0xA0;
+    hdr.version = 30;
+    hdr.clientIntelligence = CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE;
+    if (config.cacheName != nullptr) {
+        hdr.cacheName.buff = (uint8_t*)config.cacheName;
+        hdr.cacheName.len = strlen(config.cacheName);
+    }
+    topologyInfo tInfo;
+    if (bootstrapTopology(&config, &hdr, &tInfo) != 0) {
+        printf("can't get the topology from %s:%d\n", config.host, config.port);
+        return 1;
+    }
+
+    int serversNum = tInfo.serversNum;
+    int writersNum = serversNum*config.connections;
+    batchQueue *queues = (batchQueue*)malloc(sizeof(batchQueue)*serversNum);
+    recordBatch **pending = (recordBatch**)malloc(sizeof(recordBatch*)*serversNum);
+    for (int i=0; i<serversNum; i++) {
+        initQueue(&queues[i], QUEUE_BATCHES*config.connections);
+        pending[i] = nullptr;
+    }
+    writerState *writers = (writerState*)calloc(writersNum, sizeof(writerState));
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t)*writersNum);
+    uint64_t start = nowNs();
+    for (int i=0; i<writersNum; i++) {
+        writers[i].config = &config;
+        writers[i].tInfo = &tInfo;
+        writers[i].hdr = &hdr;
+        writers[i].server = i % serversNum;
+        writers[i].queue = &queues[i % serversNum];
+        pthread_create(&threads[i], nullptr, writeRecords, &writers[i]);
+    }
+
+    uint64_t records = 0;
+    uint64_t malformed = 0;
+    uint8_t *pos = data;
+    uint8_t *end = data+st.st_size;
+    loadRecord r;
+    int res;
+    while ((res = nextRecord(&config, &pos, end, &r)) != 0) {
+        if (res < 0) {
+            malformed++;
+            continue;
+        }
+        records++;
+        int server = getServerListVoidPtr(&tInfo, r.key, r.keyLen)[0];
+        if (pending[server] == nullptr) {
+            pending[server] = (recordBatch*)malloc(sizeof(recordBatch));
+            pending[server]->count = 0;
+        }
+        pending[server]->records[pending[server]->count++] = r;
+        if (pending[server]->count == BATCH_RECORDS) {
+            pushBatch(&queues[server], pending[server]);
+            pending[server] = nullptr;
+        }
+    }
+    for (int i=0; i<serversNum; i++) {
+        if (pending[i] != nullptr) {
+            pushBatch(&queues[i], pending[i]);
+        }
+        closeQueue(&queues[i]);
+    }
+
+    serverStats total = {0, 0, 0, 0};
+    serverStats *perServer = (serverStats*)calloc(serversNum, sizeof(serverStats));
+    for (int i=0; i<writersNum; i++) {
+        pthread_join(threads[i], nullptr);
+        serverStats *s = &perServer[writers[i].server];
+        s->written += writers[i].stats.written;
+        s->failed += writers[i].stats.failed;
+        s->lost += writers[i].stats.lost;
+        s->bytes += writers[i].stats.bytes;
+    }
+    double seconds = (nowNs()-start)/1e9;
+    for (int i=0; i<serversNum; i++) {
+        printf("[SERVER %.*s:%d] Written, %llu, Failed, %llu, Lost, %llu\n",
+            tInfo.servers[i].len, (char*)tInfo.servers[i].buff, tInfo.ports[i], (unsigned long long)perServer[i].written,
+            (unsigned long long)perServer[i].failed, (unsigned long long)perServer[i].lost);
+        total.written += perServer[i].written;
+        total.failed += perServer[i].failed;
+        total.lost += perServer[i].lost;
+        total.bytes += perServer[i].bytes;
+    }
+    printf("[LOAD] Records, %llu\n", (unsigned long long)records);
+    printf("[LOAD] Malformed, %llu\n", (unsigned long long)malformed);
+    printf("[LOAD] Written, %llu\n", (unsigned long long)total.written);
+    printf("[LOAD] Failed, %llu\n", (unsigned long long)total.failed);
+    printf("[LOAD] Lost, %llu\n", (unsigned long long)total.lost);
+    printf("[LOAD] RunTime(s), %.3f\n", seconds);
+    printf("[LOAD] Throughput(records/sec), %.1f\n", total.written/seconds);
+    printf("[LOAD] Throughput(MB/sec), %.2f\n", total.bytes/seconds/1e6);
+
+    for (int i=0; i<serversNum; i++) {
+        destroyQueue(&queues[i]);
+    }
+    free(perServer);
+    free(threads);
+    free(writers);
+    free(pending);
+    free(queues);
+    freeTopology(&tInfo);
+    if (data != nullptr) {
+        munmap(data, st.st_size);
+    }
+    return total.failed+total.lost+malformed > 0 ? 2 : 0;
+}
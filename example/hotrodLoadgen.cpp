@@ -0,0 +1,352 @@
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hotrodClient.h"
+#include "latencyHistogram.h"
+#include "standInServer.h"
+
+/** @file
+ * YCSB style load generator: loads recordsNum records and then runs a read/update mix from
+ * many threads sharing one hotrodClient, reporting throughput and latency percentiles.
+ * Without --server a local stand-in cluster is started on loopback.
+ */
+
+typedef struct {
+    const char *host;
+    uint16_t port;
+    int nodes;
+    int segments;
+    int threads;
+    int shards;
+    int duration;
+    uint64_t records;
+    double readProportion;
+    int zipfian;
+    int valueSize;
+    int metrics;
+    const char *compression;
+    int compressThreshold;
+} loadgenConfig;
+
+/**
+ * Zipfian distribution over [0, items) as in YCSB, with the item scrambled by a hash
+ * so the hot keys are spread over the key space (and the servers)
+ */
+typedef struct {
+    uint64_t items;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipfianGenerator;
+
+typedef struct {
+    hotrodClient *client;
+    const loadgenConfig *config;
+    const zipfianGenerator *zipf;
+    int index;
+    volatile int *running;
+    uint64_t seed;
+    latencyHistogram reads;
+    latencyHistogram updates;
+    uint64_t errors;
+} workerState;
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// xorshift64*, one state per thread
+static uint64_t nextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double nextDouble(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+static uint64_t fnvHash64(uint64_t val) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i=0; i<8; i++) {
+        hash ^= val & 0xff;
+        hash *= 1099511628211ULL;
+        val >>= 8;
+    }
+    return hash;
+}
+
+static void initZipfian(zipfianGenerator *z, uint64_t items, double theta) {
+    double zeta2 = 1.0 + 1.0/pow(2.0, theta);
+    z->items = items;
+    z->theta = theta;
+    z->alpha = 1.0/(1.0-theta);
+    z->zetan = 0;
+    for (uint64_t i=1; i<=items; i++) {
+        z->zetan += 1.0/pow((double)i, theta);
+    }
+    z->eta = (1.0-pow(2.0/items, 1.0-theta))/(1.0-zeta2/z->zetan);
+}
+
+static uint64_t nextZipfian(const zipfianGenerator *z, uint64_t *state) {
+    double u = nextDouble(state);
+    double uz = u*z->zetan;
+    uint64_t item;
+    if (uz < 1.0) {
+        item = 0;
+    } else if (uz < 1.0+pow(0.5, z->theta)) {
+        item = 1;
+    } else {
+        item = (uint64_t)(z->items*pow(z->eta*u-z->eta+1.0, z->alpha));
+    }
+    return fnvHash64(item) % z->items;
+}
+
+static int formatKey(char *buff, uint64_t keyNum) {
+    return sprintf(buff, "user%012llu", (unsigned long long)keyNum);
+}
+
+static void *loadRecords(void *arg) {
+    workerState *w = (workerState*)arg;
+    char key[32];
+    uint8_t *value = (uint8_t*)malloc(w->config->valueSize);
+    for (int i=0; i<w->config->valueSize; i++) {
+        value[i] = 'a' + nextRandom(&w->seed) % 26;
+    }
+    byteArray valArr = {w->config->valueSize, value};
+    for (uint64_t k=w->index; k<w->config->records; k+=w->config->threads) {
+        byteArray keyArr = {formatKey(key, k), (uint8_t*)key};
+        if (clientPut(w->client, &keyArr, &valArr) != OK_STATUS) {
+            w->errors++;
+        }
+    }
+    free(value);
+    return nullptr;
+}
+
+static void *runWorkload(void *arg) {
+    workerState *w = (workerState*)arg;
+    char key[32];
+    uint8_t *value = (uint8_t*)malloc(w->config->valueSize);
+    for (int i=0; i<w->config->valueSize; i++) {
+        value[i] = 'a' + nextRandom(&w->seed) % 26;
+    }
+    byteArray valArr = {w->config->valueSize, value};
+    valueBuffer buf = {0, 0, nullptr, 1};
+    while (*w->running) {
+        uint64_t keyNum = w->config->zipfian ? nextZipfian(w->zipf, &w->seed)
+                                             : nextRandom(&w->seed) % w->config->records;
+        byteArray keyArr = {formatKey(key, keyNum), (uint8_t*)key};
+        int isRead = nextDouble(&w->seed) < w->config->readProportion;
+        uint64_t start = nowNs();
+        int res = isRead ? clientGet(w->client, &keyArr, &buf) : clientPut(w->client, &keyArr, &valArr);
+        uint64_t elapsed = nowNs()-start;
+        if (res != OK_STATUS) {
+            w->errors++;
+        }
+        histogramRecord(isRead ? &w->reads : &w->updates, elapsed);
+    }
+    free(buf.buff);
+    free(value);
+    return nullptr;
+}
+
+static void report(const char *name, const latencyHistogram *h, double seconds) {
+    if (h->total == 0) {
+        return;
+    }
+    printf("[%s] Operations, %llu\n", name, (unsigned long long)h->total);
+    printf("[%s] Throughput(ops/sec), %.1f\n", name, h->total/seconds);
+    printf("[%s] AverageLatency(us), %.2f\n", name, h->sum/1000.0/h->total);
+    printf("[%s] MinLatency(us), %.2f\n", name, h->min/1000.0);
+    printf("[%s] 50thPercentileLatency(us), %.2f\n", name, histogramPercentile(h, 50)/1000.0);
+    printf("[%s] 95thPercentileLatency(us), %.2f\n", name, histogramPercentile(h, 95)/1000.0);
+    printf("[%s] 99thPercentileLatency(us), %.2f\n", name, histogramPercentile(h, 99)/1000.0);
+    printf("[%s] 99.9thPercentileLatency(us), %.2f\n", name, histogramPercentile(h, 99.9)/1000.0);
+    printf("[%s] MaxLatency(us), %.2f\n", name, h->max/1000.0);
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [options]\n"
+           "  --server host:port     cluster to load, default is a local stand-in server\n"
+           "  --nodes n              stand-in server nodes (3)\n"
+           "  --port p               stand-in server first port (11322)\n"
+           "  --segments n           stand-in server segments (256)\n"
+           "  --threads n            client threads (4)\n"
+           "  --shards n             connections per server, 0 is one per cpu (0)\n"
+           "  --duration s           run phase seconds (10)\n"
+           "  --records n            number of keys (10000)\n"
+           "  --read-proportion r    fraction of reads, the rest are updates (0.95)\n"
+           "  --distribution d       uniform or zipfian (zipfian)\n"
+           "  --value-size n         value bytes (100)\n"
+           "  --compression codec    compress the values, e.g. zlib (none)\n"
+           "  --compress-threshold n smallest value to compress (64)\n"
+           "  --metrics              dump the client metrics at the end\n", prog);
+}
+
+int main(int argc, char **argv) {
+    loadgenConfig config = {nullptr, 11322, 3, 256, 4, 0, 10, 10000, 0.95, 1, 100, 0, nullptr, 64};
+    static struct option options[] = {
+        {"server", required_argument, nullptr, 'S'},
+        {"nodes", required_argument, nullptr, 'n'},
+        {"port", required_argument, nullptr, 'p'},
+        {"segments", required_argument, nullptr, 'g'},
+        {"threads", required_argument, nullptr, 't'},
+        {"shards", required_argument, nullptr, 's'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"records", required_argument, nullptr, 'r'},
+        {"read-proportion", required_argument, nullptr, 'R'},
+        {"distribution", required_argument, nullptr, 'D'},
+        {"value-size", required_argument, nullptr, 'v'},
+        {"compression", required_argument, nullptr, 'c'},
+        {"compress-threshold", required_argument, nullptr, 'T'},
+        {"metrics", no_argument, nullptr, 'm'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+    char host[256] = "127.0.0.1";
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'S': {
+                const char *colon = strrchr(optarg, ':');
+                if (colon == nullptr || colon-optarg >= (int)sizeof(host)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                memcpy(host, optarg, colon-optarg);
+                host[colon-optarg] = 0;
+                config.host = host;
+                config.port = atoi(colon+1);
+            }
+            break;
+            case 'n': config.nodes = atoi(optarg); break;
+            case 'p': config.port = atoi(optarg); break;
+            case 'g': config.segments = atoi(optarg); break;
+            case 't': config.threads = atoi(optarg); break;
+            case 's': config.shards = atoi(optarg); break;
+            case 'd': config.duration = atoi(optarg); break;
+            case 'r': config.records = strtoull(optarg, nullptr, 10); break;
+            case 'R': config.readProportion = atof(optarg); break;
+            case 'D': config.zipfian = strcmp(optarg, "uniform") != 0; break;
+            case 'v': config.valueSize = atoi(optarg); break;
+            case 'c': config.compression = optarg; break;
+            case 'T': config.compressThreshold = atoi(optarg); break;
+            case 'm': config.metrics = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    const valueCodec *codec = nullptr;
+    if (config.compression != nullptr) {
+        codec = findValueCodec(config.compression);
+        if (codec == nullptr) {
+            printf("unknown compression codec %s\n", config.compression);
+            return 1;
+        }
+    }
+
+    standInServer *server = nullptr;
+    if (config.host == nullptr) {
+        server = startStandInServer(config.port, config.nodes, config.segments);
+        if (server == nullptr) {
+            printf("can't start the stand-in server on port %d\n", config.port);
+            return 1;
+        }
+        config.host = host;
+    }
+
+    requestHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = 0xA0;
+    hdr.version = 30;
+    hdr.clientIntelligence = CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE;
+    hotrodClient *client = createClient(config.host, config.port, &hdr, config.shards);
+    if (client == nullptr) {
+        printf("can't connect to %s:%d\n", config.host, config.port);
+        return 1;
+    }
+    setClientCompression(client, codec, config.compressThreshold);
+    if (config.metrics) {
+        enableClientMetrics(client);
+    }
+
+    zipfianGenerator zipf;
+    if (config.zipfian) {
+        initZipfian(&zipf, config.records, 0.99);
+    }
+    volatile int running = 1;
+    workerState *workers = (workerState*)malloc(sizeof(workerState)*config.threads);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t)*config.threads);
+    for (int i=0; i<config.threads; i++) {
+        workers[i].client = client;
+        workers[i].config = &config;
+        workers[i].zipf = &zipf;
+        workers[i].index = i;
+        workers[i].running = &running;
+        workers[i].seed = 0x9E3779B97F4A7C15ULL*(i+1);
+        workers[i].errors = 0;
+        histogramReset(&workers[i].reads);
+        histogramReset(&workers[i].updates);
+    }
+
+    uint64_t start = nowNs();
+    for (int i=0; i<config.threads; i++) {
+        pthread_create(&threads[i], nullptr, loadRecords, &workers[i]);
+    }
+    for (int i=0; i<config.threads; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    double loadSeconds = (nowNs()-start)/1e9;
+    printf("[LOAD] RunTime(s), %.3f\n", loadSeconds);
+    printf("[LOAD] Throughput(ops/sec), %.1f\n", config.records/loadSeconds);
+
+    start = nowNs();
+    for (int i=0; i<config.threads; i++) {
+        pthread_create(&threads[i], nullptr, runWorkload, &workers[i]);
+    }
+    struct timespec duration = {config.duration, 0};
+    nanosleep(&duration, nullptr);
+    running = 0;
+    latencyHistogram reads, updates;
+    histogramReset(&reads);
+    histogramReset(&updates);
+    uint64_t errors = 0;
+    for (int i=0; i<config.threads; i++) {
+        pthread_join(threads[i], nullptr);
+        histogramMerge(&reads, &workers[i].reads);
+        histogramMerge(&updates, &workers[i].updates);
+        errors += workers[i].errors;
+    }
+    double seconds = (nowNs()-start)/1e9;
+    printf("[OVERALL] RunTime(s), %.3f\n", seconds);
+    printf("[OVERALL] Throughput(ops/sec), %.1f\n", (reads.total+updates.total)/seconds);
+    printf("[OVERALL] Errors, %llu\n", (unsigned long long)errors);
+    report("READ", &reads, seconds);
+    report("UPDATE", &updates, seconds);
+    if (config.metrics) {
+        clientMetrics snapshot;
+        getClientMetrics(client, &snapshot);
+        dumpMetrics(&snapshot, stdout);
+        freeMetrics(&snapshot);
+    }
+
+    destroyClient(client);
+    if (server != nullptr) {
+        stopStandInServer(server);
+    }
+    free(threads);
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hotrodMetrics.h"
+
+void metricsRecordLatency(clientMetrics *m, uint8_t opCode, uint64_t ns) {
+    latencyHistogram *h = __atomic_load_n(&m->latency[opCode], __ATOMIC_ACQUIRE);
+    if (h == nullptr) {
+        latencyHistogram *fresh = (latencyHistogram*)malloc(sizeof(latencyHistogram));
+        histogramReset(fresh);
+        // Another thread may have installed one meanwhile, keep that
+        if (__atomic_compare_exchange_n(&m->latency[opCode], &h, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            h = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    histogramRecordAtomic(h, ns);
+}
+
+static void addCounter(uint64_t *dst, const uint64_t *src) {
+    *dst += __atomic_load_n(src, __ATOMIC_RELAXED);
+}
+
+void metricsMerge(clientMetrics *dst, const clientMetrics *src) {
+    addCounter(&dst->transport.bytesSent, &src->transport.bytesSent);
+    addCounter(&dst->transport.bytesReceived, &src->transport.bytesReceived);
+    addCounter(&dst->transport.sendCalls, &src->transport.sendCalls);
+    addCounter(&dst->transport.recvCalls, &src->transport.recvCalls);
+    addCounter(&dst->requests, &src->requests);
+    addCounter(&dst->transportErrors, &src->transportErrors);
+    addCounter(&dst->topologyChanges, &src->topologyChanges);
+    addCounter(&dst->compressedValues, &src->compressedValues);
+    addCounter(&dst->compressInBytes, &src->compressInBytes);
+    addCounter(&dst->compressOutBytes, &src->compressOutBytes);
+    addCounter(&dst->compressNs, &src->compressNs);
+    addCounter(&dst->decompressedValues, &src->decompressedValues);
+    addCounter(&dst->decompressNs, &src->decompressNs);
+    dst->inFlight += __atomic_load_n(&src->inFlight, __ATOMIC_RELAXED);
+    for (int i=0; i<256; i++) {
+        const latencyHistogram *h = __atomic_load_n(&src->latency[i], __ATOMIC_ACQUIRE);
+        if (h == nullptr) {
+            continue;
+        }
+        if (dst->latency[i] == nullptr) {
+            dst->latency[i] = (latencyHistogram*)malloc(sizeof(latencyHistogram));
+            histogramReset(dst->latency[i]);
+        }
+        histogramMerge(dst->latency[i], h);
+    }
+}
+
+void freeMetrics(clientMetrics *m) {
+    for (int i=0; i<256; i++) {
+        free(m->latency[i]);
+        m->latency[i] = nullptr;
+    }
+    free(m->serverErrors);
+    m->serverErrors = nullptr;
+}
+
+void dumpMetrics(const clientMetrics *m, FILE *out) {
+    fprintf(out, "requests %llu\n", (unsigned long long)m->requests);
+    fprintf(out, "in-flight %lld\n", (long long)m->inFlight);
+    fprintf(out, "transport errors %llu\n", (unsigned long long)m->transportErrors);
+    fprintf(out, "topology changes %llu\n", (unsigned long long)m->topologyChanges);
+    fprintf(out, "library allocations %llu\n", (unsigned long long)m->allocations);
+    fprintf(out, "bytes sent %llu received %llu\n", (unsigned long long)m->transport.bytesSent,
+            (unsigned long long)m->transport.bytesReceived);
+    fprintf(out, "syscalls send %llu read %llu\n", (unsigned long long)m->transport.sendCalls,
+            (unsigned long long)m->transport.recvCalls);
+    if (m->compressedValues > 0) {
+        fprintf(out, "compressed values %llu ratio %.2f cpu %.2f us/value\n", (unsigned long long)m->compressedValues,
+                (double)m->compressInBytes/m->compressOutBytes, m->compressNs/1000.0/m->compressedValues);
+    }
+    if (m->decompressedValues > 0) {
+        fprintf(out, "decompressed values %llu cpu %.2f us/value\n", (unsigned long long)m->decompressedValues,
+                m->decompressNs/1000.0/m->decompressedValues);
+    }
+    for (uint32_t i=0; i<m->serversNum; i++) {
+        fprintf(out, "server %u errors %llu\n", i, (unsigned long long)m->serverErrors[i]);
+    }
+    for (int i=0; i<256; i++) {
+        const latencyHistogram *h = m->latency[i];
+        if (h == nullptr || h->total == 0) {
+            continue;
+        }
+        fprintf(out, "opcode 0x%02X count %llu avg %.2f p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n", i,
+                (unsigned long long)h->total, h->sum/1000.0/h->total,
+                histogramPercentile(h, 50)/1000.0, histogramPercentile(h, 99)/1000.0,
+                histogramPercentile(h, 99.9)/1000.0, h->max/1000.0);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef HOTROD_METRICS_H
+#define HOTROD_METRICS_H
+
+#include <stdio.h>
+#include "latencyHistogram.h"
+#include "socketTransport.h"
+
+/** @file */
+
+/**
+ * Client metrics
+ *
+ * The client keeps one block per connection shard, updated with relaxed atomics.
+ * A snapshot merges the shards and adds the fields marked as snapshot only.
+ */
+typedef struct {
+    transportCounters transport;
+    uint64_t requests;
+    uint64_t transportErrors;
+    uint64_t topologyChanges;
+    int64_t inFlight;                   ///< requests written and not yet answered
+    latencyHistogram *latency[256];     ///< latency in ns per request opcode, nullptr until used
+    uint64_t compressedValues;
+    uint64_t compressInBytes;           ///< size of the compressed values before compression
+    uint64_t compressOutBytes;          ///< size of the compressed values after compression, framing included
+    uint64_t compressNs;                ///< thread cpu time spent compressing, attempts that didn't shrink included
+    uint64_t decompressedValues;
+    uint64_t decompressNs;              ///< thread cpu time spent decompressing
+    uint64_t allocations;               ///< snapshot only: library allocations, @see allocationCount
+    uint32_t serversNum;                ///< snapshot only
+    uint64_t *serverErrors;             ///< snapshot only: transport errors per server of the client, @see clientServer
+} clientMetrics;
+
+/**
+ * metricsRecordLatency records the latency of a request, allocating its histogram at first use
+ */
+void metricsRecordLatency(clientMetrics *m, uint8_t opCode, uint64_t ns);
+
+/**
+ * metricsMerge adds src to dst, dst histograms are allocated as needed
+ */
+void metricsMerge(clientMetrics *dst, const clientMetrics *src);
+
+/**
+ * freeMetrics releases the histograms and the per server counters of m
+ */
+void freeMetrics(clientMetrics *m);
+
+/**
+ * dumpMetrics prints a snapshot in human readable form, latencies in microseconds
+ */
+void dumpMetrics(const clientMetrics *m, FILE *out);
+
+#endif // HOTROD_METRICS_H
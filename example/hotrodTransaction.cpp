@@ -0,0 +1,402 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hotrodTransaction.h"
+#include "murmurHash3.h"
+
+/// formatId of the xids of this client, "HRTX"
+static const int32_t TX_FORMAT_ID = 0x48525458;
+
+typedef struct {
+    byteArray key;
+    byteArray value;        ///< of the buffered put, or the value read
+    int written;            ///< a put or a remove is buffered
+    int removed;
+    int read;               ///< the key has been read from the server
+    int existed;            ///< ...and had a value
+    uint64_t version;       ///< version read
+} txEntry;
+
+struct hotrodTransaction {
+    hotrodCache *cache;
+    uint64_t timeoutMs;
+    txEntry *entries;
+    int entriesNum;
+    int entriesCapacity;
+    int *index;             ///< open addressing table of entry indexes, -1 if free
+    int indexSize;          ///< power of two, twice entriesCapacity
+};
+
+typedef struct {
+    uint8_t opCode;
+    const transactionXid *xid;
+    uint8_t onePhaseCommit;
+    uint64_t timeoutMs;
+    const txModification *mods;
+    int modsNum;
+    int32_t xaCode;
+} txArgs;
+
+/**
+ * The writes of the transaction owned by one server
+ */
+typedef struct {
+    txModification *mods;
+    int modsNum;
+    uint8_t branchId[4];
+    transactionXid xid;
+    int prepared;           ///< the branch must be committed or rolled back
+} txBranch;
+
+static void txOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    txArgs *args = (txArgs*)opArgs;
+    if (args->opCode == PREPARE_REQUEST) {
+        writePrepare(ctx, writer, hdr, args->xid, args->onePhaseCommit, args->timeoutMs, args->mods, args->modsNum);
+    } else if (args->opCode == COMMIT_REQUEST) {
+        writeCommit(ctx, writer, hdr, args->xid);
+    } else {
+        writeRollback(ctx, writer, hdr, args->xid);
+    }
+    readTransactionResult(ctx, reader, rsh, hdr, newTopology, &args->xaCode);
+}
+
+/**
+ * Send a transaction request for branch, routed with its first key
+ *
+ * @return the response status or a negative errno, xaCode is set with OK_STATUS
+ */
+static int sendBranch(hotrodTransaction *tx, txBranch *branch, uint8_t opCode, uint8_t onePhaseCommit, int32_t *xaCode) {
+    txArgs args = {opCode, &branch->xid, onePhaseCommit, tx->timeoutMs, branch->mods, branch->modsNum, 0};
+    const byteArray *key = &branch->mods[0].key;
+    int res = cacheExecute(tx->cache, key->buff, key->len, txOperation, &args);
+    *xaCode = args.xaCode;
+    return res;
+}
+
+static int isPrepared(int32_t xaCode) {
+    return xaCode == XA_OK || xaCode == XA_RDONLY;
+}
+
+static void setBytes(byteArray *dst, const uint8_t *buff, int len) {
+    dst->buff = (uint8_t*)realloc(dst->buff, len > 0 ? len : 1);
+    memcpy(dst->buff, buff, len);
+    dst->len = len;
+}
+
+/**
+ * Copy a value of the transaction in value, growing it if growable
+ *
+ * @return OK_STATUS or -ENOBUFS if value is too small and not growable, value->len is then
+ *         the size needed
+ */
+static int copyValue(const byteArray *src, valueBuffer *value) {
+    if (value->capacity < src->len) {
+        if (!value->growable) {
+            value->len = src->len;
+            return -ENOBUFS;
+        }
+        value->buff = (uint8_t*)realloc(value->buff, src->len);
+        value->capacity = src->len;
+    }
+    memcpy(value->buff, src->buff, src->len);
+    value->len = src->len;
+    return OK_STATUS;
+}
+
+/**
+ * Slot of key in the index, the one holding its entry or the free one to insert it
+ */
+static int indexSlot(hotrodTransaction *tx, const byteArray *key) {
+    int mask = tx->indexSize-1;
+    int slot = hashVoidPtr(key->buff, key->len) & mask;
+    while (tx->index[slot] >= 0) {
+        const byteArray *k = &tx->entries[tx->index[slot]].key;
+        if (k->len == key->len && memcmp(k->buff, key->buff, key->len) == 0) {
+            break;
+        }
+        slot = (slot+1) & mask;
+    }
+    return slot;
+}
+
+static void growEntries(hotrodTransaction *tx) {
+    tx->entriesCapacity *= 2;
+    tx->entries = (txEntry*)realloc(tx->entries, sizeof(txEntry)*tx->entriesCapacity);
+    free(tx->index);
+    tx->indexSize = 2*tx->entriesCapacity;
+    tx->index = (int*)malloc(sizeof(int)*tx->indexSize);
+    memset(tx->index, -1, sizeof(int)*tx->indexSize);
+    for (int i=0; i<tx->entriesNum; i++) {
+        tx->index[indexSlot(tx, &tx->entries[i].key)] = i;
+    }
+}
+
+/**
+ * Entry of key, added if create, valid until the next entry is added
+ */
+static txEntry *findEntry(hotrodTransaction *tx, const byteArray *key, int create) {
+    int slot = indexSlot(tx, key);
+    if (tx->index[slot] >= 0) {
+        return &tx->entries[tx->index[slot]];
+    }
+    if (!create) {
+        return nullptr;
+    }
+    if (tx->entriesNum == tx->entriesCapacity) {
+        growEntries(tx);
+        slot = indexSlot(tx, key);
+    }
+    txEntry *e = &tx->entries[tx->entriesNum];
+    memset(e, 0, sizeof(*e));
+    setBytes(&e->key, key->buff, key->len);
+    tx->index[slot] = tx->entriesNum++;
+    return e;
+}
+
+static void releaseTransaction(hotrodTransaction *tx) {
+    for (int i=0; i<tx->entriesNum; i++) {
+        free(tx->entries[i].key.buff);
+        free(tx->entries[i].value.buff);
+    }
+    free(tx->entries);
+    free(tx->index);
+    free(tx);
+}
+
+static void fillGlobalId(uint8_t *id) {
+    static uint32_t counter = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+    uint32_t seq = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    uint32_t pid = (uint32_t)getpid();
+    for (int i=0; i<8; i++) {
+        id[i] = ns >> (56-8*i);
+    }
+    for (int i=0; i<4; i++) {
+        id[8+i] = seq >> (24-8*i);
+        id[12+i] = pid >> (24-8*i);
+    }
+}
+
+hotrodTransaction *beginTransaction(hotrodCache *cache, uint64_t timeoutMs) {
+    hotrodTransaction *tx = (hotrodTransaction*)malloc(sizeof(hotrodTransaction));
+    tx->cache = cache;
+    tx->timeoutMs = timeoutMs;
+    tx->entriesNum = 0;
+    tx->entriesCapacity = 8;
+    tx->entries = (txEntry*)malloc(sizeof(txEntry)*tx->entriesCapacity);
+    tx->indexSize = 2*tx->entriesCapacity;
+    tx->index = (int*)malloc(sizeof(int)*tx->indexSize);
+    memset(tx->index, -1, sizeof(int)*tx->indexSize);
+    return tx;
+}
+
+int txGet(hotrodTransaction *tx, const byteArray *key, valueBuffer *value) {
+    txEntry *e = findEntry(tx, key, 0);
+    if (e != nullptr && (e->written || e->read)) {
+        if (e->written ? e->removed : !e->existed) {
+            value->len = 0;
+            return KEY_DOES_NOT_EXIST_STATUS;
+        }
+        return copyValue(&e->value, value);
+    }
+    // The value is read aside, so the transaction knows it even if value is too small
+    valueBuffer read = {0, 0, nullptr, 1};
+    uint64_t version = 0;
+    int res = cacheGetWithVersion(tx->cache, key, &read, &version);
+    if (res != OK_STATUS && res != KEY_DOES_NOT_EXIST_STATUS) {
+        free(read.buff);
+        return res;
+    }
+    e = findEntry(tx, key, 1);
+    e->read = 1;
+    e->existed = res == OK_STATUS;
+    e->version = version;
+    if (!e->existed) {
+        free(read.buff);
+        value->len = 0;
+        return res;
+    }
+    // The buffer read becomes the value of the entry
+    free(e->value.buff);
+    e->value.buff = read.buff;
+    e->value.len = read.len;
+    return copyValue(&e->value, value);
+}
+
+void txPut(hotrodTransaction *tx, const byteArray *key, const byteArray *value) {
+    txEntry *e = findEntry(tx, key, 1);
+    e->written = 1;
+    e->removed = 0;
+    setBytes(&e->value, value->buff, value->len);
+}
+
+void txRemove(hotrodTransaction *tx, const byteArray *key) {
+    txEntry *e = findEntry(tx, key, 1);
+    e->written = 1;
+    e->removed = 1;
+    e->value.len = 0;
+}
+
+/**
+ * Check that the keys only read still have the version read
+ *
+ * @return OK_STATUS, NOT_PUT_REMOVED_REPLACED_STATUS if one has been modified or the
+ *         status of a failed read
+ */
+static int checkReadOnly(hotrodTransaction *tx) {
+    valueBuffer scratch = {0, 0, nullptr, 1};
+    int res = OK_STATUS;
+    for (int i=0; i<tx->entriesNum && res == OK_STATUS; i++) {
+        const txEntry *e = &tx->entries[i];
+        if (e->written || !e->read) {
+            continue;
+        }
+        uint64_t version = 0;
+        int status = cacheGetWithVersion(tx->cache, &e->key, &scratch, &version);
+        if (status != OK_STATUS && status != KEY_DOES_NOT_EXIST_STATUS) {
+            res = status;
+        } else if ((status == OK_STATUS) != e->existed || (e->existed && version != e->version)) {
+            res = NOT_PUT_REMOVED_REPLACED_STATUS;
+        }
+    }
+    free(scratch.buff);
+    return res;
+}
+
+/**
+ * Prepare the branches and commit them, or roll back the prepared ones if one failed
+ */
+static int commitBranches(hotrodTransaction *tx, txBranch *branches, int branchesNum) {
+    int res = OK_STATUS;
+    int32_t xaCode = XA_OK;
+    if (branchesNum == 1) {
+        res = sendBranch(tx, &branches[0], PREPARE_REQUEST, 1, &xaCode);
+        if (res == OK_STATUS && !isPrepared(xaCode)) {
+            res = NOT_PUT_REMOVED_REPLACED_STATUS;
+        }
+        return res;
+    }
+    for (int b=0; b<branchesNum; b++) {
+        res = sendBranch(tx, &branches[b], PREPARE_REQUEST, 0, &xaCode);
+        if (res == OK_STATUS && !isPrepared(xaCode)) {
+            res = NOT_PUT_REMOVED_REPLACED_STATUS;
+        }
+        if (res != OK_STATUS) {
+            break;
+        }
+        // A read only branch is complete after the prepare
+        branches[b].prepared = xaCode == XA_OK;
+    }
+    uint8_t opCode = res == OK_STATUS ? COMMIT_REQUEST : ROLLBACK_REQUEST;
+    for (int b=0; b<branchesNum; b++) {
+        if (!branches[b].prepared) {
+            continue;
+        }
+        int endRes = sendBranch(tx, &branches[b], opCode, 0, &xaCode);
+        if (res == OK_STATUS && (endRes != OK_STATUS || !isPrepared(xaCode))) {
+            res = endRes != OK_STATUS ? endRes : NOT_PUT_REMOVED_REPLACED_STATUS;
+        }
+    }
+    return res;
+}
+
+int commitTransaction(hotrodTransaction *tx) {
+    hotrodClient *client = tx->cache->client;
+    int res = checkReadOnly(tx);
+    if (res != OK_STATUS) {
+        releaseTransaction(tx);
+        return res;
+    }
+    int n = tx->entriesNum;
+    // Only the written keys are sent, grouped by primary owner with a counting sort
+    int *owners = (int*)malloc(sizeof(int)*n);
+    int ownersNum = 0;
+    for (int i=0; i<n; i++) {
+        const txEntry *e = &tx->entries[i];
+        owners[i] = e->written ? (int)cachePrimaryOwner(tx->cache, e->key.buff, e->key.len) : -1;
+        if (owners[i] >= ownersNum) {
+            ownersNum = owners[i]+1;
+        }
+    }
+    int *counts = (int*)calloc(ownersNum > 0 ? ownersNum : 1, sizeof(int));
+    int branchesNum = 0;
+    for (int i=0; i<n; i++) {
+        if (owners[i] >= 0 && counts[owners[i]]++ == 0) {
+            branchesNum++;
+        }
+    }
+    txBranch *branches = (txBranch*)calloc(branchesNum > 0 ? branchesNum : 1, sizeof(txBranch));
+    txModification *mods = (txModification*)calloc(n > 0 ? n : 1, sizeof(txModification));
+    valueBuffer *framed = (valueBuffer*)calloc(n > 0 ? n : 1, sizeof(valueBuffer));
+    // Each branch gets its slice of mods, counts[s] becomes the branch of the owner s
+    for (int s=0, b=0, first=0; s<ownersNum; s++) {
+        if (counts[s] == 0) {
+            continue;
+        }
+        branches[b].mods = mods+first;
+        first += counts[s];
+        counts[s] = b++;
+    }
+    for (int i=0; i<n; i++) {
+        const txEntry *e = &tx->entries[i];
+        if (owners[i] < 0) {
+            continue;
+        }
+        txBranch *b = &branches[counts[owners[i]]];
+        txModification *mod = &b->mods[b->modsNum++];
+        mod->key = e->key;
+        if (e->removed) {
+            mod->control = TX_REMOVE_OP;
+        } else {
+            byteArray value = e->value;
+            if (encodeValue(client->codec, client->compressThreshold, &value, &framed[i])) {
+                value.len = framed[i].len;
+                value.buff = framed[i].buff;
+            }
+            mod->value = value;
+        }
+        if (!e->read) {
+            mod->control |= TX_NOT_READ;
+        } else if (!e->existed) {
+            mod->control |= TX_NON_EXISTING;
+        } else {
+            mod->versionRead = e->version;
+        }
+    }
+
+    uint8_t globalId[16];
+    fillGlobalId(globalId);
+    for (int b=0; b<branchesNum; b++) {
+        txBranch *branch = &branches[b];
+        for (int i=0; i<4; i++) {
+            branch->branchId[i] = (uint32_t)b >> (24-8*i);
+        }
+        branch->xid.formatId = TX_FORMAT_ID;
+        branch->xid.globalId.len = sizeof(globalId);
+        branch->xid.globalId.buff = globalId;
+        branch->xid.branchId.len = sizeof(branch->branchId);
+        branch->xid.branchId.buff = branch->branchId;
+    }
+    if (branchesNum > 0) {
+        res = commitBranches(tx, branches, branchesNum);
+    }
+    for (int i=0; i<n; i++) {
+        free(framed[i].buff);
+    }
+    free(framed);
+    free(mods);
+    free(branches);
+    free(counts);
+    free(owners);
+    releaseTransaction(tx);
+    return res;
+}
+
+void rollbackTransaction(hotrodTransaction *tx) {
+    releaseTransaction(tx);
+}
@@ -0,0 +1,69 @@
+#ifndef HOTROD_TRANSACTION_H
+#define HOTROD_TRANSACTION_H
+
+#include "hotrodClient.h"
+
+/** @file */
+
+/**
+ * A transaction on a cache, buffering its writes on the client
+ *
+ * Puts and removes are kept in the transaction until the commit, reads see the writes of
+ * the transaction and remember the version of the keys read from the server.
+ * The commit groups the writes by primary owner and sends one PREPARE per owner, all the
+ * branches share the global id of the transaction; then one COMMIT per owner if every
+ * branch prepared, else a ROLLBACK of the prepared ones. A transaction writing to a single
+ * server is committed in one phase, with one request. The prepare fails if a key read and
+ * written by the transaction has been modified since, so commits are optimistic. Keys that
+ * are only read are not sent: before the prepare the commit reads their version again and
+ * gives up if one changed. That check and the commit are not atomic, a write landing on
+ * such a key in between goes undetected, so write skew is narrowed but not prevented.
+ * A transaction is used by one thread at time, the values are compressed as configured
+ * on the client.
+ */
+typedef struct hotrodTransaction hotrodTransaction;
+
+/**
+ * beginTransaction starts a transaction on cache, no request is sent
+ *
+ * timeoutMs is the time the servers keep a prepared branch waiting for its commit.
+ */
+hotrodTransaction *beginTransaction(hotrodCache *cache, uint64_t timeoutMs);
+
+/**
+ * txGet reads the value of key as seen by the transaction
+ *
+ * The first read of a key goes to the server, later ones are served by the transaction.
+ *
+ * @return the response status or a negative errno, as cacheGet. If value is not growable
+ *         and too small it is -ENOBUFS and value->len is the size needed, the key still
+ *         counts as read.
+ */
+int txGet(hotrodTransaction *tx, const byteArray *key, valueBuffer *value);
+
+/**
+ * txPut buffers a put of value under key
+ */
+void txPut(hotrodTransaction *tx, const byteArray *key, const byteArray *value);
+
+/**
+ * txRemove buffers a remove of key
+ */
+void txRemove(hotrodTransaction *tx, const byteArray *key);
+
+/**
+ * commitTransaction commits the writes of the transaction and releases it
+ *
+ * @return OK_STATUS if committed, NOT_PUT_REMOVED_REPLACED_STATUS if a key read has been
+ *         modified or a server refused to prepare, and the transaction was rolled back,
+ *         the status of a failed request or a negative errno. A failure during the commit
+ *         phase can leave the branches already committed applied.
+ */
+int commitTransaction(hotrodTransaction *tx);
+
+/**
+ * rollbackTransaction discards the writes of the transaction and releases it
+ */
+void rollbackTransaction(hotrodTransaction *tx);
+
+#endif // HOTROD_TRANSACTION_H
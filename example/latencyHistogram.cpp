@@ -0,0 +1,92 @@
+#include <string.h>
+
+#include "latencyHistogram.h"
+
+static int bucketIndex(uint64_t value) {
+    const uint64_t exact = 2<<HISTOGRAM_SUB_BITS;
+    if (value < exact) {
+        return value;
+    }
+    int msb = 63-__builtin_clzll(value);
+    if (msb >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS-1;
+    }
+    int shift = msb-HISTOGRAM_SUB_BITS;
+    uint64_t mantissa = value >> shift;
+    return exact + (shift-1)*(1<<HISTOGRAM_SUB_BITS) + (mantissa-(1<<HISTOGRAM_SUB_BITS));
+}
+
+/**
+ * Highest value counted in a bucket
+ */
+static uint64_t bucketValue(int index) {
+    const int exact = 2<<HISTOGRAM_SUB_BITS;
+    if (index < exact) {
+        return index;
+    }
+    int shift = (index-exact)/(1<<HISTOGRAM_SUB_BITS)+1;
+    uint64_t mantissa = (index-exact)%(1<<HISTOGRAM_SUB_BITS) + (1<<HISTOGRAM_SUB_BITS);
+    return ((mantissa+1) << shift)-1;
+}
+
+void histogramReset(latencyHistogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histogramRecord(latencyHistogram *h, uint64_t value) {
+    h->counts[bucketIndex(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+void histogramRecordAtomic(latencyHistogram *h, uint64_t value) {
+    __atomic_add_fetch(&h->counts[bucketIndex(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+    uint64_t min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (value < min && !__atomic_compare_exchange_n(&h->min, &min, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&h->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void histogramMerge(latencyHistogram *dst, const latencyHistogram *src) {
+    for (int i=0; i<HISTOGRAM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t histogramPercentile(const latencyHistogram *h, double percentile) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile/100.0*h->total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i=0; i<HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucketValue(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
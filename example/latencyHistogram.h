@@ -0,0 +1,50 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+/** @file */
+
+/**
+ * \defgroup LatencyHistogram Latency histogram
+ *
+ * Log-linear histogram in the HdrHistogram style: values below 128 are counted exactly,
+ * above that every power of two is split in 64 buckets, so any percentile is reported
+ * with a relative error below 1.6%. Values larger than 2^40 are clamped.
+ * @{
+ */
+const int HISTOGRAM_SUB_BITS = 6;
+const int HISTOGRAM_MAX_BITS = 40;
+const int HISTOGRAM_BUCKETS  = (2<<HISTOGRAM_SUB_BITS) + (HISTOGRAM_MAX_BITS-HISTOGRAM_SUB_BITS)*(1<<HISTOGRAM_SUB_BITS);
+/**@}*/
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} latencyHistogram;
+
+void histogramReset(latencyHistogram *h);
+
+/**
+ * histogramRecord adds a value, typically a latency in nanoseconds
+ *
+ * Not thread safe: use one histogram per thread and merge them.
+ */
+void histogramRecord(latencyHistogram *h, uint64_t value);
+
+/**
+ * histogramRecordAtomic adds a value to a histogram shared by many threads
+ */
+void histogramRecordAtomic(latencyHistogram *h, uint64_t value);
+
+void histogramMerge(latencyHistogram *dst, const latencyHistogram *src);
+
+/**
+ * histogramPercentile returns the value below which percentile% of the values fall
+ */
+uint64_t histogramPercentile(const latencyHistogram *h, double percentile);
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,367 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hotrod-codec.h"
+#include "listenerStream.h"
+#include "socketTransport.h"
+
+static const int READ_BUFFER_SIZE = 256*1024;
+static const int IDLE_SPINS = 64;
+
+typedef struct {
+    uint64_t sequence;      ///< index+1 when filled, index+ring size when free again
+    cacheEvent event;
+} eventSlot;
+
+struct listenerStream {
+    streamCtx ctx;
+    requestHeader hdr;
+    valueBuffer listenerId;
+    uint8_t *readBuff;          ///< bytes read from the socket and not yet decoded
+    int readPos;
+    int readLen;
+    eventSlot *ring;
+    uint64_t mask;
+    int maxBatch;
+    eventBatchHandler handler;
+    void *arg;
+    int consumersNum;
+    pthread_t decoder;
+    pthread_t *consumers;
+    int decoderDone;            ///< set when the decoder exits, consumers then drain the ring
+    int registered;             ///< status of the registration, -1 until the response arrives
+    pthread_mutex_t lock;       ///< protects registered and the parking of idle threads
+    pthread_cond_t registeredCond;
+    pthread_cond_t eventsCond;  ///< signaled for the parked consumers when an event is published
+    pthread_cond_t slotsCond;   ///< signaled for the parked decoder when slots are released
+    int parkedConsumers;        ///< consumers waiting on eventsCond, the decoder skips the signal at 0
+    int decoderParked;          ///< the decoder waits on slotsCond
+    uint64_t ringFullWaits;
+    uint64_t ringFullNs;
+    uint64_t batches;
+    transportCounters counters;
+    // Producer and consumers positions on their own cache lines
+    uint64_t head __attribute__((aligned(64)));     ///< next slot to fill, decoder only
+    uint64_t tail __attribute__((aligned(64)));     ///< next slot to consume, claimed with a CAS
+};
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/**
+ * streamReader serving the reads from a large buffer, refilled with one syscall when empty
+ */
+static void bufferedReader(void *ctx, uint8_t *val, int len) {
+    listenerStream *ls = (listenerStream*)ctx;
+    while (len > 0) {
+        if (ls->readPos == ls->readLen) {
+            ls->readPos = 0;
+            ls->readLen = 0;
+            int count;
+            do {
+                count = read(ls->ctx.socket, ls->readBuff, READ_BUFFER_SIZE);
+            } while (count < 0 && errno == EINTR);
+            __atomic_add_fetch(&ls->counters.recvCalls, 1, __ATOMIC_RELAXED);
+            if (count <= 0) {
+                if (!ls->ctx.hasError) {
+                    ls->ctx.hasError = count < 0 ? errno : ECONNRESET;
+                }
+                memset(val, 0, len);
+                return;
+            }
+            __atomic_add_fetch(&ls->counters.bytesReceived, count, __ATOMIC_RELAXED);
+            ls->readLen = count;
+        }
+        int chunk = ls->readLen-ls->readPos < len ? ls->readLen-ls->readPos : len;
+        memcpy(val, ls->readBuff+ls->readPos, chunk);
+        ls->readPos += chunk;
+        val += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * Wait for the slot of the next event to be released by the consumers
+ *
+ * The decoder spins a little, then parks until a consumer releases slots.
+ */
+static eventSlot *waitFreeSlot(listenerStream *ls) {
+    eventSlot *slot = &ls->ring[ls->head & ls->mask];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == ls->head) {
+        return slot;
+    }
+    uint64_t start = nowNs();
+    for (int spins=0; spins < IDLE_SPINS && __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ls->head; spins++) {
+        sched_yield();
+    }
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ls->head) {
+        pthread_mutex_lock(&ls->lock);
+        // Published before checking the slot again, releaseSlots checks them in the other order
+        __atomic_store_n(&ls->decoderParked, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) != ls->head) {
+            pthread_cond_wait(&ls->slotsCond, &ls->lock);
+        }
+        __atomic_store_n(&ls->decoderParked, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&ls->lock);
+    }
+    __atomic_add_fetch(&ls->ringFullWaits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ls->ringFullNs, nowNs()-start, __ATOMIC_RELAXED);
+    return slot;
+}
+
+/**
+ * Make the event of the slot at head visible to the consumers and wake one if they are parked
+ */
+static void publishEvent(listenerStream *ls, eventSlot *slot) {
+    __atomic_store_n(&slot->sequence, ls->head+1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ls->head, ls->head+1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&ls->parkedConsumers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&ls->lock);
+        pthread_cond_signal(&ls->eventsCond);
+        pthread_mutex_unlock(&ls->lock);
+    }
+}
+
+/**
+ * Give count slots from first back to the decoder and wake it if it is parked
+ */
+static void releaseSlots(listenerStream *ls, uint64_t first, int count) {
+    for (int i=0; i<count; i++) {
+        __atomic_store_n(&ls->ring[(first+i) & ls->mask].sequence, first+i+ls->mask+1, __ATOMIC_SEQ_CST);
+    }
+    if (__atomic_load_n(&ls->decoderParked, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&ls->lock);
+        pthread_cond_signal(&ls->slotsCond);
+        pthread_mutex_unlock(&ls->lock);
+    }
+}
+
+/**
+ * Park a consumer until the decoder publishes the event at the tail or exits
+ */
+static void waitEvents(listenerStream *ls) {
+    pthread_mutex_lock(&ls->lock);
+    // Published before checking the ring, publishEvent checks them in the other order
+    __atomic_add_fetch(&ls->parkedConsumers, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        uint64_t tail = __atomic_load_n(&ls->tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ls->ring[tail & ls->mask].sequence, __ATOMIC_SEQ_CST) == tail+1 ||
+                __atomic_load_n(&ls->decoderDone, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        pthread_cond_wait(&ls->eventsCond, &ls->lock);
+    }
+    __atomic_sub_fetch(&ls->parkedConsumers, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ls->lock);
+}
+
+static void setRegistered(listenerStream *ls, int status) {
+    pthread_mutex_lock(&ls->lock);
+    ls->registered = status;
+    pthread_cond_broadcast(&ls->registeredCond);
+    pthread_mutex_unlock(&ls->lock);
+}
+
+static void *decodeEvents(void *arg) {
+    listenerStream *ls = (listenerStream*)arg;
+    responseHeader rsh;
+    topologyInfo newTopology;
+    while (!ls->ctx.hasError) {
+        readResponseHeader(ls, bufferedReader, &rsh, &ls->hdr, &newTopology);
+        if (rsh.topologyChanged) {
+            // Events are not routed, the topology is of no use here
+            freeTopology(&newTopology);
+        }
+        free(rsh.error.buff);
+        if (ls->ctx.hasError) {
+            break;
+        }
+        if (isCacheEvent(&rsh)) {
+            eventSlot *slot = waitFreeSlot(ls);
+            readCacheEvent(ls, bufferedReader, &rsh, &slot->event);
+            publishEvent(ls, slot);
+        } else if (rsh.opCode == ADD_CLIENT_LISTENER_RESPONSE) {
+            setRegistered(ls, rsh.status);
+        } else if (rsh.opCode == REMOVE_CLIENT_LISTENER_RESPONSE || rsh.opCode == ERROR_RESPONSE) {
+            break;
+        }
+    }
+    if (ls->registered < 0) {
+        setRegistered(ls, ls->ctx.hasError ? -ls->ctx.hasError : -EPROTO);
+    }
+    pthread_mutex_lock(&ls->lock);
+    __atomic_store_n(&ls->decoderDone, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&ls->eventsCond);
+    pthread_mutex_unlock(&ls->lock);
+    return nullptr;
+}
+
+/**
+ * Claim up to maxBatch consecutive filled slots
+ *
+ * @return the number of slots claimed from *first
+ */
+static int claimBatch(listenerStream *ls, uint64_t *first) {
+    uint64_t tail = __atomic_load_n(&ls->tail, __ATOMIC_ACQUIRE);
+    for (;;) {
+        int count = 0;
+        while (count < ls->maxBatch &&
+                __atomic_load_n(&ls->ring[(tail+count) & ls->mask].sequence, __ATOMIC_ACQUIRE) == tail+count+1) {
+            count++;
+        }
+        if (count == 0) {
+            return 0;
+        }
+        if (__atomic_compare_exchange_n(&ls->tail, &tail, tail+count, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *first = tail;
+            return count;
+        }
+    }
+}
+
+static void *consumeEvents(void *arg) {
+    listenerStream *ls = (listenerStream*)arg;
+    cacheEvent **batch = (cacheEvent**)malloc(sizeof(cacheEvent*)*ls->maxBatch);
+    int idle = 0;
+    for (;;) {
+        uint64_t first;
+        int done = __atomic_load_n(&ls->decoderDone, __ATOMIC_ACQUIRE);
+        int count = claimBatch(ls, &first);
+        if (count == 0) {
+            // done was read before claiming, so no event can be left behind
+            if (done) {
+                break;
+            }
+            if (++idle < IDLE_SPINS) {
+                sched_yield();
+            } else {
+                waitEvents(ls);
+                idle = 0;
+            }
+            continue;
+        }
+        idle = 0;
+        for (int i=0; i<count; i++) {
+            batch[i] = &ls->ring[(first+i) & ls->mask].event;
+        }
+        ls->handler(batch, count, ls->arg);
+        __atomic_add_fetch(&ls->batches, 1, __ATOMIC_RELAXED);
+        releaseSlots(ls, first, count);
+    }
+    free(batch);
+    return nullptr;
+}
+
+static void freeStream(listenerStream *ls) {
+    for (uint64_t i=0; i<=ls->mask; i++) {
+        free(ls->ring[i].event.listenerId.buff);
+        free(ls->ring[i].event.key.buff);
+    }
+    free(ls->ring);
+    free(ls->readBuff);
+    free(ls->listenerId.buff);
+    free(ls->consumers);
+    pthread_cond_destroy(&ls->registeredCond);
+    pthread_cond_destroy(&ls->eventsCond);
+    pthread_cond_destroy(&ls->slotsCond);
+    pthread_mutex_destroy(&ls->lock);
+    free(ls);
+}
+
+listenerStream *startListener(const char *addr, uint16_t port, const requestHeader *hdr, const byteArray *listenerId,
+        int includeState, int ringSize, int consumersNum, int maxBatch, eventBatchHandler handler, void *arg) {
+    int sock = getSocket(addr, port);
+    if (sock < 0) {
+        return nullptr;
+    }
+    listenerStream *ls = (listenerStream*)aligned_alloc(64, (sizeof(listenerStream)+63)/64*64);
+    memset(ls, 0, sizeof(*ls));
+    ls->ctx.socket = sock;
+    ls->ctx.counters = &ls->counters;
+    ls->hdr = *hdr;
+    ls->listenerId.buff = (uint8_t*)malloc(listenerId->len);
+    memcpy(ls->listenerId.buff, listenerId->buff, listenerId->len);
+    ls->listenerId.len = listenerId->len;
+    ls->readBuff = (uint8_t*)malloc(READ_BUFFER_SIZE);
+    uint64_t size = 1;
+    while (size < (uint64_t)ringSize) {
+        size <<= 1;
+    }
+    ls->mask = size-1;
+    ls->ring = (eventSlot*)calloc(size, sizeof(eventSlot));
+    for (uint64_t i=0; i<size; i++) {
+        ls->ring[i].sequence = i;
+        ls->ring[i].event.listenerId.growable = 1;
+        ls->ring[i].event.key.growable = 1;
+    }
+    ls->maxBatch = maxBatch;
+    ls->handler = handler;
+    ls->arg = arg;
+    ls->registered = -1;
+    pthread_mutex_init(&ls->lock, nullptr);
+    pthread_cond_init(&ls->registeredCond, nullptr);
+    pthread_cond_init(&ls->eventsCond, nullptr);
+    pthread_cond_init(&ls->slotsCond, nullptr);
+
+    byteArray id = {ls->listenerId.len, ls->listenerId.buff};
+    writeAddClientListener(&ls->ctx, writer, &ls->hdr, &id, includeState, LISTENER_INTEREST_ALL);
+    ls->consumersNum = consumersNum;
+    ls->consumers = (pthread_t*)malloc(sizeof(pthread_t)*consumersNum);
+    // Consumers start first: with includeState the current entries come before the response
+    for (int i=0; i<consumersNum; i++) {
+        pthread_create(&ls->consumers[i], nullptr, consumeEvents, ls);
+    }
+    pthread_create(&ls->decoder, nullptr, decodeEvents, ls);
+    pthread_mutex_lock(&ls->lock);
+    while (ls->registered < 0 && !__atomic_load_n(&ls->decoderDone, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&ls->registeredCond, &ls->lock);
+    }
+    int status = ls->registered;
+    pthread_mutex_unlock(&ls->lock);
+    if (status != OK_STATUS) {
+        shutdown(sock, SHUT_RDWR);
+        pthread_join(ls->decoder, nullptr);
+        for (int i=0; i<consumersNum; i++) {
+            pthread_join(ls->consumers[i], nullptr);
+        }
+        close(sock);
+        freeStream(ls);
+        return nullptr;
+    }
+    return ls;
+}
+
+void getListenerStats(listenerStream *stream, listenerStats *stats) {
+    uint64_t tail = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+    // head is written by the decoder only, a slightly stale value is fine for stats
+    uint64_t head = __atomic_load_n(&stream->head, __ATOMIC_RELAXED);
+    stats->events = head;
+    stats->backlog = head > tail ? head-tail : 0;
+    stats->batches = __atomic_load_n(&stream->batches, __ATOMIC_RELAXED);
+    stats->ringFullWaits = __atomic_load_n(&stream->ringFullWaits, __ATOMIC_RELAXED);
+    stats->ringFullNs = __atomic_load_n(&stream->ringFullNs, __ATOMIC_RELAXED);
+    stats->readCalls = __atomic_load_n(&stream->counters.recvCalls, __ATOMIC_RELAXED);
+}
+
+void stopListener(listenerStream *stream) {
+    requestHeader hdr = stream->hdr;
+    byteArray id = {stream->listenerId.len, stream->listenerId.buff};
+    // The decoder stops at the response, or at the end of stream if the server just closes
+    writeRemoveClientListener(&stream->ctx, writer, &hdr, &id);
+    shutdown(stream->ctx.socket, SHUT_WR);
+    pthread_join(stream->decoder, nullptr);
+    for (int i=0; i<stream->consumersNum; i++) {
+        pthread_join(stream->consumers[i], nullptr);
+    }
+    close(stream->ctx.socket);
+    freeStream(stream);
+}
@@ -0,0 +1,58 @@
+#ifndef LISTENER_STREAM_H
+#define LISTENER_STREAM_H
+
+#include "hotrod-c.h"
+
+/** @file */
+
+/**
+ * A client listener on a dedicated connection
+ *
+ * One decoder thread reads the connection through a large buffer, so a single read
+ * syscall brings many events, and decodes the events straight into the slots of a ring.
+ * consumersNum threads take the events from the ring in batches of up to maxBatch and
+ * pass them to the handler. The ring is lock free, single producer and multiple consumers;
+ * threads with nothing to do spin briefly, then park until the other side signals them.
+ * When the consumers fall behind and the ring is full, the decoder waits and stops reading
+ * the connection, so the backpressure reaches the server through TCP; the waits are
+ * accounted in the stats.
+ * Batches run concurrently on different consumers, the order of events is kept only
+ * within a batch.
+ */
+typedef struct listenerStream listenerStream;
+
+/**
+ * eventBatchHandler processes count events, valid only until it returns
+ */
+typedef void (*eventBatchHandler)(cacheEvent *const *events, int count, void *arg);
+
+typedef struct {
+    uint64_t events;            ///< decoded events
+    uint64_t batches;           ///< handler calls
+    uint64_t backlog;           ///< events decoded and not yet taken by a consumer
+    uint64_t ringFullWaits;     ///< events that found the ring full
+    uint64_t ringFullNs;        ///< time the decoder waited for a free slot
+    uint64_t readCalls;         ///< read syscalls on the connection
+} listenerStats;
+
+/**
+ * startListener connects to addr:port and registers a listener with id listenerId
+ *
+ * ringSize is rounded up to a power of two.
+ *
+ * @return the stream or nullptr if the connection or the registration failed
+ */
+listenerStream *startListener(const char *addr, uint16_t port, const requestHeader *hdr, const byteArray *listenerId,
+        int includeState, int ringSize, int consumersNum, int maxBatch, eventBatchHandler handler, void *arg);
+
+/**
+ * getListenerStats reads the counters of the stream, thread safe
+ */
+void getListenerStats(listenerStream *stream, listenerStats *stats);
+
+/**
+ * stopListener unregisters the listener, delivers the events already received and releases the stream
+ */
+void stopListener(listenerStream *stream);
+
+#endif // LISTENER_STREAM_H
@@ -0,0 +1,448 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "socketTransport.h"
+
+static void countIo(uint64_t *calls, uint64_t *bytes, int count) {
+    __atomic_add_fetch(calls, 1, __ATOMIC_RELAXED);
+    if (count > 0) {
+        __atomic_add_fetch(bytes, count, __ATOMIC_RELAXED);
+    }
+}
+
+void reader(void *ctx, uint8_t *val, int len) {
+    streamCtx *sc = (streamCtx*)ctx;
+    if (sc->hasError) {
+        // The stream is out of sync, a read could wait for bytes that will never come
+        memset(val, 0, len);
+        return;
+    }
+    if (sc->outLen > 0) {
+        flushStream(sc);
+    }
+    // A stream socket can return less than asked, the library expects all the bytes
+    while (len > 0) {
+        int count = read( sc->socket , val, len);
+        if (sc->counters != nullptr) {
+            countIo(&sc->counters->recvCalls, &sc->counters->bytesReceived, count);
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        // errno is meaningful only on failure, it may still hold the EINPROGRESS of a non-blocking connect
+        if (count <= 0) {
+            if (!sc->hasError) {
+                sc->hasError = count < 0 ? errno : ECONNRESET;
+            }
+            memset(val, 0, len);
+            return;
+        }
+        val += count;
+        len -= count;
+    }
+}
+
+void writer(void *ctx, uint8_t *val, int len) {
+    streamCtx *sc = (streamCtx*)ctx;
+    // As for reads, a send can take only part of the bytes
+    while (len > 0) {
+        int count = send(sc->socket, val, len, MSG_NOSIGNAL);
+        if (sc->counters != nullptr) {
+            countIo(&sc->counters->sendCalls, &sc->counters->bytesSent, count);
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            if (!sc->hasError) {
+                sc->hasError = count < 0 ? errno : EIO;
+            }
+            return;
+        }
+        val += count;
+        len -= count;
+    }
+}
+
+static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/**
+ * Send all the buffers with as few syscalls as possible, resuming after partial sends
+ */
+static void sendAll(streamCtx *sc, struct iovec *iov, int iovCnt) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCnt;
+    while (msg.msg_iovlen > 0) {
+        ssize_t count = sendmsg(sc->socket, &msg, MSG_NOSIGNAL);
+        if (sc->counters != nullptr) {
+            countIo(&sc->counters->sendCalls, &sc->counters->bytesSent, count);
+        }
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!sc->hasError) {
+                sc->hasError = errno;
+            }
+            return;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)count >= msg.msg_iov->iov_len) {
+            count -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + count;
+            msg.msg_iov->iov_len -= count;
+        }
+    }
+}
+
+void corkStream(streamCtx *sc, int flushThreshold, int flushDelayUs) {
+    sc->outBuff = (uint8_t*)malloc(flushThreshold);
+    sc->outLen = 0;
+    sc->outCapacity = flushThreshold;
+    sc->flushDelayUs = flushDelayUs;
+}
+
+void uncorkStream(streamCtx *sc) {
+    flushStream(sc);
+    free(sc->outBuff);
+    sc->outBuff = nullptr;
+    sc->outCapacity = 0;
+}
+
+void flushStream(streamCtx *sc) {
+    if (sc->outLen == 0) {
+        return;
+    }
+    struct iovec iov = {sc->outBuff, (size_t)sc->outLen};
+    sendAll(sc, &iov, 1);
+    sc->outLen = 0;
+}
+
+void flushIfDue(streamCtx *sc) {
+    if (sc->outLen > 0 && sc->flushDelayUs > 0 && nowUs()-sc->firstPendingUs >= (uint64_t)sc->flushDelayUs) {
+        flushStream(sc);
+    }
+}
+
+void corkedWriter(void *ctx, uint8_t *val, int len) {
+    streamCtx *sc = (streamCtx*)ctx;
+    if (sc->outBuff == nullptr) {
+        writer(ctx, val, len);
+        return;
+    }
+    if (sc->outLen+len > sc->outCapacity) {
+        // Doesn't fit: pending requests and this one go out together in one sendmsg
+        struct iovec iov[2] = {{sc->outBuff, (size_t)sc->outLen}, {val, (size_t)len}};
+        sendAll(sc, iov, 2);
+        sc->outLen = 0;
+        return;
+    }
+    if (sc->outLen == 0) {
+        sc->firstPendingUs = nowUs();
+    }
+    memcpy(sc->outBuff+sc->outLen, val, len);
+    sc->outLen += len;
+    if (sc->outLen == sc->outCapacity) {
+        flushStream(sc);
+    } else {
+        flushIfDue(sc);
+    }
+}
+
+static void setError(streamCtx *sc, int err) {
+    if (!sc->hasError) {
+        sc->hasError = err;
+    }
+}
+
+void sendFileRange(streamCtx *sc, int fd, off_t offset, size_t len) {
+    // The request header may still be in the cork buffer and must go first
+    flushStream(sc);
+    while (len > 0 && !sc->hasError) {
+        ssize_t count = sendfile(sc->socket, fd, &offset, len);
+        if (sc->counters != nullptr) {
+            countIo(&sc->counters->sendCalls, &sc->counters->bytesSent, count);
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            // A file shorter than announced leaves the stream out of sync as well
+            setError(sc, count < 0 ? errno : EIO);
+            return;
+        }
+        len -= count;
+    }
+}
+
+/**
+ * Copy len bytes from the socket to fd through a user space buffer, for files that can't be spliced
+ */
+static void copyToFile(streamCtx *sc, int fd, off_t offset, size_t len) {
+    uint8_t buff[64*1024];
+    while (len > 0 && !sc->hasError) {
+        int chunk = len < sizeof(buff) ? len : sizeof(buff);
+        reader(sc, buff, chunk);
+        if (!sc->hasError && pwrite(fd, buff, chunk, offset) != chunk) {
+            setError(sc, errno ? errno : EIO);
+        }
+        offset += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * Move count bytes already in the pipe to fd with plain copies
+ */
+static void drainPipe(streamCtx *sc, int pipeFd, int fd, off_t offset, size_t count) {
+    uint8_t buff[64*1024];
+    while (count > 0 && !sc->hasError) {
+        ssize_t chunk = read(pipeFd, buff, count < sizeof(buff) ? count : sizeof(buff));
+        if (chunk <= 0 || pwrite(fd, buff, chunk, offset) != chunk) {
+            setError(sc, errno ? errno : EIO);
+            return;
+        }
+        offset += chunk;
+        count -= chunk;
+    }
+}
+
+void recvToFile(streamCtx *sc, int fd, off_t offset, size_t len) {
+    int pipeFds[2];
+    int spliceToFile = 1;
+    if (sc->outLen > 0) {
+        flushStream(sc);
+    }
+    if (pipe2(pipeFds, O_CLOEXEC) < 0) {
+        copyToFile(sc, fd, offset, len);
+        return;
+    }
+    while (len > 0 && spliceToFile && !sc->hasError) {
+        ssize_t count = splice(sc->socket, nullptr, pipeFds[1], nullptr, len, SPLICE_F_MOVE);
+        if (sc->counters != nullptr) {
+            countIo(&sc->counters->recvCalls, &sc->counters->bytesReceived, count);
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && errno == EINVAL) {
+            break;
+        }
+        if (count <= 0) {
+            setError(sc, count < 0 ? errno : ECONNRESET);
+            break;
+        }
+        len -= count;
+        // Drain the pipe into the file before reading more from the socket
+        while (count > 0) {
+            ssize_t written = splice(pipeFds[0], nullptr, fd, &offset, count, SPLICE_F_MOVE);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written < 0 && errno == EINVAL) {
+                drainPipe(sc, pipeFds[0], fd, offset, count);
+                offset += count;
+                spliceToFile = 0;
+                break;
+            }
+            if (written <= 0) {
+                setError(sc, written < 0 ? errno : EIO);
+                break;
+            }
+            count -= written;
+        }
+    }
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    if (len > 0 && !sc->hasError) {
+        // splice is not supported by the socket or the file, finish with plain copies
+        copyToFile(sc, fd, offset, len);
+    }
+}
+
+void cleaner(void *ctx) {
+    streamCtx *sc = (streamCtx*)ctx;
+    close(sc->socket);
+}
+
+/**
+ * Disable Nagle: requests and pipelined batches must leave at once, not wait for the ACK of the previous ones
+ */
+static void setNoDelay(int sock) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int getSocket(const char* str, uint16_t port) {
+    struct sockaddr_in serv_addr;
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    // Convert IPv4 addresses from text to binary form
+    if (inet_pton(AF_INET, str, &serv_addr.sin_addr)<=0) {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    setNoDelay(sock);
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * Start a non-blocking connect to the server, returns the socket or -1
+ */
+static int startConnect(const byteArray *server, uint16_t port) {
+    char str[INET_ADDRSTRLEN];
+    struct sockaddr_in serv_addr;
+    // Server address in the topology is not null terminated
+    if (server->len >= (int)sizeof(str)) {
+        return -1;
+    }
+    memcpy(str, server->buff, server->len);
+    str[server->len]=0;
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, str, &serv_addr.sin_addr)<=0) {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    setNoDelay(sock);
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 && errno != EINPROGRESS) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int connectServers(const topologyInfo *tInfo, int *socks, int timeoutMs) {
+    int n = tInfo->serversNum;
+    struct pollfd *pfds = (struct pollfd*)malloc(sizeof(struct pollfd)*n);
+    int *idx = (int*)malloc(sizeof(int)*n);
+    int pending = 0;
+    for (int i=0; i<n; i++) {
+        socks[i] = startConnect(&tInfo->servers[i], tInfo->ports[i]);
+        if (socks[i] >= 0) {
+            pfds[pending].fd = socks[i];
+            pfds[pending].events = POLLOUT;
+            idx[pending++] = i;
+        }
+    }
+    // Wait for all the connects together, compacting the poll set as they complete
+    while (pending > 0) {
+        int ready = poll(pfds, pending, timeoutMs);
+        if (ready <= 0) {
+            break;
+        }
+        for (int p=0; p<pending; ) {
+            if (pfds[p].revents == 0) {
+                p++;
+                continue;
+            }
+            int err = 0;
+            socklen_t errLen = sizeof(err);
+            getsockopt(pfds[p].fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+            if (err != 0) {
+                close(socks[idx[p]]);
+                socks[idx[p]] = -1;
+            }
+            pfds[p] = pfds[--pending];
+            idx[p] = idx[pending];
+        }
+    }
+    // Whatever is still pending didn't make it in time
+    for (int p=0; p<pending; p++) {
+        close(socks[idx[p]]);
+        socks[idx[p]] = -1;
+    }
+    int connected = 0;
+    for (int i=0; i<n; i++) {
+        if (socks[i] >= 0) {
+            fcntl(socks[i], F_SETFL, fcntl(socks[i], F_GETFL, 0) & ~O_NONBLOCK);
+            connected++;
+        }
+    }
+    free(idx);
+    free(pfds);
+    return connected;
+}
+
+int warmUpServers(const topologyInfo *tInfo, int *socks, requestHeader *hdr) {
+    int n = tInfo->serversNum;
+    int ok = 0;
+    for (int i=0; i<n; i++) {
+        if (socks[i] < 0) {
+            continue;
+        }
+        streamCtx ctx = {};
+        ctx.socket = socks[i];
+        writePing(&ctx, writer, hdr);
+        if (ctx.hasError) {
+            close(socks[i]);
+            socks[i] = -1;
+        }
+    }
+    for (int i=0; i<n; i++) {
+        if (socks[i] < 0) {
+            continue;
+        }
+        streamCtx ctx = {};
+        ctx.socket = socks[i];
+        responseHeader rsh;
+        // Replies are read into a scratch topology, the caller's one stays untouched
+        topologyInfo scratch;
+        mediaType keyMt, valueMt;
+        readPing(&ctx, reader, &rsh, hdr, &scratch, &keyMt, &valueMt);
+        if (ctx.hasError || rsh.status != 0x00) {
+            close(socks[i]);
+            socks[i] = -1;
+        } else {
+            ok++;
+        }
+        if (rsh.topologyChanged) {
+            freeTopology(&scratch);
+        }
+        if (rsh.error.buff != nullptr) {
+            free(rsh.error.buff);
+        }
+    }
+    return ok;
+}
+
+void closeServers(const topologyInfo *tInfo, int *socks) {
+    for (int i=0; i<tInfo->serversNum; i++) {
+        if (socks[i] >= 0) {
+            close(socks[i]);
+            socks[i] = -1;
+        }
+    }
+}
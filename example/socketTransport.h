@@ -0,0 +1,135 @@
+#ifndef SOCKET_TRANSPORT_H
+#define SOCKET_TRANSPORT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "hotrod-c.h"
+
+/** @file */
+
+/**
+ * Transport counters, updated with relaxed atomic increments
+ */
+typedef struct {
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t sendCalls;     ///< send syscalls
+    uint64_t recvCalls;     ///< read syscalls
+} transportCounters;
+
+/**
+ * Context passed to the stream functions: the socket and the first
+ * error seen on it (errno value, 0 means no error)
+ *
+ * The output fields are used only by a corked stream, see corkStream().
+ */
+typedef struct {
+    int socket;
+    int hasError;
+    uint8_t *outBuff;        ///< pending requests, nullptr if the stream is not corked
+    int outLen;              ///< bytes pending in outBuff
+    int outCapacity;         ///< size of outBuff
+    int flushDelayUs;        ///< max time a request can wait in outBuff
+    uint64_t firstPendingUs; ///< when the oldest pending byte was buffered
+    transportCounters *counters; ///< nullptr disables counting
+} streamCtx;
+
+/**
+ * reader reads len bytes from the socket
+ *
+ * Pending corked requests are flushed first: the reply can't arrive before the request leaves.
+ * Once the stream has an error nothing is read and val is zero filled, as after a failed read.
+ */
+void reader(void *ctx, uint8_t *val, int len);
+void writer(void *ctx, uint8_t *val, int len);
+void cleaner(void *ctx);
+
+/**
+ * corkStream enables write coalescing on the stream
+ *
+ * Requests written with corkedWriter() are accumulated and sent with a single syscall
+ * when flushThreshold bytes are pending, when the oldest one has waited flushDelayUs,
+ * on flushStream() or before the next read. flushDelayUs 0 disables the delay: requests
+ * leave only on the threshold, an explicit flush or a read.
+ * There is no timer: the delay is checked only when a later request is written or on
+ * flushIfDue(), a lone request stays in the buffer until then or until the next read.
+ */
+void corkStream(streamCtx *sc, int flushThreshold, int flushDelayUs);
+
+/**
+ * uncorkStream flushes the pending requests and disables write coalescing
+ */
+void uncorkStream(streamCtx *sc);
+
+/**
+ * corkedWriter is a streamWriter that appends to the output buffer of a corked stream
+ *
+ * On a stream that is not corked it behaves as writer().
+ */
+void corkedWriter(void *ctx, uint8_t *val, int len);
+
+/**
+ * flushStream sends all the pending requests
+ */
+void flushStream(streamCtx *sc);
+
+/**
+ * flushIfDue flushes the pending requests if the oldest one has waited flushDelayUs
+ *
+ * Nothing is flushed on a stream corked with flushDelayUs 0.
+ * Call it from the application loop when no reads or writes are expected soon.
+ */
+void flushIfDue(streamCtx *sc);
+
+/**
+ * sendFileRange sends len bytes of fd starting at offset with sendfile()
+ *
+ * The data goes from the page cache to the socket without being copied in user space,
+ * pending corked requests are flushed first. Used for values of @ref writePutHeader.
+ */
+void sendFileRange(streamCtx *sc, int fd, off_t offset, size_t len);
+
+/**
+ * recvToFile reads len bytes from the socket and writes them to fd at offset
+ *
+ * Data is moved with splice() through a pipe; destinations that don't support splice
+ * are written with plain copies. Used for values of @ref readGetValueLength.
+ */
+void recvToFile(streamCtx *sc, int fd, off_t offset, size_t len);
+
+/**
+ * getSocket opens a blocking connection to addr:port
+ *
+ * @return the socket, or -1 if addr is not an IPv4 address or the connection failed
+ */
+int getSocket(const char *addr, uint16_t port);
+
+/**
+ * connectServers opens a connection to every server of the topology in parallel
+ *
+ * All the connects are started in non-blocking mode and then waited together with
+ * poll(), so the total time is the one of the slowest server and not the sum.
+ * socks must have room for tInfo->serversNum entries, socks[i] is the socket for
+ * tInfo->servers[i] or -1 if the connection failed or didn't complete in timeoutMs.
+ * Returned sockets are switched back to blocking mode.
+ *
+ * @return the number of connected servers
+ */
+int connectServers(const topologyInfo *tInfo, int *socks, int timeoutMs);
+
+/**
+ * warmUpServers sends a ping on all the connected sockets and then reads all the replies
+ *
+ * Pings are all written before reading the first reply, so the servers work in parallel.
+ * Sockets whose ping fails are closed and set to -1.
+ *
+ * @return the number of servers that replied OK
+ */
+int warmUpServers(const topologyInfo *tInfo, int *socks, requestHeader *hdr);
+
+/**
+ * closeServers closes all the sockets opened by connectServers
+ */
+void closeServers(const topologyInfo *tInfo, int *socks);
+
+#endif // SOCKET_TRANSPORT_H
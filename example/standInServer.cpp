@@ -0,0 +1,964 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hotrod-codec.h"
+#include "socketTransport.h"
+#include "standInServer.h"
+
+typedef struct {
+    std::string value;
+    uint64_t version;
+} storedValue;
+
+typedef std::unordered_map<std::string, storedValue> cacheStore;
+
+typedef struct {
+    std::string key;
+    std::string value;
+    uint8_t control;
+    uint64_t versionRead;
+} standInModification;
+
+/**
+ * A prepared transaction branch, waiting for its COMMIT or ROLLBACK
+ */
+typedef struct {
+    std::string cacheName;
+    std::vector<standInModification> mods;
+} preparedBranch;
+
+/**
+ * Output of a connection, responses and events are queued and written by flushOutput
+ *
+ * Events are queued under the server lock, in the order of the writes that fire them, and
+ * written after it is released: a listener slow to read blocks the requests notifying it,
+ * not the whole server.
+ */
+typedef struct {
+    streamCtx ctx;
+    pthread_mutex_t lock;           ///< protects pending
+    pthread_mutex_t writeLock;      ///< held while writing, so the flushes keep the queue order
+    std::vector<uint8_t> pending;
+} connOutput;
+
+typedef struct {
+    std::shared_ptr<connOutput> output;     ///< of the connection of the listener
+    std::string id;
+    std::string cacheName;  ///< events of the writes to this cache only
+    uint64_t messageId;     ///< of the ADD_CLIENT_LISTENER request, carried by the events
+    uint32_t interests;
+} standInListener;
+
+/**
+ * A topology as sent to the clients, the first nodesNum nodes own the entries
+ */
+typedef struct {
+    uint32_t topologyId;
+    int nodesNum;
+    int segmentsNum;
+    std::vector<uint8_t> topology;              ///< servers only, for topology aware clients
+    std::vector<uint8_t> hashTopology;          ///< servers and owners, for hash aware clients
+} cacheTopology;
+
+struct standInServer {
+    int nodesNum;
+    uint16_t basePort;
+    int stopping;
+    int *listenSocks;
+    pthread_t *acceptThreads;
+    pthread_mutex_t lock;                       ///< protects stores, listeners and connections
+    std::unordered_map<std::string, cacheStore> stores;  ///< by cache name, "" is the default cache
+    uint64_t lastVersion;
+    std::unordered_map<std::string, int64_t> counters;
+    std::vector<standInListener> listeners;
+    std::unordered_map<std::string, preparedBranch> prepared;  ///< by xid
+    std::vector<pthread_t> connThreads;
+    std::vector<int> connSocks;                 ///< -1 once the connection is closed
+    cacheTopology defaultTopology;              ///< of the caches without their own one
+    std::unordered_map<std::string, cacheTopology> cacheTopologies;    ///< by cache name, read without lock
+};
+
+typedef struct {
+    uint64_t messageId;
+    uint8_t version;
+    uint8_t opCode;
+    std::string cacheName;
+    uint32_t flags;
+    uint8_t clientIntelligence;
+    uint32_t topologyId;
+    int node;               ///< node serving the request
+    std::shared_ptr<connOutput> output;     ///< of the connection serving the request
+    std::vector<std::shared_ptr<connOutput>> *notified;    ///< listener outputs with events of the request
+} standInRequest;
+
+typedef struct {
+    standInServer *server;
+    int connIndex;
+    int node;
+} connArgs;
+
+static void freeOutput(connOutput *output) {
+    pthread_mutex_destroy(&output->lock);
+    pthread_mutex_destroy(&output->writeLock);
+    delete output;
+}
+
+static std::shared_ptr<connOutput> newOutput(int socket) {
+    connOutput *output = new connOutput;
+    output->ctx = {};
+    output->ctx.socket = socket;
+    pthread_mutex_init(&output->lock, nullptr);
+    pthread_mutex_init(&output->writeLock, nullptr);
+    return std::shared_ptr<connOutput>(output, freeOutput);
+}
+
+static void queueOutput(connOutput *output, const uint8_t *data, int len) {
+    pthread_mutex_lock(&output->lock);
+    output->pending.insert(output->pending.end(), data, data+len);
+    pthread_mutex_unlock(&output->lock);
+}
+
+/**
+ * Write what is queued on output, the caller doesn't hold the server lock
+ */
+static void flushOutput(connOutput *output) {
+    std::vector<uint8_t> out;
+    pthread_mutex_lock(&output->writeLock);
+    pthread_mutex_lock(&output->lock);
+    out.swap(output->pending);
+    pthread_mutex_unlock(&output->lock);
+    // The connection may be closed, its socket is then -1
+    if (!out.empty() && output->ctx.socket >= 0) {
+        writer(&output->ctx, out.data(), out.size());
+    }
+    pthread_mutex_unlock(&output->writeLock);
+}
+
+/**
+ * Encode the topology as sent in the response header, @see readNewTopology
+ */
+static std::vector<uint8_t> encodeTopology(standInServer *srv, const cacheTopology *topo, int withSegments) {
+    std::vector<uint8_t> data(16+topo->nodesNum*16+topo->segmentsNum*11);
+    uint8_t *curs = data.data();
+    writeVInt(&curs, topo->topologyId);
+    writeVInt(&curs, topo->nodesNum);
+    for (int i=0; i<topo->nodesNum; i++) {
+        writeBytes(&curs, (uint8_t*)"127.0.0.1", 9);
+        writeShort(&curs, srv->basePort+i);
+    }
+    if (withSegments) {
+        int ownersNum = topo->nodesNum > 1 ? 2 : 1;
+        writeByte(&curs, 0x03);
+        writeVInt(&curs, topo->segmentsNum);
+        for (int i=0; i<topo->segmentsNum; i++) {
+            writeByte(&curs, ownersNum);
+            for (int j=0; j<ownersNum; j++) {
+                writeVInt(&curs, (i+j) % topo->nodesNum);
+            }
+        }
+    }
+    data.resize(curs-data.data());
+    return data;
+}
+
+static void initTopology(standInServer *srv, cacheTopology *topo, uint32_t topologyId, int nodesNum, int segmentsNum) {
+    topo->topologyId = topologyId;
+    topo->nodesNum = nodesNum;
+    topo->segmentsNum = segmentsNum;
+    topo->topology = encodeTopology(srv, topo, 0);
+    topo->hashTopology = encodeTopology(srv, topo, 1);
+}
+
+static const cacheTopology *findTopology(standInServer *srv, const std::string &cacheName) {
+    auto it = srv->cacheTopologies.find(cacheName);
+    return it != srv->cacheTopologies.end() ? &it->second : &srv->defaultTopology;
+}
+
+/**
+ * Queue a response header, with the topology if the client one is stale, followed by body
+ */
+static void sendResponse(standInServer *srv, const standInRequest *req, uint8_t opCode, uint8_t status, const uint8_t *body, int bodyLen) {
+    const std::vector<uint8_t> *topology = nullptr;
+    const cacheTopology *topo = findTopology(srv, req->cacheName);
+    if (req->topologyId != topo->topologyId) {
+        if (req->clientIntelligence == CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE) {
+            topology = &topo->hashTopology;
+        } else if (req->clientIntelligence == CLIENT_INTELLIGENCE_TOPOLOGY_AWARE) {
+            topology = &topo->topology;
+        }
+    }
+    std::vector<uint8_t> out(16+(topology ? topology->size() : 0)+bodyLen);
+    uint8_t *curs = out.data();
+    writeByte(&curs, 0xA1);
+    writeVLong(&curs, req->messageId);
+    writeByte(&curs, opCode);
+    writeByte(&curs, status);
+    writeByte(&curs, topology != nullptr);
+    if (topology != nullptr) {
+        memcpy(curs, topology->data(), topology->size());
+        curs += topology->size();
+    }
+    if (bodyLen > 0) {
+        memcpy(curs, body, bodyLen);
+        curs += bodyLen;
+    }
+    queueOutput(req->output.get(), out.data(), curs-out.data());
+}
+
+static void sendError(standInServer *srv, const standInRequest *req, uint8_t status, const char *msg) {
+    std::vector<uint8_t> body(strlen(msg)+5);
+    uint8_t *curs = body.data();
+    writeBytes(&curs, (uint8_t*)msg, strlen(msg));
+    sendResponse(srv, req, ERROR_RESPONSE, status, body.data(), curs-body.data());
+}
+
+static std::string readString(streamCtx *ctx) {
+    uint32_t len = readVInt(ctx, reader);
+    std::string str(len, 0);
+    reader(ctx, (uint8_t*)&str[0], len);
+    return str;
+}
+
+/**
+ * Skip the expiration parameters of a write request, @see writePutWithExpiration
+ */
+static void readExpiration(streamCtx *ctx) {
+    uint8_t units = readByte(ctx, reader);
+    if ((units >> 4) != DEFAULT && (units >> 4) != INFINITUM) {
+        readVLong(ctx, reader);
+    }
+    if ((units & 0x0f) != DEFAULT && (units & 0x0f) != INFINITUM) {
+        readVLong(ctx, reader);
+    }
+}
+
+/**
+ * Read an xid as a key of the prepared branches, @see writePrepare
+ */
+static std::string readXid(streamCtx *ctx) {
+    int32_t formatId = readSignedVInt(ctx, reader);
+    std::string globalId = readString(ctx);
+    std::string branchId = readString(ctx);
+    return std::to_string(formatId)+":"+std::to_string(globalId.size())+":"+globalId+branchId;
+}
+
+/**
+ * Queue a cache entry event for a listener, the caller holds the server lock
+ */
+static void sendEvent(standInListener *listener, uint8_t opCode, const std::string &key, uint64_t version) {
+    std::vector<uint8_t> out(32+listener->id.size()+key.size());
+    uint8_t *curs = out.data();
+    writeByte(&curs, 0xA1);
+    writeVLong(&curs, listener->messageId);
+    writeByte(&curs, opCode);
+    writeByte(&curs, OK_STATUS);
+    writeByte(&curs, 0);
+    writeBytes(&curs, (uint8_t*)listener->id.data(), listener->id.size());
+    writeByte(&curs, 0); // not custom
+    writeByte(&curs, 0); // not retried
+    writeBytes(&curs, (uint8_t*)key.data(), key.size());
+    if (opCode != CACHE_ENTRY_REMOVED_EVENT_RESPONSE) {
+        writeLong(&curs, version);
+    }
+    queueOutput(listener->output.get(), out.data(), curs-out.data());
+}
+
+/**
+ * Notify the listeners interested in a modification, the caller holds the server lock
+ *
+ * The outputs of the listeners are added to the notified ones of the request, flushed once
+ * the request is served.
+ */
+static void notifyListeners(standInServer *srv, const standInRequest *req, uint8_t opCode, const std::string &key, uint64_t version) {
+    if (req->flags & SKIP_LISTENER_NOTIFICATION) {
+        return;
+    }
+    uint32_t interest = 1 << (opCode-CACHE_ENTRY_CREATED_EVENT_RESPONSE);
+    for (standInListener &listener : srv->listeners) {
+        if ((listener.interests & interest) && listener.cacheName == req->cacheName) {
+            sendEvent(&listener, opCode, key, version);
+            std::vector<std::shared_ptr<connOutput>> *notified = req->notified;
+            if (std::find(notified->begin(), notified->end(), listener.output) == notified->end()) {
+                notified->push_back(listener.output);
+            }
+        }
+    }
+}
+
+static void handlePing(standInServer *srv, const standInRequest *req) {
+    // Key and value media types, protocol version, no operation list
+    uint8_t body[] = {0x00, 0x00, req->version, 0x00};
+    sendResponse(srv, req, PING_RESPONSE, OK_STATUS, body, sizeof(body));
+}
+
+static void handleGet(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string key = readString(ctx);
+    std::vector<uint8_t> body;
+    uint8_t status = KEY_DOES_NOT_EXIST_STATUS;
+    pthread_mutex_lock(&srv->lock);
+    cacheStore &store = srv->stores[req->cacheName];
+    auto it = store.find(key);
+    if (it != store.end()) {
+        status = OK_STATUS;
+        body.resize(it->second.value.size()+5);
+        uint8_t *curs = body.data();
+        writeBytes(&curs, (uint8_t*)it->second.value.data(), it->second.value.size());
+        body.resize(curs-body.data());
+    }
+    pthread_mutex_unlock(&srv->lock);
+    sendResponse(srv, req, GET_RESPONSE, status, body.data(), body.size());
+}
+
+/**
+ * Serve PUT, PUT_IF_ABSENT, REPLACE and REMOVE, with the previous value if FORCE_RETURN_VALUE is set
+ */
+static void handleWrite(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string key = readString(ctx);
+    std::string value;
+    if (req->opCode != REMOVE_REQUEST) {
+        readExpiration(ctx);
+        value = readString(ctx);
+    }
+    if (ctx->hasError) {
+        return;
+    }
+    uint8_t status = OK_STATUS;
+    std::string previous;
+    pthread_mutex_lock(&srv->lock);
+    cacheStore &store = srv->stores[req->cacheName];
+    auto it = store.find(key);
+    int exists = it != store.end();
+    if (exists) {
+        previous = it->second.value;
+    }
+    switch (req->opCode) {
+        case PUT_REQUEST:
+            store[key] = {value, ++srv->lastVersion};
+        break;
+        case PUT_IF_ABSENT_REQUEST:
+        case REPLACE_REQUEST:
+            if (exists == (req->opCode == PUT_IF_ABSENT_REQUEST)) {
+                status = NOT_PUT_REMOVED_REPLACED_STATUS;
+            } else {
+                store[key] = {value, ++srv->lastVersion};
+            }
+        break;
+        case REMOVE_REQUEST:
+            if (exists) {
+                store.erase(it);
+            } else {
+                status = KEY_DOES_NOT_EXIST_STATUS;
+            }
+        break;
+    }
+    if (status == OK_STATUS) {
+        if (req->opCode == REMOVE_REQUEST) {
+            notifyListeners(srv, req, CACHE_ENTRY_REMOVED_EVENT_RESPONSE, key, 0);
+        } else {
+            notifyListeners(srv, req, exists ? CACHE_ENTRY_MODIFIED_EVENT_RESPONSE : CACHE_ENTRY_CREATED_EVENT_RESPONSE, key, srv->lastVersion);
+        }
+    }
+    pthread_mutex_unlock(&srv->lock);
+    std::vector<uint8_t> body;
+    if ((req->flags & FORCE_RETURN_VALUE) && exists) {
+        status = status == OK_STATUS ? SUCCESS_WITH_PREVIOUS_STATUS : NOT_EXECUTED_WITH_PREVIOUS_STATUS;
+        body.resize(previous.size()+5);
+        uint8_t *curs = body.data();
+        writeBytes(&curs, (uint8_t*)previous.data(), previous.size());
+        body.resize(curs-body.data());
+    }
+    sendResponse(srv, req, req->opCode+1, status, body.data(), body.size());
+}
+
+/**
+ * Serve GET_WITH_VERSION and GET_WITH_METADATA, entries never expire
+ */
+static void handleGetVersioned(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string key = readString(ctx);
+    std::vector<uint8_t> body;
+    uint8_t status = KEY_DOES_NOT_EXIST_STATUS;
+    pthread_mutex_lock(&srv->lock);
+    cacheStore &store = srv->stores[req->cacheName];
+    auto it = store.find(key);
+    if (it != store.end()) {
+        status = OK_STATUS;
+        body.resize(it->second.value.size()+14);
+        uint8_t *curs = body.data();
+        if (req->opCode == GET_WITH_METADATA_REQUEST) {
+            writeByte(&curs, INFINITE_LIFESPAN | INFINITE_MAXIDLE);
+        }
+        writeLong(&curs, it->second.version);
+        writeBytes(&curs, (uint8_t*)it->second.value.data(), it->second.value.size());
+        body.resize(curs-body.data());
+    }
+    pthread_mutex_unlock(&srv->lock);
+    // A response opcode is the request one plus one
+    sendResponse(srv, req, req->opCode+1, status, body.data(), body.size());
+}
+
+/**
+ * Serve REPLACE_IF_UNMODIFIED and REMOVE_IF_UNMODIFIED
+ */
+static void handleIfUnmodified(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    int replace = req->opCode == REPLACE_IF_UNMODIFIED_REQUEST;
+    std::string key = readString(ctx);
+    std::string value;
+    if (replace) {
+        readExpiration(ctx);
+    }
+    uint64_t version = readLong(ctx, reader);
+    if (replace) {
+        value = readString(ctx);
+    }
+    if (ctx->hasError) {
+        return;
+    }
+    uint8_t status = KEY_DOES_NOT_EXIST_STATUS;
+    pthread_mutex_lock(&srv->lock);
+    cacheStore &store = srv->stores[req->cacheName];
+    auto it = store.find(key);
+    if (it != store.end()) {
+        if (it->second.version != version) {
+            status = NOT_PUT_REMOVED_REPLACED_STATUS;
+        } else if (replace) {
+            it->second = {value, ++srv->lastVersion};
+            status = OK_STATUS;
+            notifyListeners(srv, req, CACHE_ENTRY_MODIFIED_EVENT_RESPONSE, key, srv->lastVersion);
+        } else {
+            store.erase(it);
+            status = OK_STATUS;
+            notifyListeners(srv, req, CACHE_ENTRY_REMOVED_EVENT_RESPONSE, key, 0);
+        }
+    }
+    pthread_mutex_unlock(&srv->lock);
+    sendResponse(srv, req, req->opCode+1, status, nullptr, 0);
+}
+
+static void sendXaCode(standInServer *srv, const standInRequest *req, int32_t xaCode) {
+    uint8_t body[4];
+    uint8_t *curs = body;
+    writeInt(&curs, xaCode);
+    sendResponse(srv, req, req->opCode+1, OK_STATUS, body, sizeof(body));
+}
+
+/**
+ * Apply the modifications of a branch, the caller holds the server lock
+ */
+static void applyModifications(standInServer *srv, const standInRequest *req, const std::vector<standInModification> &mods) {
+    cacheStore &store = srv->stores[req->cacheName];
+    for (const standInModification &mod : mods) {
+        auto it = store.find(mod.key);
+        int exists = it != store.end();
+        if (mod.control & TX_REMOVE_OP) {
+            if (exists) {
+                store.erase(it);
+                notifyListeners(srv, req, CACHE_ENTRY_REMOVED_EVENT_RESPONSE, mod.key, 0);
+            }
+        } else {
+            store[mod.key] = {mod.value, ++srv->lastVersion};
+            notifyListeners(srv, req, exists ? CACHE_ENTRY_MODIFIED_EVENT_RESPONSE : CACHE_ENTRY_CREATED_EVENT_RESPONSE, mod.key, srv->lastVersion);
+        }
+    }
+}
+
+/**
+ * Serve PREPARE, the versions read are checked at the prepare and the keys are not locked until the commit
+ */
+static void handlePrepare(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string xid = readXid(ctx);
+    uint8_t onePhaseCommit = readByte(ctx, reader);
+    readByte(ctx, reader);  // recoverable
+    readLong(ctx, reader);  // timeout
+    uint32_t modsNum = readVInt(ctx, reader);
+    std::vector<standInModification> mods;
+    for (uint32_t i=0; i<modsNum && !ctx->hasError; i++) {
+        standInModification mod;
+        mod.key = readString(ctx);
+        mod.control = readByte(ctx, reader);
+        mod.versionRead = 0;
+        if (!(mod.control & (TX_NOT_READ | TX_NON_EXISTING))) {
+            mod.versionRead = readLong(ctx, reader);
+        }
+        if (!(mod.control & TX_REMOVE_OP)) {
+            readExpiration(ctx);
+            mod.value = readString(ctx);
+        }
+        mods.push_back(mod);
+    }
+    if (ctx->hasError) {
+        return;
+    }
+    int32_t xaCode = XA_OK;
+    pthread_mutex_lock(&srv->lock);
+    cacheStore &store = srv->stores[req->cacheName];
+    for (const standInModification &mod : mods) {
+        if (mod.control & TX_NOT_READ) {
+            continue;
+        }
+        auto it = store.find(mod.key);
+        if ((mod.control & TX_NON_EXISTING) ? it != store.end() : it == store.end() || it->second.version != mod.versionRead) {
+            xaCode = XA_RBROLLBACK;
+            break;
+        }
+    }
+    if (xaCode == XA_OK) {
+        if (mods.empty()) {
+            xaCode = XA_RDONLY;
+        } else if (onePhaseCommit) {
+            applyModifications(srv, req, mods);
+        } else {
+            srv->prepared[xid] = {req->cacheName, mods};
+        }
+    }
+    pthread_mutex_unlock(&srv->lock);
+    sendXaCode(srv, req, xaCode);
+}
+
+/**
+ * Serve COMMIT and ROLLBACK of a prepared branch
+ */
+static void handleTransactionEnd(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string xid = readXid(ctx);
+    if (ctx->hasError) {
+        return;
+    }
+    int32_t xaCode = XAER_NOTA;
+    pthread_mutex_lock(&srv->lock);
+    auto it = srv->prepared.find(xid);
+    if (it != srv->prepared.end()) {
+        if (req->opCode == COMMIT_REQUEST) {
+            standInRequest branchReq = *req;
+            branchReq.cacheName = it->second.cacheName;
+            applyModifications(srv, &branchReq, it->second.mods);
+        }
+        srv->prepared.erase(it);
+        xaCode = XA_OK;
+    }
+    pthread_mutex_unlock(&srv->lock);
+    sendXaCode(srv, req, xaCode);
+}
+
+/**
+ * Tell if node is the primary owner of key, as in the hash aware topology of the cache
+ */
+static int isPrimaryOwner(const cacheTopology *topo, int node, const std::string &key) {
+    return (int)(getSegmentVoidPtr(key.data(), key.size(), topo->segmentsNum) % topo->nodesNum) == node;
+}
+
+/**
+ * Serve EXEC with the built-in tasks, @see standInServer
+ */
+static void handleExec(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string script = readString(ctx);
+    uint32_t paramsNum = readVInt(ctx, reader);
+    std::unordered_map<std::string, std::string> params;
+    for (uint32_t i=0; i<paramsNum && !ctx->hasError; i++) {
+        std::string name = readString(ctx);
+        params[name] = readString(ctx);
+    }
+    if (ctx->hasError) {
+        return;
+    }
+    std::string result;
+    if (script == "echo") {
+        result = params["value"];
+    } else if (script == "count" || script == "sum") {
+        const std::string &prefix = params["prefix"];
+        int64_t total = 0;
+        pthread_mutex_lock(&srv->lock);
+        for (auto &entry : srv->stores[req->cacheName]) {
+            if (entry.first.compare(0, prefix.size(), prefix) != 0 || !isPrimaryOwner(findTopology(srv, req->cacheName), req->node, entry.first)) {
+                continue;
+            }
+            total += script == "count" ? 1 : strtoll(entry.second.value.c_str(), nullptr, 10);
+        }
+        pthread_mutex_unlock(&srv->lock);
+        result = std::to_string(total);
+    } else {
+        sendError(srv, req, SERVER_ERROR_STATUS, "unknown task");
+        return;
+    }
+    std::vector<uint8_t> body(result.size()+5);
+    uint8_t *curs = body.data();
+    writeBytes(&curs, (uint8_t*)result.data(), result.size());
+    sendResponse(srv, req, EXEC_RESPONSE, OK_STATUS, body.data(), curs-body.data());
+}
+
+static void sendCounterValue(standInServer *srv, const standInRequest *req, uint8_t opCode, int found, int64_t value) {
+    uint8_t body[8];
+    uint8_t *curs = body;
+    writeLong(&curs, value);
+    sendResponse(srv, req, opCode, found ? OK_STATUS : KEY_DOES_NOT_EXIST_STATUS, body, found ? 8 : 0);
+}
+
+static void handleCounterCreate(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string name = readString(ctx);
+    uint8_t flags = readByte(ctx, reader);
+    if (flags & COUNTER_WEAK) {
+        readVInt(ctx, reader);
+    }
+    if (flags & COUNTER_BOUNDED) {
+        // Bounds are not enforced
+        readLong(ctx, reader);
+        readLong(ctx, reader);
+    }
+    int64_t initialValue = readLong(ctx, reader);
+    if (ctx->hasError) {
+        return;
+    }
+    pthread_mutex_lock(&srv->lock);
+    int created = srv->counters.emplace(name, initialValue).second;
+    pthread_mutex_unlock(&srv->lock);
+    sendResponse(srv, req, COUNTER_CREATE_RESPONSE, created ? OK_STATUS : NOT_PUT_REMOVED_REPLACED_STATUS, nullptr, 0);
+}
+
+static void handleCounterAddAndGet(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string name = readString(ctx);
+    int64_t delta = readLong(ctx, reader);
+    if (ctx->hasError) {
+        return;
+    }
+    pthread_mutex_lock(&srv->lock);
+    auto it = srv->counters.find(name);
+    int found = it != srv->counters.end();
+    int64_t value = found ? (it->second += delta) : 0;
+    pthread_mutex_unlock(&srv->lock);
+    sendCounterValue(srv, req, COUNTER_ADD_AND_GET_RESPONSE, found, value);
+}
+
+static void handleCounterGet(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string name = readString(ctx);
+    pthread_mutex_lock(&srv->lock);
+    auto it = srv->counters.find(name);
+    int found = it != srv->counters.end();
+    int64_t value = found ? it->second : 0;
+    pthread_mutex_unlock(&srv->lock);
+    sendCounterValue(srv, req, COUNTER_GET_RESPONSE, found, value);
+}
+
+/**
+ * Skip the name and the parameters of a filter or converter factory, they are not supported
+ */
+static void skipFactory(streamCtx *ctx) {
+    uint32_t nameLen = readVInt(ctx, reader);
+    if (nameLen == 0 || ctx->hasError) {
+        return;
+    }
+    skipBytes(ctx, reader, nameLen);
+    uint8_t paramsNum = readByte(ctx, reader);
+    for (int i=0; i<paramsNum && !ctx->hasError; i++) {
+        skipBytes(ctx, reader, readVInt(ctx, reader));
+    }
+}
+
+/**
+ * Register a listener on the connection, with includeState the existing entries are sent
+ * as CREATED events before the response
+ */
+static void handleAddListener(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    standInListener listener;
+    listener.output = req->output;
+    listener.id = readString(ctx);
+    listener.cacheName = req->cacheName;
+    listener.messageId = req->messageId;
+    uint8_t includeState = readByte(ctx, reader);
+    skipFactory(ctx);
+    skipFactory(ctx);
+    readByte(ctx, reader); // raw data
+    listener.interests = readVInt(ctx, reader);
+    if (ctx->hasError) {
+        return;
+    }
+    if (listener.interests == 0) {
+        listener.interests = LISTENER_INTEREST_ALL;
+    }
+    pthread_mutex_lock(&srv->lock);
+    cacheStore &store = srv->stores[req->cacheName];
+    if (includeState) {
+        for (auto &entry : store) {
+            sendEvent(&listener, CACHE_ENTRY_CREATED_EVENT_RESPONSE, entry.first, entry.second.version);
+        }
+    }
+    srv->listeners.push_back(listener);
+    // Queued under the lock, the response comes after the state and before the next events
+    sendResponse(srv, req, ADD_CLIENT_LISTENER_RESPONSE, OK_STATUS, nullptr, 0);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+static void handleRemoveListener(standInServer *srv, streamCtx *ctx, const standInRequest *req) {
+    std::string id = readString(ctx);
+    if (ctx->hasError) {
+        return;
+    }
+    uint8_t status = NOT_PUT_REMOVED_REPLACED_STATUS;
+    pthread_mutex_lock(&srv->lock);
+    for (auto it = srv->listeners.begin(); it != srv->listeners.end(); ++it) {
+        if (it->id == id && it->output == req->output) {
+            srv->listeners.erase(it);
+            status = OK_STATUS;
+            break;
+        }
+    }
+    sendResponse(srv, req, REMOVE_CLIENT_LISTENER_RESPONSE, status, nullptr, 0);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+/**
+ * Serve a request whose header has been read
+ *
+ * @return 0 if the connection can serve more requests
+ */
+static int dispatchRequest(standInServer *srv, streamCtx *ctx, standInRequest *req) {
+    switch (req->opCode) {
+        case PING_REQUEST:
+            handlePing(srv, req);
+        break;
+        case GET_REQUEST:
+            handleGet(srv, ctx, req);
+        break;
+        case PUT_REQUEST:
+        case PUT_IF_ABSENT_REQUEST:
+        case REPLACE_REQUEST:
+        case REMOVE_REQUEST:
+            handleWrite(srv, ctx, req);
+        break;
+        case GET_WITH_VERSION_REQUEST:
+        case GET_WITH_METADATA_REQUEST:
+            handleGetVersioned(srv, ctx, req);
+        break;
+        case REPLACE_IF_UNMODIFIED_REQUEST:
+        case REMOVE_IF_UNMODIFIED_REQUEST:
+            handleIfUnmodified(srv, ctx, req);
+        break;
+        case COUNTER_CREATE_REQUEST:
+            handleCounterCreate(srv, ctx, req);
+        break;
+        case COUNTER_ADD_AND_GET_REQUEST:
+            handleCounterAddAndGet(srv, ctx, req);
+        break;
+        case COUNTER_GET_REQUEST:
+            handleCounterGet(srv, ctx, req);
+        break;
+        case ADD_CLIENT_LISTENER_REQUEST:
+            handleAddListener(srv, ctx, req);
+        break;
+        case REMOVE_CLIENT_LISTENER_REQUEST:
+            handleRemoveListener(srv, ctx, req);
+        break;
+        case EXEC_REQUEST:
+            handleExec(srv, ctx, req);
+        break;
+        case PREPARE_REQUEST:
+            handlePrepare(srv, ctx, req);
+        break;
+        case COMMIT_REQUEST:
+        case ROLLBACK_REQUEST:
+            handleTransactionEnd(srv, ctx, req);
+        break;
+        default:
+            // The request body can't be skipped without knowing its format
+            sendError(srv, req, UNKNOWN_COMMAND_STATUS, "unsupported operation");
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read and serve one request, @see writeRequestHeader for the header format
+ *
+ * @return 0 if the connection can serve more requests
+ */
+static int handleRequest(standInServer *srv, streamCtx *ctx, const std::shared_ptr<connOutput> &output, int node) {
+    standInRequest req;
+    mediaType mt;
+    uint8_t magic = readByte(ctx, reader);
+    if (ctx->hasError) {
+        return -1;
+    }
+    req.messageId = readVLong(ctx, reader);
+    req.version = readByte(ctx, reader);
+    req.opCode = readByte(ctx, reader);
+    req.cacheName = readString(ctx);
+    req.flags = readVInt(ctx, reader);
+    req.clientIntelligence = readByte(ctx, reader);
+    req.topologyId = readVInt(ctx, reader);
+    req.node = node;
+    req.output = output;
+    std::vector<std::shared_ptr<connOutput>> notified;
+    req.notified = &notified;
+    readMediaType(ctx, reader, &mt);
+    readMediaType(ctx, reader, &mt);
+    int res = -1;
+    if (magic != 0xA0) {
+        sendError(srv, &req, INVALID_MAGIC_OR_MESSAGE_ID_STATUS, "invalid magic");
+    } else {
+        res = dispatchRequest(srv, ctx, &req);
+    }
+    // Written now that the server lock is released
+    for (const std::shared_ptr<connOutput> &listenerOutput : notified) {
+        flushOutput(listenerOutput.get());
+    }
+    flushOutput(output.get());
+    return res < 0 || ctx->hasError || output->ctx.hasError ? -1 : 0;
+}
+
+static void *serveConnection(void *arg) {
+    connArgs *args = (connArgs*)arg;
+    standInServer *srv = args->server;
+    pthread_mutex_lock(&srv->lock);
+    streamCtx ctx = {};
+    ctx.socket = srv->connSocks[args->connIndex];
+    pthread_mutex_unlock(&srv->lock);
+    std::shared_ptr<connOutput> output = newOutput(ctx.socket);
+    while (handleRequest(srv, &ctx, output, args->node) == 0) {
+    }
+    pthread_mutex_lock(&srv->lock);
+    for (size_t i=0; i<srv->listeners.size(); ) {
+        if (srv->listeners[i].output == output) {
+            srv->listeners.erase(srv->listeners.begin()+i);
+        } else {
+            i++;
+        }
+    }
+    srv->connSocks[args->connIndex] = -1;
+    pthread_mutex_unlock(&srv->lock);
+    // A request may still be flushing events queued before the listeners were removed,
+    // the shutdown ends its write and the socket is closed once it is done
+    shutdown(ctx.socket, SHUT_RDWR);
+    pthread_mutex_lock(&output->writeLock);
+    output->ctx.socket = -1;
+    pthread_mutex_unlock(&output->writeLock);
+    close(ctx.socket);
+    free(args);
+    return nullptr;
+}
+
+static void *acceptConnections(void *arg) {
+    standInServer *srv = (standInServer*)((void**)arg)[0];
+    int listenSock = (int)(intptr_t)((void**)arg)[1];
+    int node = (int)(intptr_t)((void**)arg)[2];
+    free(arg);
+    for (;;) {
+        int sock = accept(listenSock, nullptr, nullptr);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return nullptr;
+        }
+        // Pipelined responses must not wait for the client ACKs
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_mutex_lock(&srv->lock);
+        if (srv->stopping) {
+            pthread_mutex_unlock(&srv->lock);
+            close(sock);
+            return nullptr;
+        }
+        connArgs *args = (connArgs*)malloc(sizeof(connArgs));
+        args->server = srv;
+        args->connIndex = srv->connSocks.size();
+        args->node = node;
+        srv->connSocks.push_back(sock);
+        pthread_t thread;
+        pthread_create(&thread, nullptr, serveConnection, args);
+        srv->connThreads.push_back(thread);
+        pthread_mutex_unlock(&srv->lock);
+    }
+}
+
+static int listenOn(uint16_t port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 128) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+standInServer *startStandInServer(uint16_t basePort, int nodesNum, int segmentsNum) {
+    standInServer *srv = new standInServer;
+    srv->nodesNum = nodesNum;
+    srv->basePort = basePort;
+    srv->stopping = 0;
+    srv->lastVersion = 0;
+    initTopology(srv, &srv->defaultTopology, 1, nodesNum, segmentsNum);
+    pthread_mutex_init(&srv->lock, nullptr);
+    srv->listenSocks = (int*)malloc(sizeof(int)*nodesNum);
+    srv->acceptThreads = (pthread_t*)malloc(sizeof(pthread_t)*nodesNum);
+    for (int i=0; i<nodesNum; i++) {
+        srv->listenSocks[i] = listenOn(basePort+i);
+        if (srv->listenSocks[i] < 0) {
+            for (int j=0; j<i; j++) {
+                close(srv->listenSocks[j]);
+            }
+            free(srv->listenSocks);
+            free(srv->acceptThreads);
+            pthread_mutex_destroy(&srv->lock);
+            delete srv;
+            return nullptr;
+        }
+    }
+    for (int i=0; i<nodesNum; i++) {
+        void **arg = (void**)malloc(3*sizeof(void*));
+        arg[0] = srv;
+        arg[1] = (void*)(intptr_t)srv->listenSocks[i];
+        arg[2] = (void*)(intptr_t)i;
+        pthread_create(&srv->acceptThreads[i], nullptr, acceptConnections, arg);
+    }
+    return srv;
+}
+
+void setStandInCacheTopology(standInServer *srv, const char *cacheName, int nodesNum, int segmentsNum) {
+    // Ids differ from the ones of the other caches, as two independent topologies of a cluster
+    uint32_t topologyId = 100+srv->cacheTopologies.size();
+    initTopology(srv, &srv->cacheTopologies[cacheName], topologyId, nodesNum, segmentsNum);
+}
+
+void stopStandInServer(standInServer *srv) {
+    pthread_mutex_lock(&srv->lock);
+    srv->stopping = 1;
+    for (int i=0; i<srv->nodesNum; i++) {
+        shutdown(srv->listenSocks[i], SHUT_RDWR);
+    }
+    for (int sock : srv->connSocks) {
+        if (sock >= 0) {
+            shutdown(sock, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&srv->lock);
+    for (int i=0; i<srv->nodesNum; i++) {
+        pthread_join(srv->acceptThreads[i], nullptr);
+        close(srv->listenSocks[i]);
+    }
+    // No new connection can be added now that the accept threads are gone
+    for (pthread_t thread : srv->connThreads) {
+        pthread_join(thread, nullptr);
+    }
+    free(srv->listenSocks);
+    free(srv->acceptThreads);
+    pthread_mutex_destroy(&srv->lock);
+    delete srv;
+}
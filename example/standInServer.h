@@ -0,0 +1,52 @@
+#ifndef STAND_IN_SERVER_H
+#define STAND_IN_SERVER_H
+
+#include <stdint.h>
+
+/** @file */
+
+/**
+ * A lightweight in-process Hotrod server for load and integration tests
+ *
+ * nodesNum nodes listen on 127.0.0.1 ports basePort..basePort+nodesNum-1 and share an
+ * in-memory store per cache name. Clients with a stale topology id get a topology listing all the nodes,
+ * with segmentsNum segments each owned by two consecutive nodes, unless the cache has its own topology,
+ * @see setStandInCacheTopology. Expiration is ignored.
+ * Only PING, GET, PUT, PUT_IF_ABSENT, REPLACE, REMOVE, the versioned GET_WITH_VERSION, GET_WITH_METADATA,
+ * REPLACE_IF_UNMODIFIED and REMOVE_IF_UNMODIFIED, the COUNTER_CREATE, COUNTER_ADD_AND_GET
+ * and COUNTER_GET counter operations, ADD_CLIENT_LISTENER and REMOVE_CLIENT_LISTENER, EXEC and the
+ * PREPARE, COMMIT and ROLLBACK transaction operations are understood, any other request is answered
+ * with UNKNOWN_COMMAND_STATUS and the connection is closed. Listeners get the events of the writes
+ * to their cache, filters and converters are not supported. Prepared transactions don't lock their
+ * keys, the versions read are checked only at the prepare, and never time out.
+ * EXEC runs built-in tasks on the entries of the cache whose primary owner is the node
+ * serving the request, so a task run on every node covers each entry once:
+ * - echo returns its parameter value
+ * - count returns the number of entries, as decimal text
+ * - sum returns the sum of the values read as decimal integers, as decimal text
+ * count and sum take only the keys starting with their parameter prefix, if given;
+ * other tasks fail with SERVER_ERROR_STATUS.
+ */
+typedef struct standInServer standInServer;
+
+/**
+ * startStandInServer starts all the nodes, each one served by its own threads
+ *
+ * @return the server or nullptr if a port can't be bound
+ */
+standInServer *startStandInServer(uint16_t basePort, int nodesNum, int segmentsNum);
+
+/**
+ * setStandInCacheTopology gives cacheName its own topology: the first nodesNum nodes with segmentsNum segments
+ *
+ * Its topology id differs from the ones of the other caches, the entries are still served by
+ * any node. Call it before any client connects.
+ */
+void setStandInCacheTopology(standInServer *srv, const char *cacheName, int nodesNum, int segmentsNum);
+
+/**
+ * stopStandInServer closes all the connections and releases the server
+ */
+void stopStandInServer(standInServer *server);
+
+#endif // STAND_IN_SERVER_H
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "topologyFile.h"
+
+int saveTopology(const char *path, const topologyInfo *tInfo) {
+    int size = topologySnapshotSize(tInfo);
+    uint8_t *buff = (uint8_t*)malloc(size);
+    writeTopologySnapshot(buff, tInfo);
+    char *tmpPath = (char*)malloc(strlen(path)+5);
+    sprintf(tmpPath, "%s.tmp", path);
+    int res = -1;
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        int written = write(fd, buff, size);
+        close(fd);
+        if (written == size && rename(tmpPath, path) == 0) {
+            res = 0;
+        } else {
+            unlink(tmpPath);
+        }
+    }
+    free(tmpPath);
+    free(buff);
+    return res;
+}
+
+void *mapTopology(const char *path, topologyInfo *tInfo, size_t *mapLen) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    // Private writable mapping: the file is never modified but tInfo holds non const pointers
+    void *map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    if (loadTopologySnapshot((uint8_t*)map, st.st_size, tInfo) < 0) {
+        munmap(map, st.st_size);
+        return nullptr;
+    }
+    *mapLen = st.st_size;
+    return map;
+}
+
+void unmapTopology(void *map, size_t mapLen, topologyInfo *tInfo) {
+    releaseTopologySnapshot(tInfo);
+    munmap(map, mapLen);
+}
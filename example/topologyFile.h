@@ -0,0 +1,32 @@
+#ifndef TOPOLOGY_FILE_H
+#define TOPOLOGY_FILE_H
+
+#include <stddef.h>
+#include "hotrod-c.h"
+
+/** @file */
+
+/**
+ * saveTopology persists the snapshot of tInfo to path
+ *
+ * The file is written aside and renamed, so a concurrent mapTopology()
+ * never sees a partial snapshot.
+ *
+ * @return 0 on success, -1 on error
+ */
+int saveTopology(const char *path, const topologyInfo *tInfo);
+
+/**
+ * mapTopology memory maps a snapshot saved by saveTopology() and loads it in tInfo
+ *
+ * @return the mapping, to be released with unmapTopology() when tInfo is no longer
+ * used, or nullptr if the file is missing or invalid
+ */
+void *mapTopology(const char *path, topologyInfo *tInfo, size_t *mapLen);
+
+/**
+ * unmapTopology releases tInfo, loaded by mapTopology(), and its mapping
+ */
+void unmapTopology(void *map, size_t mapLen, topologyInfo *tInfo);
+
+#endif // TOPOLOGY_FILE_H
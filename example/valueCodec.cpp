@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HOTROD_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "valueCodec.h"
+
+#ifdef HOTROD_WITH_ZLIB
+static int zlibBound(int len) {
+    return compressBound(len);
+}
+
+static int zlibCompress(const uint8_t *src, int len, uint8_t *dst, int capacity) {
+    uLongf dstLen = capacity;
+    if (compress2(dst, &dstLen, src, len, Z_BEST_SPEED) != Z_OK) {
+        return -1;
+    }
+    return dstLen;
+}
+
+static int zlibDecompress(const uint8_t *src, int len, uint8_t *dst, int originalLen) {
+    uLongf dstLen = originalLen;
+    if (uncompress(dst, &dstLen, src, len) != Z_OK || dstLen != (uLongf)originalLen) {
+        return -1;
+    }
+    return 0;
+}
+
+const valueCodec zlibCodec = {1, "zlib", zlibBound, zlibCompress, zlibDecompress};
+#endif
+
+static const valueCodec *codecs[256] = {
+#ifdef HOTROD_WITH_ZLIB
+    nullptr, &zlibCodec
+#endif
+};
+
+void registerValueCodec(const valueCodec *codec) {
+    __atomic_store_n(&codecs[codec->id], codec, __ATOMIC_RELEASE);
+}
+
+const valueCodec *findValueCodec(const char *name) {
+    for (int i=1; i<256; i++) {
+        const valueCodec *codec = __atomic_load_n(&codecs[i], __ATOMIC_ACQUIRE);
+        if (codec != nullptr && strcmp(codec->name, name) == 0) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+int isFramedValue(const uint8_t *value, int len) {
+    return len >= VALUE_FRAME_SIZE && value[0] == VALUE_FRAME_MAGIC[0] && value[1] == VALUE_FRAME_MAGIC[1];
+}
+
+static void reserve(valueBuffer *buf, int len) {
+    if (buf->capacity < len) {
+        buf->buff = (uint8_t*)realloc(buf->buff, len);
+        buf->capacity = len;
+    }
+}
+
+static void writeFrame(uint8_t *buff, uint8_t id, uint32_t len) {
+    buff[0] = VALUE_FRAME_MAGIC[0];
+    buff[1] = VALUE_FRAME_MAGIC[1];
+    buff[2] = id;
+    buff[3] = len >> 24;
+    buff[4] = len >> 16;
+    buff[5] = len >> 8;
+    buff[6] = len;
+}
+
+int encodeValue(const valueCodec *codec, int threshold, const byteArray *value, valueBuffer *out) {
+    if (codec != nullptr && value->len >= threshold) {
+        reserve(out, VALUE_FRAME_SIZE+codec->bound(value->len));
+        int len = codec->compress(value->buff, value->len, out->buff+VALUE_FRAME_SIZE, out->capacity-VALUE_FRAME_SIZE);
+        if (len >= 0 && VALUE_FRAME_SIZE+len < value->len) {
+            writeFrame(out->buff, codec->id, value->len);
+            out->len = VALUE_FRAME_SIZE+len;
+            return 1;
+        }
+    }
+    if (!isFramedValue(value->buff, value->len)) {
+        return 0;
+    }
+    // Escape a raw value that would be taken for a frame
+    reserve(out, VALUE_FRAME_SIZE+value->len);
+    writeFrame(out->buff, 0, value->len);
+    memcpy(out->buff+VALUE_FRAME_SIZE, value->buff, value->len);
+    out->len = VALUE_FRAME_SIZE+value->len;
+    return 1;
+}
+
+int decodeValue(valueBuffer *buf) {
+    uint8_t id = buf->buff[2];
+    uint32_t frameLen = ((uint32_t)buf->buff[3] << 24) | ((uint32_t)buf->buff[4] << 16) | ((uint32_t)buf->buff[5] << 8) | buf->buff[6];
+    if (frameLen > INT_MAX) {
+        return -1;
+    }
+    int originalLen = frameLen;
+    int dataLen = buf->len-VALUE_FRAME_SIZE;
+    if (id == 0) {
+        if (originalLen != dataLen) {
+            return -1;
+        }
+        memmove(buf->buff, buf->buff+VALUE_FRAME_SIZE, dataLen);
+        buf->len = dataLen;
+        return dataLen;
+    }
+    const valueCodec *codec = __atomic_load_n(&codecs[id], __ATOMIC_ACQUIRE);
+    if (codec == nullptr) {
+        return -1;
+    }
+    if (originalLen > buf->capacity && !buf->growable) {
+        buf->len = originalLen;
+        return -ENOBUFS;
+    }
+    // The compressed data is moved aside, the original value takes its place in buf
+    uint8_t *data = (uint8_t*)malloc(dataLen);
+    memcpy(data, buf->buff+VALUE_FRAME_SIZE, dataLen);
+    reserve(buf, originalLen);
+    int res = codec->decompress(data, dataLen, buf->buff, originalLen);
+    free(data);
+    buf->len = res == 0 ? originalLen : 0;
+    return res == 0 ? originalLen : -1;
+}
@@ -0,0 +1,75 @@
+#ifndef VALUE_CODEC_H
+#define VALUE_CODEC_H
+
+#include <stdint.h>
+#include "hotrod-c.h"
+
+/** @file */
+
+/**
+ * A compression codec for values
+ *
+ * A compressed value is stored framed: the 2 bytes of VALUE_FRAME_MAGIC, the id of the codec
+ * and the original size as a 4 bytes big endian int, followed by the compressed data. A raw
+ * value that starts with the magic is framed with id 0 (stored), so any value read can be
+ * decoded without knowing how it was written.
+ */
+typedef struct {
+    uint8_t id;         ///< stored in the frame, 1-255
+    const char *name;
+    int (*bound)(int len);  ///< max compressed size for len bytes
+    /// @return the compressed size or -1 if dst is too small
+    int (*compress)(const uint8_t *src, int len, uint8_t *dst, int capacity);
+    /// @return 0 if exactly originalLen bytes have been decompressed in dst
+    int (*decompress)(const uint8_t *src, int len, uint8_t *dst, int originalLen);
+} valueCodec;
+
+static const uint8_t VALUE_FRAME_MAGIC[2] = {0xF9, 0x5A};
+static const int VALUE_FRAME_SIZE = 7;
+
+#ifdef HOTROD_WITH_ZLIB
+/**
+ * zlib deflate at the fastest level, registered by default
+ */
+extern const valueCodec zlibCodec;
+#endif
+
+/**
+ * registerValueCodec makes a codec available for decoding and for findValueCodec
+ *
+ * Codecs must be registered before the clients using them start.
+ */
+void registerValueCodec(const valueCodec *codec);
+
+/**
+ * findValueCodec looks up a registered codec by name
+ *
+ * @return the codec or nullptr if none is registered with that name
+ */
+const valueCodec *findValueCodec(const char *name);
+
+/**
+ * encodeValue frames value in out, compressing it with codec if it is at least threshold bytes
+ *
+ * A value that doesn't shrink is kept raw. out is a growable buffer.
+ *
+ * @return 1 if out holds the value to send, 0 if value can be sent as is
+ */
+int encodeValue(const valueCodec *codec, int threshold, const byteArray *value, valueBuffer *out);
+
+/**
+ * isFramedValue tells if the len bytes of value must go through decodeValue
+ */
+int isFramedValue(const uint8_t *value, int len);
+
+/**
+ * decodeValue replaces the framed value in buf with the original one
+ *
+ * If buf is not growable and the original value doesn't fit, its content is left untouched.
+ *
+ * @return the original size, -ENOBUFS if it doesn't fit buf, buf->len is then the original size,
+ *         or -1 if the frame is corrupted or its codec isn't registered
+ */
+int decodeValue(valueBuffer *buf);
+
+#endif // VALUE_CODEC_H
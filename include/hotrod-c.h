@@ -1,3 +1,6 @@
+#ifndef HOTROD_C_H
+#define HOTROD_C_H
+
 #include <stdint.h>
 
 /*! \mainpage A Reference Implementation in plain C for Hotrod protocol 2.8+
@@ -42,6 +45,152 @@ const uint8_t CLIENT_INTELLIGENCE_TOPOLOGY_AWARE          = 0x02;
 const uint8_t CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE = 0x03; 
 /**@}*/
 
+/**
+ * \defgroup ResponseOpcode Response opcode
+ * @{
+ */
+
+/**@}*/
+
+/**
+ * \defgroup ErrorResponseCode Error response code
+ * @{
+ */
+const uint8_t OK_STATUS                          = 0x00; ///< No error
+const uint8_t INVALID_MAGIC_OR_MESSAGE_ID_STATUS = 0x81; ///< Invalid magic or message id
+const uint8_t UNKNOWN_COMMAND_STATUS             = 0x82; ///< Unknown command
+const uint8_t UNKNOWN_VERSION_STATUS             = 0x83; ///< Unknown version
+const uint8_t REQUEST_PARSING_ERROR_STATUS       = 0x84; ///< Request parsing error
+const uint8_t SERVER_ERROR_STATUS                = 0x85; ///< Server Error
+const uint8_t COMMAND_TIMEOUT_STATUS             = 0x86; ///< Command timed out
+/**@}*/
+
+/**
+ * \defgroup ResponseStatus Response status for conditional operations
+ * @{
+ */
+const uint8_t NOT_PUT_REMOVED_REPLACED_STATUS    = 0x01; ///< Conditional operation not executed
+const uint8_t KEY_DOES_NOT_EXIST_STATUS          = 0x02; ///< Key does not exist
+const uint8_t SUCCESS_WITH_PREVIOUS_STATUS       = 0x03; ///< Executed, the previous value follows
+const uint8_t NOT_EXECUTED_WITH_PREVIOUS_STATUS  = 0x04; ///< Conditional operation not executed, the current value follows
+/**@}*/
+
+/**
+ * \defgroup RequestFlags Flags of the request header
+ * @{
+ */
+const uint32_t FORCE_RETURN_VALUE                = 0x01; ///< Write operations return the previous value
+const uint32_t DEFAULT_LIFESPAN                  = 0x02; ///< Use the lifespan configured on the server
+const uint32_t DEFAULT_MAXIDLE                   = 0x04; ///< Use the maxIdle configured on the server
+const uint32_t SKIP_CACHE_LOAD                   = 0x08; ///< Don't read the entry from the cache store
+const uint32_t SKIP_INDEXING                     = 0x10; ///< Don't index the entry
+const uint32_t SKIP_LISTENER_NOTIFICATION        = 0x20; ///< Don't notify the client listeners
+/**@}*/
+
+/**
+ * \defgroup RequestOpCode Operation code for request
+ * @{
+ */
+const uint8_t PUT_REQUEST                         = 0x01;
+const uint8_t GET_REQUEST                         = 0x03;
+const uint8_t PUT_IF_ABSENT_REQUEST               = 0x05;
+const uint8_t REPLACE_REQUEST                     = 0x07;
+const uint8_t REPLACE_IF_UNMODIFIED_REQUEST       = 0x09;
+const uint8_t REMOVE_REQUEST                      = 0x0B;
+const uint8_t REMOVE_IF_UNMODIFIED_REQUEST        = 0x0D;
+const uint8_t CONTAINS_KEY_REQUEST                = 0x0F;
+const uint8_t GET_WITH_VERSION_REQUEST            = 0x11;
+const uint8_t CLEAR_REQUEST                       = 0x13;
+const uint8_t STATS_REQUEST                       = 0x15;
+const uint8_t PING_REQUEST                        = 0x17;
+const uint8_t BULK_GET_REQUEST                    = 0x19;
+const uint8_t GET_WITH_METADATA_REQUEST           = 0x1B;
+const uint8_t BULK_GET_KEYS_REQUEST               = 0x1D;
+const uint8_t QUERY_REQUEST                       = 0x1F;
+const uint8_t AUTH_MECH_LIST_REQUEST              = 0x21;
+const uint8_t AUTH_REQUEST                        = 0x23;
+const uint8_t ADD_CLIENT_LISTENER_REQUEST         = 0x25;
+const uint8_t REMOVE_CLIENT_LISTENER_REQUEST      = 0x27;
+const uint8_t SIZE_REQUEST                        = 0x29;
+const uint8_t EXEC_REQUEST                        = 0x2B;
+const uint8_t PUT_ALL_REQUEST                     = 0x2D;
+const uint8_t GET_ALL_REQUEST                     = 0x2F;
+const uint8_t ITERATION_START_REQUEST             = 0x31;
+const uint8_t ITERATION_NEXT_REQUEST              = 0x33;
+const uint8_t ITERATION_END_REQUEST               = 0x35;
+const uint8_t GET_STREAM_REQUEST                  = 0x37;
+const uint8_t PUT_STREAM_REQUEST                  = 0x39;
+const uint8_t PREPARE_REQUEST                     = 0x3B;
+const uint8_t COMMIT_REQUEST                      = 0x3D;
+const uint8_t ROLLBACK_REQUEST                    = 0x3F;
+const uint8_t COUNTER_CREATE_REQUEST              = 0x4B;
+const uint8_t COUNTER_GET_CONFIGURATION_REQUEST   = 0x4D;
+const uint8_t COUNTER_IS_DEFINED_REQUEST          = 0x4F;
+const uint8_t COUNTER_ADD_AND_GET_REQUEST         = 0x52;
+const uint8_t COUNTER_RESET_REQUEST               = 0x54;
+const uint8_t COUNTER_GET_REQUEST                 = 0x56;
+const uint8_t COUNTER_CAS_REQUEST                 = 0x58;
+const uint8_t COUNTER_ADD_LISTENER_REQUEST        = 0x5A;
+const uint8_t COUNTER_REMOVE_LISTENER_REQUEST     = 0x5C;
+const uint8_t COUNTER_REMOVE_REQUEST              = 0x5E;
+const uint8_t COUNTER_GET_NAMES_REQUEST           = 0x64;
+/**@}*/
+
+/**
+ * \defgroup ResponseOpCode Operation code for response
+ * @{
+ */
+const uint8_t PUT_RESPONSE                        = 0x02;
+const uint8_t GET_RESPONSE                        = 0x04;
+const uint8_t PUT_IF_ABSENT_RESPONSE              = 0x06;
+const uint8_t REPLACE_RESPONSE                    = 0x08;
+const uint8_t REPLACE_IF_UNMODIFIED_RESPONSE      = 0x0A;
+const uint8_t REMOVE_RESPONSE                     = 0x0C;
+const uint8_t REMOVE_IF_UNMODIFIED_RESPONSE       = 0x0E;
+const uint8_t CONTAINS_KEY_RESPONSE               = 0x10;
+const uint8_t GET_WITH_VERSION_RESPONSE           = 0x12;
+const uint8_t CLEAR_RESPONSE                      = 0x14;
+const uint8_t STATS_RESPONSE                      = 0x16;
+const uint8_t PING_RESPONSE                       = 0x18;
+const uint8_t BULK_GET_RESPONSE                   = 0x1A;
+const uint8_t GET_WITH_METADATA_RESPONSE          = 0x1C;
+const uint8_t BULK_GET_KEYS_RESPONSE              = 0x1E;
+const uint8_t QUERY_RESPONSE                      = 0x20;
+const uint8_t AUTH_MECH_LIST_RESPONSE             = 0x22;
+const uint8_t AUTH_RESPONSE                       = 0x24;
+const uint8_t ADD_CLIENT_LISTENER_RESPONSE        = 0x26;
+const uint8_t REMOVE_CLIENT_LISTENER_RESPONSE     = 0x28;
+const uint8_t SIZE_RESPONSE                       = 0x2A;
+const uint8_t EXEC_RESPONSE                       = 0x2C;
+const uint8_t PUT_ALL_RESPONSE                    = 0x2E;
+const uint8_t GET_ALL_RESPONSE                    = 0x30;
+const uint8_t ITERATION_NEXT_RESPONSE             = 0x34;
+const uint8_t ITERATION_END_RESPONSE              = 0x36;
+const uint8_t ITERATION_START_RESPONSE            = 0x32;
+const uint8_t GET_STREAM_RESPONSE                 = 0x38;
+const uint8_t PUT_STREAM_RESPONSE                 = 0x3A;
+const uint8_t PREPARE_RESPONSE                    = 0x3C;
+const uint8_t COMMIT_RESPONSE                     = 0x3E;
+const uint8_t ROLLBACK_RESPONSE                   = 0x40;
+const uint8_t ERROR_RESPONSE                      = 0x50;
+const uint8_t CACHE_ENTRY_CREATED_EVENT_RESPONSE  = 0x60;
+const uint8_t CACHE_ENTRY_MODIFIED_EVENT_RESPONSE = 0x61;
+const uint8_t CACHE_ENTRY_REMOVED_EVENT_RESPONSE  = 0x62;
+const uint8_t CACHE_ENTRY_EXPIRED_EVENT_RESPONSE  = 0x63;
+const uint8_t COUNTER_CREATE_RESPONSE             = 0x4C;
+const uint8_t COUNTER_GET_CONFIGURATION_RESPONSE  = 0x4E;
+const uint8_t COUNTER_IS_DEFINED_RESPONSE         = 0x51;
+const uint8_t COUNTER_ADD_AND_GET_RESPONSE        = 0x53;
+const uint8_t COUNTER_RESET_RESPONSE              = 0x55;
+const uint8_t COUNTER_GET_RESPONSE                = 0x57;
+const uint8_t COUNTER_CAS_RESPONSE                = 0x59;
+const uint8_t COUNTER_ADD_LISTENER_RESPONSE       = 0x5B;
+const uint8_t COUNTER_REMOVE_LISTENER_RESPONSE    = 0x5D;
+const uint8_t COUNTER_REMOVE_RESPONSE             = 0x5F;
+const uint8_t COUNTER_GET_NAMES_RESPONSE          = 0x65;
+const uint8_t COUNTER_EVENT_RESPONSE              = 0x66;
+/**@}*/
+
 /**
  * @file
  * @brief This is the C implementation of the hotrod 2.8 protocol for client.
@@ -52,6 +201,20 @@ typedef struct {
     uint8_t *buff;
 } byteArray;
 
+/**
+ * A caller owned buffer that can be reused across reads
+ *
+ * buff is capacity bytes long and len is the size of the last value read into it.
+ * A growable buffer must be allocated with malloc (or be nullptr with 0 capacity)
+ * and is reallocated by the library when a larger value arrives.
+ */
+typedef struct {
+    int len;
+    int capacity;
+    uint8_t *buff;
+    uint8_t growable;
+} valueBuffer;
+
 typedef struct {
     uint8_t infoType;
     uint32_t predefinedMediaType;
@@ -97,6 +260,34 @@ typedef struct {
     uint8_t topologyChanged;
 } topologyInfo;
 
+/**
+ * Time units of lifespan and maxIdle in write requests
+ */
+enum  TimeUnit {
+    SECONDS = 0x00,
+    MILLISECONDS = 0x01,
+    NANOSECONDS = 0x02,
+    MICROSECONDS = 0x03,
+    MINUTES = 0x04,
+    DAYS = 0x06,
+    HOURS = 0x05,
+    DEFAULT = 0x07,
+    INFINITUM = 0x08
+};
+
+/**
+ * Expiration of an entry in write requests
+ *
+ * An amount is sent only if its unit is neither DEFAULT nor INFINITUM. Write functions
+ * take a nullptr expiration for entries that never expire.
+ */
+typedef struct {
+    uint64_t lifespan;
+    uint64_t maxIdle;
+    uint8_t lifespanUnit;   ///< a TimeUnit
+    uint8_t maxIdleUnit;    ///< a TimeUnit
+} entryExpiration;
+
 typedef void (*streamReader)(void* ctx, uint8_t *val, int len);
 typedef void (*streamWriter)(void* ctx, uint8_t *val, int len);
 
@@ -116,6 +307,28 @@ void writeGet(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *key
  */
 void readGet(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, byteArray *arr);
 
+/**
+ * readGetInto read a GET response into a reusable buffer
+ *
+ * Same as @ref readGet but the value is decoded into buf, so a read loop reusing the
+ * same buffer does no allocation once the buffer is large enough. If buf is not
+ * growable and the value doesn't fit, the value is discarded and buf->len is 0.
+ *
+ * @return the value size, greater than buf->capacity when the value didn't fit
+ */
+int readGetInto(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, valueBuffer *buf);
+
+/**
+ * readGetValueLength read a GET response up to the value
+ *
+ * Same as @ref readGet but the value is left on the stream, so the transport can move it
+ * straight to its destination (a file, an mmap region). The caller must consume exactly
+ * the returned number of bytes before reading the next response.
+ *
+ * @return the value size or -1 if the response has no value
+ */
+int readGetValueLength(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo);
+
 
 /**
  * writePut send a request for a put operation
@@ -126,7 +339,379 @@ void readGet(void *ctx, streamReader reader, responseHeader *hdr, requestHeader
  */
 void writePut(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue);
 
+/**
+ * writePutWithExpiration send a put request for an entry that expires as set in exp
+ *
+ * With FORCE_RETURN_VALUE in hdr->flags the response carries the previous value, @see readPut.
+ */
+void writePutWithExpiration(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp);
+
+/**
+ * writePutHeader send a put request up to the value
+ *
+ * Header, key and value length are written, the caller must then write exactly valueLen
+ * bytes of value on the same stream. This lets the transport send a large value without
+ * copying it in the request buffer (e.g. with sendfile). The response is read with
+ * @ref readPut as usual.
+ */
+void writePutHeader(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, uint32_t valueLen, const entryExpiration *exp);
+
+/**
+ * readPut read a put response
+ *
+ * If the status is SUCCESS_WITH_PREVIOUS_STATUS the previous value is read in arr, to be freed
+ * by the caller, otherwise arr is empty. arr can be nullptr if the previous value is not needed.
+ */
 void readPut(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, byteArray *arr);
 
+/**
+ * writePutIfAbsent send a request to store keyValue only if keyName has no value
+ *
+ * Read the result with @ref readConditional.
+ */
+void writePutIfAbsent(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp);
+
+/**
+ * writeReplace send a request to replace the value of keyName only if it has one
+ *
+ * Read the result with @ref readConditional.
+ */
+void writeReplace(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp);
+
+/**
+ * writeRemove send a request to remove keyName
+ *
+ * Read the result with @ref readConditional, KEY_DOES_NOT_EXIST_STATUS if there was no value.
+ */
+void writeRemove(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName);
+
+/**
+ * writeGetWithVersion sends a GET_WITH_VERSION request
+ *
+ * After this call a @ref readGetWithVersion must be performed on the same stream.
+ */
+void writeGetWithVersion(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName);
+
+/**
+ * readGetWithVersion read a GET_WITH_VERSION response
+ *
+ * As @ref readGetInto, version is set if the status is OK_STATUS. The version identifies
+ * the value for @ref writeReplaceIfUnmodified and @ref writeRemoveIfUnmodified.
+ *
+ * @return the value size
+ */
+int readGetWithVersion(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, uint64_t *version, valueBuffer *buf);
+
+/**
+ * Flags of entryMetadata
+ */
+const uint8_t INFINITE_LIFESPAN = 0x01;   ///< created and lifespan are not set
+const uint8_t INFINITE_MAXIDLE  = 0x02;   ///< lastUsed and maxIdle are not set
+
+/**
+ * Expiration and version of an entry
+ */
+typedef struct {
+    uint8_t flags;
+    int64_t created;        ///< ms since the epoch
+    uint32_t lifespan;      ///< seconds
+    int64_t lastUsed;       ///< ms since the epoch
+    uint32_t maxIdle;       ///< seconds
+    uint64_t version;
+} entryMetadata;
+
+/**
+ * writeGetWithMetadata sends a GET_WITH_METADATA request
+ *
+ * After this call a @ref readGetWithMetadata must be performed on the same stream.
+ */
+void writeGetWithMetadata(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName);
+
+/**
+ * readGetWithMetadata read a GET_WITH_METADATA response, as @ref readGetWithVersion
+ */
+int readGetWithMetadata(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, entryMetadata *metadata, valueBuffer *buf);
+
+/**
+ * writeReplaceIfUnmodified send a request to replace the value of keyName if its version is still version
+ *
+ * Read the result with @ref readConditional.
+ */
+void writeReplaceIfUnmodified(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, uint64_t version, const entryExpiration *exp);
+
+/**
+ * writeRemoveIfUnmodified send a request to remove keyName if its version is still version
+ *
+ * Read the result with @ref readConditional.
+ */
+void writeRemoveIfUnmodified(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, uint64_t version);
+
+/**
+ * readConditional read the response of a conditional write
+ *
+ * The status is OK_STATUS if the operation has been executed, NOT_PUT_REMOVED_REPLACED_STATUS
+ * if the condition didn't hold and KEY_DOES_NOT_EXIST_STATUS if there was no value.
+ * With FORCE_RETURN_VALUE in the request flags they become SUCCESS_WITH_PREVIOUS_STATUS and
+ * NOT_EXECUTED_WITH_PREVIOUS_STATUS when there was a value, which is read in previous
+ * (a nullptr previous discards it).
+ *
+ * @return the size of the previous value, greater than previous->capacity if it didn't fit
+ */
+int readConditional(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, valueBuffer *previous);
+
 void writePing(void *ctx, streamWriter writer, requestHeader *hdr);
 void readPing(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, mediaType *keyMt, mediaType *valueMt);
+
+/**
+ * Flags of a counter configuration, a counter with neither WEAK nor BOUNDED is an unbounded strong counter
+ */
+const uint8_t COUNTER_WEAK       = 0x01;
+const uint8_t COUNTER_BOUNDED    = 0x02;    ///< strong counter with bounds
+const uint8_t COUNTER_PERSISTENT = 0x04;    ///< survives a cluster restart
+
+typedef struct {
+    uint8_t flags;
+    uint32_t concurrencyLevel;  ///< weak counters only
+    int64_t lowerBound;         ///< bounded counters only
+    int64_t upperBound;         ///< bounded counters only
+    int64_t initialValue;
+} counterConfiguration;
+
+/**
+ * writeCounterCreate defines a counter
+ *
+ * Read the result with @ref readCounterCreate, status is NOT_PUT_REMOVED_REPLACED_STATUS
+ * if the counter was already defined.
+ */
+void writeCounterCreate(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *counterName, const counterConfiguration *conf);
+void readCounterCreate(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo);
+
+/**
+ * writeCounterAddAndGet adds delta to a counter
+ *
+ * Read the new value with @ref readCounterValue.
+ */
+void writeCounterAddAndGet(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *counterName, int64_t delta);
+
+/**
+ * writeCounterGet reads the value of a counter
+ *
+ * Read the value with @ref readCounterValue.
+ */
+void writeCounterGet(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *counterName);
+
+/**
+ * readCounterValue reads the response of a counter add and get or get
+ *
+ * value is set only if the status is OK_STATUS, KEY_DOES_NOT_EXIST_STATUS means the counter is not defined.
+ */
+void readCounterValue(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, int64_t *value);
+
+/**
+ * \defgroup ListenerInterests Events a client listener receives
+ * @{
+ */
+const uint32_t LISTENER_INTEREST_CREATED  = 0x01;
+const uint32_t LISTENER_INTEREST_MODIFIED = 0x02;
+const uint32_t LISTENER_INTEREST_REMOVED  = 0x04;
+const uint32_t LISTENER_INTEREST_EXPIRED  = 0x08;
+const uint32_t LISTENER_INTEREST_ALL      = 0x0F;
+/**@}*/
+
+/**
+ * writeAddClientListener registers a listener for the events of the cache
+ *
+ * The listener has no filter and no converter. Events are then sent by the server on the
+ * same stream, each one as a response with an event opcode read with @ref readCacheEvent.
+ * With includeState the existing entries are sent as created events before the response
+ * to this request (ADD_CLIENT_LISTENER_RESPONSE).
+ */
+void writeAddClientListener(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *listenerId, uint8_t includeState, uint32_t interests);
+
+/**
+ * writeRemoveClientListener unregisters a listener, the response is REMOVE_CLIENT_LISTENER_RESPONSE
+ */
+void writeRemoveClientListener(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *listenerId);
+
+/**
+ * A cache event received by a client listener
+ *
+ * Buffers are growable and reused from event to event.
+ */
+typedef struct {
+    uint8_t opCode;         ///< CACHE_ENTRY_*_EVENT_RESPONSE
+    uint8_t custom;         ///< 0 for key and version, otherwise key holds the converted event
+    uint8_t retried;        ///< the operation was retried, the event may be a duplicate
+    uint64_t version;       ///< created and modified events only
+    valueBuffer listenerId;
+    valueBuffer key;
+} cacheEvent;
+
+/**
+ * isCacheEvent tells if a response header read with readResponseHeader is an event
+ */
+int isCacheEvent(const responseHeader *hdr);
+
+/**
+ * readCacheEvent reads the body of an event whose header has been read with readResponseHeader
+ */
+void readCacheEvent(void *ctx, streamReader reader, const responseHeader *hdr, cacheEvent *event);
+
+/**
+ * Identifier of a transaction branch, as in XA
+ */
+typedef struct {
+    int32_t formatId;
+    byteArray globalId;     ///< up to 64 bytes, the same for all the branches of a transaction
+    byteArray branchId;     ///< up to 64 bytes
+} transactionXid;
+
+/**
+ * \defgroup TxControl Control flags of a transaction modification
+ * @{
+ */
+const uint8_t TX_NOT_READ     = 0x01;   ///< the key was not read, its version is not checked
+const uint8_t TX_NON_EXISTING = 0x02;   ///< the key was read and had no value
+const uint8_t TX_REMOVE_OP    = 0x04;   ///< the key is removed, no value
+/**@}*/
+
+/**
+ * A write of a transaction
+ *
+ * Without TX_NOT_READ and TX_NON_EXISTING versionRead is the version the transaction read,
+ * the prepare fails if the key has been modified since.
+ */
+typedef struct {
+    byteArray key;
+    byteArray value;                    ///< ignored with TX_REMOVE_OP
+    uint8_t control;                    ///< @ref TxControl
+    uint64_t versionRead;
+    const entryExpiration *expiration;  ///< nullptr for entries that never expire
+} txModification;
+
+/**
+ * \defgroup XaCodes Results of the transaction operations, as in XA
+ * @{
+ */
+const int32_t XA_OK         = 0;
+const int32_t XA_RDONLY     = 3;        ///< nothing to commit, the branch is already complete
+const int32_t XA_RBROLLBACK = 100;      ///< the branch has been rolled back, e.g. a version check failed
+const int32_t XAER_NOTA     = -4;       ///< unknown xid
+/**@}*/
+
+/**
+ * writePrepare sends the modifications of a transaction branch and prepares it
+ *
+ * With onePhaseCommit the branch is also committed and no COMMIT must follow.
+ * Read the result with @ref readTransactionResult.
+ */
+void writePrepare(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid, uint8_t onePhaseCommit, uint64_t timeoutMs, const txModification *mods, int modsNum);
+
+/**
+ * writeCommit commits a prepared branch, read the result with @ref readTransactionResult
+ */
+void writeCommit(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid);
+
+/**
+ * writeRollback rolls back a prepared branch, read the result with @ref readTransactionResult
+ */
+void writeRollback(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid);
+
+/**
+ * readTransactionResult reads the response of a prepare, commit or rollback
+ *
+ * xaCode is set only if the status is OK_STATUS, @ref XaCodes.
+ */
+void readTransactionResult(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, int32_t *xaCode);
+
+/**
+ * A named parameter of an EXEC request
+ */
+typedef struct {
+    byteArray name;
+    byteArray value;
+} execParam;
+
+/**
+ * writeExec sends an EXEC request running the server task scriptName with params
+ *
+ * Read the result with @ref readExecInto.
+ */
+void writeExec(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *scriptName, const execParam *params, int paramsNum);
+
+/**
+ * readExecInto reads the result of an EXEC into a reusable buffer, as @ref readGetInto
+ *
+ * @return the result size, greater than result->capacity when the result didn't fit
+ */
+int readExecInto(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, valueBuffer *result);
+
+/**
+ * enableAllocationCounting makes the library count its heap allocations
+ *
+ * Counting is off by default and costs an atomic increment per allocation when on.
+ */
+void enableAllocationCounting(int enabled);
+
+/**
+ * allocationCount returns the allocations done by the library since counting was enabled
+ */
+uint64_t allocationCount();
+
+/**
+ * freeTopology releases a topology read from a response header
+ *
+ * It must not be called on a topology loaded from a snapshot, @see releaseTopologySnapshot
+ */
+void freeTopology(topologyInfo *tInfo);
+
+/**
+ * getSegmentVoidPtr returns the segment of a key given its bytes
+ */
+uint32_t getSegmentVoidPtr(const void *key, int size, unsigned int numSegments);
+
+/**
+ * getServerListVoidPtr returns the owners of a key, the primary owner first
+ *
+ * The list is getServerListSizeVoidPtr() long, entries are indexes in tInfo->servers.
+ */
+uint32_t* getServerListVoidPtr(const topologyInfo *t, const void *key, int size);
+uint8_t getServerListSizeVoidPtr(const topologyInfo *t, const void *key, int size);
+
+/**
+ * getSegment32 returns the segment of an integer object id
+ */
+uint32_t getSegment32(uint32_t objectId, unsigned int numSegments);
+uint32_t* getServerList32(const topologyInfo *t, uint32_t objectId);
+uint8_t getServerListSize32(const topologyInfo *t, uint32_t objectId);
+
+/**
+ * topologySnapshotSize returns the size of the binary snapshot of a topology
+ *
+ * A snapshot is a compact copy of a hash distribution aware topologyInfo that can be
+ * persisted and loaded back (e.g. memory mapped) at startup, so routing can start
+ * before the first server replies. @see writeTopologySnapshot loadTopologySnapshot
+ */
+int topologySnapshotSize(const topologyInfo *tInfo);
+
+/**
+ * writeTopologySnapshot writes the snapshot of tInfo in buff, which must be
+ * topologySnapshotSize() bytes long. Returns the written size.
+ */
+int writeTopologySnapshot(uint8_t *buff, const topologyInfo *tInfo);
+
+/**
+ * loadTopologySnapshot makes tInfo usable for routing directly from a snapshot buffer
+ *
+ * tInfo will point into buff, so buff must outlive it. Returns 0 on success or -1 if
+ * the buffer is not a valid snapshot. A loaded topology is released with
+ * releaseTopologySnapshot(), never with freeTopology().
+ */
+int loadTopologySnapshot(uint8_t *buff, int len, topologyInfo *tInfo);
+
+/**
+ * releaseTopologySnapshot frees what loadTopologySnapshot allocated, buff is left to the caller
+ */
+void releaseTopologySnapshot(topologyInfo *tInfo);
+
+#endif // HOTROD_C_H
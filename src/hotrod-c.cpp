@@ -1,9 +1,40 @@
 #include <iostream>
 #include <string.h>
 #include <hotrod-c.h>
+#include "hotrod-codec.h"
+#include "murmurHash3.h"
+#include "hotrodTrace.h"
 
 /** @file */ 
 
+static int countAllocations = 0;
+static uint64_t allocations = 0;
+
+void enableAllocationCounting(int enabled) {
+    countAllocations = enabled;
+}
+
+uint64_t allocationCount() {
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+/**
+ * malloc for all the library allocations, counted when enabled
+ */
+void *hotrodMalloc(size_t size) {
+    if (countAllocations) {
+        __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    }
+    return malloc(size);
+}
+
+void *hotrodRealloc(void *ptr, size_t size) {
+    if (countAllocations) {
+        __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    }
+    return realloc(ptr, size);
+}
+
 /**
  * Read 1 byte from the stream
  */
@@ -44,6 +75,48 @@ void writeShort(uint8_t **buff, uint16_t val) {
     ++*buff;
 }
 
+/**
+ * Read an int, 4 bytes big endian as Java writes it
+ */
+uint32_t readInt(void* ctx, streamReader reader) {
+    uint8_t b[4];
+    reader(ctx, b, 4);
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+/**
+ * write an int to the buffer, 4 bytes big endian
+ */
+void writeInt(uint8_t **buff, uint32_t val) {
+    for (int i=24; i>=0; i-=8) {
+        **buff=(uint8_t)(val>>i);
+        ++*buff;
+    }
+}
+
+/**
+ * Read a long, 8 bytes big endian as Java writes it
+ */
+uint64_t readLong(void* ctx, streamReader reader) {
+    uint8_t b[8];
+    uint64_t val = 0;
+    reader(ctx, b, 8);
+    for (int i=0; i<8; i++) {
+        val = (val<<8) | b[i];
+    }
+    return val;
+}
+
+/**
+ * write a long to the buffer, 8 bytes big endian
+ */
+void writeLong(uint8_t **buff, uint64_t val) {
+    for (int i=56; i>=0; i-=8) {
+        **buff=(uint8_t)(val>>i);
+        ++*buff;
+    }
+}
+
 /** 
  * Read an unsigned int from the stream of bytes
  * 
@@ -124,6 +197,18 @@ void writeVLong(uint8_t **buff, uint64_t val) {
     writeByte(buff, val);
 }
 
+/**
+ * Read a signed int, zigzag encoded as vInt so that small negative values stay short
+ */
+int32_t readSignedVInt(void *ctx, streamReader reader) {
+    uint32_t val = readVInt(ctx, reader);
+    return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+void writeSignedVInt(uint8_t **buff, int32_t val) {
+    writeVInt(buff, ((uint32_t)val << 1) ^ (uint32_t)(val >> 31));
+}
+
 /**
  * Read an bytes array of variable length from the stream
  * 
@@ -133,11 +218,48 @@ void writeVLong(uint8_t **buff, uint64_t val) {
  */
 uint32_t readBytes(void *ctx, streamReader reader, uint8_t **str) {
   uint32_t size = readVInt(ctx, reader);
-  *str=(uint8_t*)malloc(sizeof(uint8_t)*size);
+  *str=(uint8_t*)hotrodMalloc(sizeof(uint8_t)*size);
   reader(ctx, *str, size);
   return size;
 }
 
+/**
+ * Discard size bytes from the stream
+ */
+void skipBytes(void *ctx, streamReader reader, uint32_t size) {
+    uint8_t scratch[256];
+    while (size > 0) {
+        uint32_t chunk = size < sizeof(scratch) ? size : sizeof(scratch);
+        reader(ctx, scratch, chunk);
+        size -= chunk;
+    }
+}
+
+/**
+ * Read a bytes array of variable length from the stream into a caller buffer
+ *
+ * Same format as readBytes(), but no allocation happens if the array fits in buf.
+ * A growable buffer is reallocated when too small, a fixed one is left untouched
+ * and the array is discarded from the stream.
+ *
+ * @return the array size, if greater than buf->capacity the array has been discarded
+ */
+uint32_t readBytesInto(void *ctx, streamReader reader, valueBuffer *buf) {
+    uint32_t size = readVInt(ctx, reader);
+    if (size > (uint32_t)buf->capacity) {
+        if (!buf->growable) {
+            buf->len = 0;
+            skipBytes(ctx, reader, size);
+            return size;
+        }
+        buf->buff = (uint8_t*)hotrodRealloc(buf->buff, size);
+        buf->capacity = size;
+    }
+    reader(ctx, buf->buff, size);
+    buf->len = size;
+    return size;
+}
+
 /**
  * Write an byte array from the stream
  * 
@@ -153,130 +275,6 @@ void writeBytes(uint8_t **buff, uint8_t *str, uint32_t len) {
   }
 }
 
-/**
- * \defgroup ResponseOpcode Response opcode
- * @{
- */
-
-/**@}*/
-
-/**
- * \defgroup ErrorResponseCode Error response code
- * @{
- */
-const uint8_t OK_STATUS                          = 0x00; ///< No error
-const uint8_t INVALID_MAGIC_OR_MESSAGE_ID_STATUS = 0x81; ///< Invalid magic or message id
-const uint8_t UNKNOWN_COMMAND_STATUS             = 0x82; ///< Unknown command
-const uint8_t UNKNOWN_VERSION_STATUS             = 0x83; ///< Unknown version
-const uint8_t REQUEST_PARSING_ERROR_STATUS       = 0x84; ///< Request parsing error
-const uint8_t SERVER_ERROR_STATUS                = 0x85; ///< Server Error
-const uint8_t COMMAND_TIMEOUT_STATUS             = 0x86; ///< Command timed out
-/**@}*/
-
-/**
- * \defgroup RequestOpCode Operation code for request
- * @{
- */
-const uint8_t PUT_REQUEST                         = 0x01;
-const uint8_t GET_REQUEST                         = 0x03;
-const uint8_t PUT_IF_ABSENT_REQUEST               = 0x05;
-const uint8_t REPLACE_REQUEST                     = 0x07;
-const uint8_t REPLACE_IF_UNMODIFIED_REQUEST       = 0x09;
-const uint8_t REMOVE_REQUEST                      = 0x0B;
-const uint8_t REMOVE_IF_UNMODIFIED_REQUEST        = 0x0D;
-const uint8_t CONTAINS_KEY_REQUEST                = 0x0F;
-const uint8_t GET_WITH_VERSION_REQUEST            = 0x11;
-const uint8_t CLEAR_REQUEST                       = 0x13;
-const uint8_t STATS_REQUEST                       = 0x15;
-const uint8_t PING_REQUEST                        = 0x17;
-const uint8_t BULK_GET_REQUEST                    = 0x19;
-const uint8_t GET_WITH_METADATA_REQUEST           = 0x1B;
-const uint8_t BULK_GET_KEYS_REQUEST               = 0x1D;
-const uint8_t QUERY_REQUEST                       = 0x1F;
-const uint8_t AUTH_MECH_LIST_REQUEST              = 0x21;
-const uint8_t AUTH_REQUEST                        = 0x23;
-const uint8_t ADD_CLIENT_LISTENER_REQUEST         = 0x25;
-const uint8_t REMOVE_CLIENT_LISTENER_REQUEST      = 0x27;
-const uint8_t SIZE_REQUEST                        = 0x29;
-const uint8_t EXEC_REQUEST                        = 0x2B;
-const uint8_t PUT_ALL_REQUEST                     = 0x2D;
-const uint8_t GET_ALL_REQUEST                     = 0x2F;
-const uint8_t ITERATION_START_REQUEST             = 0x31;
-const uint8_t ITERATION_NEXT_REQUEST              = 0x33;
-const uint8_t ITERATION_END_REQUEST               = 0x35;
-const uint8_t GET_STREAM_REQUEST                  = 0x37;
-const uint8_t PUT_STREAM_REQUEST                  = 0x39;
-const uint8_t PREPARE_REQUEST                     = 0x3B;
-const uint8_t COMMIT_REQUEST                      = 0x3D;
-const uint8_t ROLLBACK_REQUEST                    = 0x3F;
-const uint8_t COUNTER_CREATE_REQUEST              = 0x4B;
-const uint8_t COUNTER_GET_CONFIGURATION_REQUEST   = 0x4D;
-const uint8_t COUNTER_IS_DEFINED_REQUEST          = 0x4F;
-const uint8_t COUNTER_ADD_AND_GET_REQUEST         = 0x52;
-const uint8_t COUNTER_RESET_REQUEST               = 0x54;
-const uint8_t COUNTER_GET_REQUEST                 = 0x56;
-const uint8_t COUNTER_CAS_REQUEST                 = 0x58;
-const uint8_t COUNTER_ADD_LISTENER_REQUEST        = 0x5A;
-const uint8_t COUNTER_REMOVE_LISTENER_REQUEST     = 0x5C;
-const uint8_t COUNTER_REMOVE_REQUEST              = 0x5E;
-const uint8_t COUNTER_GET_NAMES_REQUEST           = 0x64;
-/**@}*/
-
-/**
- * \defgroup ResponseOpCode Operation code for response
- * @{
- */
-const uint8_t PUT_RESPONSE                        = 0x02;
-const uint8_t GET_RESPONSE                        = 0x04;
-const uint8_t PUT_IF_ABSENT_RESPONSE              = 0x06;
-const uint8_t REPLACE_RESPONSE                    = 0x08;
-const uint8_t REPLACE_IF_UNMODIFIED_RESPONSE      = 0x0A;
-const uint8_t REMOVE_RESPONSE                     = 0x0C;
-const uint8_t REMOVE_IF_UNMODIFIED_RESPONSE       = 0x0E;
-const uint8_t CONTAINS_KEY_RESPONSE               = 0x10;
-const uint8_t GET_WITH_VERSION_RESPONSE           = 0x12;
-const uint8_t CLEAR_RESPONSE                      = 0x14;
-const uint8_t STATS_RESPONSE                      = 0x16;
-const uint8_t PING_RESPONSE                       = 0x18;
-const uint8_t BULK_GET_RESPONSE                   = 0x1A;
-const uint8_t GET_WITH_METADATA_RESPONSE          = 0x1C;
-const uint8_t BULK_GET_KEYS_RESPONSE              = 0x1E;
-const uint8_t QUERY_RESPONSE                      = 0x20;
-const uint8_t AUTH_MECH_LIST_RESPONSE             = 0x22;
-const uint8_t AUTH_RESPONSE                       = 0x24;
-const uint8_t ADD_CLIENT_LISTENER_RESPONSE        = 0x26;
-const uint8_t REMOVE_CLIENT_LISTENER_RESPONSE     = 0x28;
-const uint8_t SIZE_RESPONSE                       = 0x2A;
-const uint8_t EXEC_RESPONSE                       = 0x2C;
-const uint8_t PUT_ALL_RESPONSE                    = 0x2E;
-const uint8_t GET_ALL_RESPONSE                    = 0x30;
-const uint8_t ITERATION_NEXT_RESPONSE             = 0x34;
-const uint8_t ITERATION_END_RESPONSE              = 0x36;
-const uint8_t ITERATION_START_RESPONSE            = 0x32;
-const uint8_t GET_STREAM_RESPONSE                 = 0x38;
-const uint8_t PUT_STREAM_RESPONSE                 = 0x3A;
-const uint8_t PREPARE_RESPONSE                    = 0x3C;
-const uint8_t COMMIT_RESPONSE                     = 0x3E;
-const uint8_t ROLLBACK_RESPONSE                   = 0x40;
-const uint8_t ERROR_RESPONSE                      = 0x50;
-const uint8_t CACHE_ENTRY_CREATED_EVENT_RESPONSE  = 0x60;
-const uint8_t CACHE_ENTRY_MODIFIED_EVENT_RESPONSE = 0x61;
-const uint8_t CACHE_ENTRY_REMOVED_EVENT_RESPONSE  = 0x62;
-const uint8_t CACHE_ENTRY_EXPIRED_EVENT_RESPONSE  = 0x63;
-const uint8_t COUNTER_CREATE_RESPONSE             = 0x4C;
-const uint8_t COUNTER_GET_CONFIGURATION_RESPONSE  = 0x4E;
-const uint8_t COUNTER_IS_DEFINED_RESPONSE         = 0x51;
-const uint8_t COUNTER_ADD_AND_GET_RESPONSE        = 0x53;
-const uint8_t COUNTER_RESET_RESPONSE              = 0x55;
-const uint8_t COUNTER_GET_RESPONSE                = 0x57;
-const uint8_t COUNTER_CAS_RESPONSE                = 0x59;
-const uint8_t COUNTER_ADD_LISTENER_RESPONSE       = 0x5B;
-const uint8_t COUNTER_REMOVE_LISTENER_RESPONSE    = 0x5D;
-const uint8_t COUNTER_REMOVE_RESPONSE             = 0x5F;
-const uint8_t COUNTER_GET_NAMES_RESPONSE          = 0x65;
-const uint8_t COUNTER_EVENT_RESPONSE              = 0x66;
-/**@}*/
-
 int readResponseError(void *ctx, streamReader reader, uint8_t status, uint8_t **errorMsg) {
     switch (status) {
         case INVALID_MAGIC_OR_MESSAGE_ID_STATUS:
@@ -315,26 +313,28 @@ int readResponseError(void *ctx, streamReader reader, uint8_t status, uint8_t **
  * end loop 3| | | |
  * end loop 2| | | |
  */
-void readNewTopology(void *ctx, streamReader reader, responseHeader *hdr, const requestHeader* const reqHdr, topologyInfo *tInfo) {
+void readNewTopology(void *ctx, streamReader reader, responseHeader * /*hdr*/, const requestHeader* const reqHdr, topologyInfo *tInfo) {
     tInfo->topologyId = readVInt(ctx, reader);
     tInfo->serversNum = readVInt(ctx, reader); // Number of servers
-    tInfo->servers = (byteArray*)malloc(sizeof(byteArray)*tInfo->serversNum);
-    tInfo->ports = (uint16_t*)malloc(sizeof(uint16_t)*tInfo->serversNum);
+    tInfo->servers = (byteArray*)hotrodMalloc(sizeof(byteArray)*tInfo->serversNum);
+    tInfo->ports = (uint16_t*)hotrodMalloc(sizeof(uint16_t)*tInfo->serversNum);
     for (int i=0; i< tInfo->serversNum; i++) { // Loop reading servers
         tInfo->servers[i].len=readBytes(ctx, reader, &tInfo->servers[i].buff);
         tInfo->ports[i]=readShort(ctx, reader);
     }
+    tInfo->hashFuncNum = 0;
+    tInfo->segmentsNum = 0;
     if (reqHdr->clientIntelligence==CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE) {
         tInfo->hashFuncNum = readByte(ctx, reader); // This should always read 0x03
         if (tInfo->hashFuncNum>0) {
             tInfo->segmentsNum = readVInt(ctx, reader); // Number of segments
             // Allocate and array of int8 for the number of owners for each segment
-            tInfo->ownersNumPerSegment = (uint8_t*)malloc(sizeof(uint8_t)*tInfo->segmentsNum);
+            tInfo->ownersNumPerSegment = (uint8_t*)hotrodMalloc(sizeof(uint8_t)*tInfo->segmentsNum);
             // Allocate and array of struct for owners, one struct for each segment
-            tInfo->ownersPerSegment = (uint32_t**)malloc(sizeof(uint32_t*)*tInfo->segmentsNum);
+            tInfo->ownersPerSegment = (uint32_t**)hotrodMalloc(sizeof(uint32_t*)*tInfo->segmentsNum);
             for (int i=0; i<tInfo->segmentsNum; i++) { // for each segment
                 tInfo->ownersNumPerSegment[i] = readByte(ctx, reader); // read the # of owners
-                tInfo->ownersPerSegment[i] = (uint32_t*)malloc(sizeof(uint32_t)*tInfo->ownersNumPerSegment[i]);
+                tInfo->ownersPerSegment[i] = (uint32_t*)hotrodMalloc(sizeof(uint32_t)*tInfo->ownersNumPerSegment[i]);
                 for (int j=0; j<tInfo->ownersNumPerSegment[i]; j++) { // read all the owner for this segment
                     tInfo->ownersPerSegment[i][j] = readVInt(ctx, reader); 
                 }
@@ -343,6 +343,72 @@ void readNewTopology(void *ctx, streamReader reader, responseHeader *hdr, const
     }
 }
 
+/**
+ * freeTopology releases the memory allocated by readNewTopology()
+ */
+void freeTopology(topologyInfo *tInfo) {
+    for (int i=0; i<tInfo->serversNum; i++) {
+        free(tInfo->servers[i].buff);
+    }
+    free(tInfo->servers);
+    free(tInfo->ports);
+    if (tInfo->hashFuncNum>0) {
+        for (int i=0; i<tInfo->segmentsNum; i++) {
+            free(tInfo->ownersPerSegment[i]);
+        }
+        free(tInfo->ownersPerSegment);
+        free(tInfo->ownersNumPerSegment);
+    }
+}
+
+/**
+ * \defgroup Routing Key routing
+ *
+ * The key hash selects one of the segmentsNum segments of the topology, each segment
+ * is owned by the servers listed in ownersPerSegment. The first owner is the primary.
+ * @{
+ */
+uint32_t getNormalizedHash32(uint32_t objectId) {
+    return hash32(objectId) & 0x7fffffff;
+}
+
+uint32_t getNormalizedHashVoidPtr(const void *key, int size) {
+     return hashVoidPtr(key,size) & 0x7fffffff;
+}
+
+uint32_t getSegment32(uint32_t objectId, unsigned int numSegments) {
+    uint32_t segmentSize = (uint32_t)(0x7FFFFFFFUL/numSegments)+1;
+    uint32_t hash = getNormalizedHash32(objectId);
+    return hash/segmentSize;
+}
+
+uint32_t getSegmentVoidPtr(const void *key, int size, unsigned int numSegments) {
+    uint32_t segmentSize = (uint32_t)(0x7FFFFFFFUL/numSegments)+1;
+    uint32_t hash = getNormalizedHashVoidPtr(key, size);
+    return hash/segmentSize;
+}
+
+uint32_t* getServerListVoidPtr(const topologyInfo *t, const void *key, int size) {
+    uint32_t seg = getSegmentVoidPtr(key, size, t->segmentsNum);
+    return t->ownersPerSegment[seg];
+}
+
+uint8_t getServerListSizeVoidPtr(const topologyInfo *t, const void *key, int size) {
+    uint32_t seg = getSegmentVoidPtr(key, size, t->segmentsNum);
+    return t->ownersNumPerSegment[seg];
+}
+
+uint32_t* getServerList32(const topologyInfo *t, uint32_t objectId) {
+    uint32_t seg = getSegment32(objectId, t->segmentsNum);
+    return t->ownersPerSegment[seg];
+}
+
+uint8_t getServerListSize32(const topologyInfo *t, uint32_t objectId) {
+    uint32_t seg = getSegment32(objectId, t->segmentsNum);
+    return t->ownersNumPerSegment[seg];
+}
+/**@}*/
+
 /**
  *  readResponseHeader read a response header from the bytes stream
  *  
@@ -358,6 +424,7 @@ void readNewTopology(void *ctx, streamReader reader, responseHeader *hdr, const
  */
 void readResponseHeader(void *ctx, streamReader reader, responseHeader *hdr, const requestHeader* const reqHdr, topologyInfo *tInfo) {
     hdr->magic = readByte(ctx, reader);
+    HOTROD_TRACE1(response__first__byte, reqHdr->messageId);
     hdr->messageId = readVLong(ctx, reader);
     hdr->opCode = readByte(ctx, reader);
     hdr->status = readByte(ctx, reader);
@@ -369,6 +436,7 @@ void readResponseHeader(void *ctx, streamReader reader, responseHeader *hdr, con
     hdr->error.len= readResponseError(ctx, reader, hdr->status, &errMsg);
     // Following cast is true when sizeof(char)==8
     hdr->error.buff= errMsg;
+    HOTROD_TRACE4(response__header, hdr->messageId, hdr->opCode, hdr->status, hdr->topologyChanged);
     // TODO implement here topology changes
 }
 
@@ -401,8 +469,8 @@ void readMediaType(void *ctx, streamReader reader, mediaType *mt) {
         case 2:
             mt->customMediaType.len = readBytes(ctx, reader, &mt->customMediaType.buff);
             mt->paramsNum = readVInt(ctx,reader);
-            mt->keys = (byteArray*)(sizeof(byteArray)*mt->paramsNum);
-            mt->values = (byteArray*)(sizeof(byteArray)*mt->paramsNum);
+            mt->keys = (byteArray*)hotrodMalloc(sizeof(byteArray)*mt->paramsNum);
+            mt->values = (byteArray*)hotrodMalloc(sizeof(byteArray)*mt->paramsNum);
             for (int i=0; i<mt->paramsNum; i++) {
                 mt->keys[i].len = readBytes(ctx, reader, &mt->keys[i].buff);
                 mt->values[i].len = readBytes(ctx, reader, &mt->values[i].buff);
@@ -417,9 +485,11 @@ void writeMediaType(uint8_t **buff, const mediaType *const mt) {
             writeByte(buff, 0x00);
         break;
         case 1:
+            writeByte(buff, 0x01);
             writeVInt(buff, mt->predefinedMediaType);
         break;
         case 2:
+            writeByte(buff, 0x02);
             writeBytes(buff, mt->customMediaType.buff, mt->customMediaType.len);
             writeVInt(buff, mt->paramsNum);
             for (int i=0; i<mt->paramsNum; i++) {
@@ -447,6 +517,7 @@ void writeMediaType(uint8_t **buff, const mediaType *const mt) {
  * Topology Id | vInt | id of the topology in use |
  */
 int writeRequestHeader(uint8_t *buff, requestHeader *hdr) {
+    HOTROD_TRACE2(request__encode, hdr->messageId, hdr->opCode);
     uint8_t *curs=buff;
     writeByte(&curs, hdr->magic);
     writeVLong(&curs, hdr->messageId);
@@ -461,6 +532,15 @@ int writeRequestHeader(uint8_t *buff, requestHeader *hdr) {
     return curs-buff;
 }
 
+/**
+ * Hand an encoded request to the writer and release it
+ */
+static void sendRequest(void *ctx, streamWriter writer, requestHeader *hdr, uint8_t *buff, int len) {
+    writer(ctx, buff, len);
+    HOTROD_TRACE3(request__write, hdr->messageId, hdr->opCode, len);
+    free(buff);
+}
+
 /**
  * writeRequestWithKey send a request for operations that has a key as parameter
  * 
@@ -468,13 +548,12 @@ int writeRequestHeader(uint8_t *buff, requestHeader *hdr) {
  * to request execution of operations with 1 key as parameter if the specific func is missing.
  */
 void writeRequestWithKey(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName) {
-    uint8_t *buff=(uint8_t *)malloc(hdr->cacheName.len+29+5+keyName->len);
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+5+keyName->len);
     int len=writeRequestHeader(buff, hdr);
     uint8_t *buff1=buff+len;
     writeBytes(&buff1,keyName->buff,keyName->len);
     len=buff1-buff;
-    writer(ctx, buff, len);
-    free(buff);
+    sendRequest(ctx, writer, hdr, buff, len);
 }
 
 void writeGet(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName) {
@@ -486,50 +565,209 @@ void readGet(void *ctx, streamReader reader, responseHeader *hdr, requestHeader
     readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
     if (hdr->status == OK_STATUS) {
        arr->len= readBytes(ctx, reader, &arr->buff);
+       HOTROD_TRACE2(value__decoded, hdr->messageId, arr->len);
+    }
+}
+
+int readGetInto(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, valueBuffer *buf) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    if (hdr->status == OK_STATUS) {
+        uint32_t len = readBytesInto(ctx, reader, buf);
+        HOTROD_TRACE2(value__decoded, hdr->messageId, len);
+        return len;
+    }
+    buf->len = 0;
+    return 0;
+}
+
+int readGetValueLength(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    if (hdr->status == OK_STATUS) {
+        return readVInt(ctx, reader);
+    }
+    return -1;
+}
+
+/**
+ * Max size of an encoded expiration: units byte and two vlongs
+ */
+static const int EXPIRATION_MAX_SIZE = 21;
+
+/**
+ * Encode lifespan and maxIdle of a write request, nullptr means the entry never expires
+ */
+static void writeExpiration(uint8_t **buff, const entryExpiration *exp) {
+    if (exp == nullptr) {
+        writeByte(buff, INFINITUM << 4 | INFINITUM);
+        return;
+    }
+    writeByte(buff, exp->lifespanUnit << 4 | exp->maxIdleUnit);
+    if (exp->lifespanUnit != DEFAULT && exp->lifespanUnit != INFINITUM) {
+        writeVLong(buff, exp->lifespan);
+    }
+    if (exp->maxIdleUnit != DEFAULT && exp->maxIdleUnit != INFINITUM) {
+        writeVLong(buff, exp->maxIdle);
     }
 }
 
-    enum  TimeUnit {
-        SECONDS = 0x00,
-        MILLISECONDS = 0x01,
-        NANOSECONDS = 0x02,
-        MICROSECONDS = 0x03,
-        MINUTES = 0x04,
-        DAYS = 0x06,
-        HOURS = 0x05,
-        DEFAULT = 0x07,
-        INFINITUM = 0x08
-        };
+/**
+ * Send a request made of key, expiration and value, as PUT, PUT_IF_ABSENT and REPLACE
+ */
+static void writeKeyValueRequest(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+5+keyName->len+EXPIRATION_MAX_SIZE+5+keyValue->len);
+    int len=writeRequestHeader(buff, hdr);
+    uint8_t *buff1=buff+len;
+    writeBytes(&buff1,keyName->buff,keyName->len);
+    writeExpiration(&buff1,exp);
+    writeBytes(&buff1,keyValue->buff,keyValue->len);
+    len=buff1-buff;
+    sendRequest(ctx, writer, hdr, buff, len);
+}
 
 /**
  * writePut send a request for a put operation
  */
 void writePut(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue) {
-    uint8_t *buff=(uint8_t *)malloc(hdr->cacheName.len+29+5+keyName->len+5+keyValue->len);
+    writePutWithExpiration(ctx, writer, hdr, keyName, keyValue, nullptr);
+}
+
+void writePutWithExpiration(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp) {
+    hdr->opCode=PUT_REQUEST;
+    writeKeyValueRequest(ctx, writer, hdr, keyName, keyValue, exp);
+}
+
+void writePutHeader(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, uint32_t valueLen, const entryExpiration *exp) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+5+keyName->len+EXPIRATION_MAX_SIZE+5);
     hdr->opCode=PUT_REQUEST;
     int len=writeRequestHeader(buff, hdr);
     uint8_t *buff1=buff+len;
     writeBytes(&buff1,keyName->buff,keyName->len);
-    writeByte(&buff1,0x88);
-    writeBytes(&buff1,keyValue->buff,keyValue->len);
+    writeExpiration(&buff1,exp);
+    writeVInt(&buff1,valueLen);
     len=buff1-buff;
-    writer(ctx, buff, len);
-    free(buff);
+    sendRequest(ctx, writer, hdr, buff, len);
+}
+
+static int hasPreviousValue(uint8_t status) {
+    return status == SUCCESS_WITH_PREVIOUS_STATUS || status == NOT_EXECUTED_WITH_PREVIOUS_STATUS;
 }
 
 void readPut(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, byteArray *arr) {
     readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    if (arr != nullptr) {
+        arr->len = 0;
+        arr->buff = nullptr;
+    }
+    if (hasPreviousValue(hdr->status)) {
+        if (arr != nullptr) {
+            arr->len = readBytes(ctx, reader, &arr->buff);
+        } else {
+            skipBytes(ctx, reader, readVInt(ctx, reader));
+        }
+    }
+}
+
+void writePutIfAbsent(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp) {
+    hdr->opCode=PUT_IF_ABSENT_REQUEST;
+    writeKeyValueRequest(ctx, writer, hdr, keyName, keyValue, exp);
+}
+
+void writeReplace(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, const entryExpiration *exp) {
+    hdr->opCode=REPLACE_REQUEST;
+    writeKeyValueRequest(ctx, writer, hdr, keyName, keyValue, exp);
+}
+
+void writeRemove(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName) {
+    hdr->opCode=REMOVE_REQUEST;
+    writeRequestWithKey(ctx, writer, hdr, keyName);
+}
+
+void writeGetWithVersion(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName) {
+    hdr->opCode=GET_WITH_VERSION_REQUEST;
+    writeRequestWithKey(ctx, writer, hdr, keyName);
+}
+
+int readGetWithVersion(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, uint64_t *version, valueBuffer *buf) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    buf->len = 0;
+    if (hdr->status != OK_STATUS) {
+        return 0;
+    }
+    *version = readLong(ctx, reader);
+    return readBytesInto(ctx, reader, buf);
+}
+
+void writeGetWithMetadata(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName) {
+    hdr->opCode=GET_WITH_METADATA_REQUEST;
+    writeRequestWithKey(ctx, writer, hdr, keyName);
+}
+
+int readGetWithMetadata(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, entryMetadata *metadata, valueBuffer *buf) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    buf->len = 0;
+    if (hdr->status != OK_STATUS) {
+        return 0;
+    }
+    memset(metadata, 0, sizeof(*metadata));
+    metadata->flags = readByte(ctx, reader);
+    if (!(metadata->flags & INFINITE_LIFESPAN)) {
+        metadata->created = readLong(ctx, reader);
+        metadata->lifespan = readVInt(ctx, reader);
+    }
+    if (!(metadata->flags & INFINITE_MAXIDLE)) {
+        metadata->lastUsed = readLong(ctx, reader);
+        metadata->maxIdle = readVInt(ctx, reader);
+    }
+    metadata->version = readLong(ctx, reader);
+    return readBytesInto(ctx, reader, buf);
+}
+
+void writeReplaceIfUnmodified(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, byteArray *keyValue, uint64_t version, const entryExpiration *exp) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+5+keyName->len+EXPIRATION_MAX_SIZE+8+5+keyValue->len);
+    hdr->opCode=REPLACE_IF_UNMODIFIED_REQUEST;
+    int len=writeRequestHeader(buff, hdr);
+    uint8_t *buff1=buff+len;
+    writeBytes(&buff1,keyName->buff,keyName->len);
+    writeExpiration(&buff1,exp);
+    writeLong(&buff1,version);
+    writeBytes(&buff1,keyValue->buff,keyValue->len);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+void writeRemoveIfUnmodified(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName, uint64_t version) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+5+keyName->len+8);
+    hdr->opCode=REMOVE_IF_UNMODIFIED_REQUEST;
+    int len=writeRequestHeader(buff, hdr);
+    uint8_t *buff1=buff+len;
+    writeBytes(&buff1,keyName->buff,keyName->len);
+    writeLong(&buff1,version);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+int readConditional(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, valueBuffer *previous) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    if (previous != nullptr) {
+        previous->len = 0;
+    }
+    if (!hasPreviousValue(hdr->status)) {
+        return 0;
+    }
+    if (previous != nullptr) {
+        return readBytesInto(ctx, reader, previous);
+    }
+    uint32_t len = readVInt(ctx, reader);
+    skipBytes(ctx, reader, len);
+    return len;
 }
 
 /**
  * writePing send a request for a ping operation
  */
 void writePing(void *ctx, streamWriter writer, requestHeader *hdr) {
-    uint8_t *buff=(uint8_t *)malloc(hdr->cacheName.len+29);
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29);
     hdr->opCode=PING_REQUEST;
     int len=writeRequestHeader(buff, hdr);
-    writer(ctx, buff, len);
-    free(buff);
+    sendRequest(ctx, writer, hdr, buff, len);
 }
 
 /**
@@ -544,9 +782,355 @@ void readPing(void *ctx, streamReader reader, responseHeader *hdr, requestHeader
     readMediaType(ctx, reader, valueMt);
     version = readByte(ctx, reader);
     operationsNum = readVInt(ctx, reader);
-    operations = (uint16_t*)malloc(sizeof(uint16_t)*operationsNum);
+    operations = (uint16_t*)hotrodMalloc(sizeof(uint16_t)*operationsNum);
     for (int i=0; i<operationsNum; i++) {
         operations[i]= readShort(ctx, reader);
     }
 }
 
+void writeAddClientListener(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *listenerId, uint8_t includeState, uint32_t interests) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+5+listenerId->len+1+1+1+1+5);
+    hdr->opCode=ADD_CLIENT_LISTENER_REQUEST;
+    int len=writeRequestHeader(buff, hdr);
+    uint8_t *buff1=buff+len;
+    writeBytes(&buff1,listenerId->buff,listenerId->len);
+    writeByte(&buff1,includeState);
+    writeVInt(&buff1,0);    // no filter factory
+    writeVInt(&buff1,0);    // no converter factory
+    writeByte(&buff1,0);    // events are not raw data
+    writeVInt(&buff1,interests);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+void writeRemoveClientListener(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *listenerId) {
+    hdr->opCode=REMOVE_CLIENT_LISTENER_REQUEST;
+    writeRequestWithKey(ctx, writer, hdr, (byteArray*)listenerId);
+}
+
+int isCacheEvent(const responseHeader *hdr) {
+    return hdr->opCode >= CACHE_ENTRY_CREATED_EVENT_RESPONSE && hdr->opCode <= CACHE_ENTRY_EXPIRED_EVENT_RESPONSE;
+}
+
+void readCacheEvent(void *ctx, streamReader reader, const responseHeader *hdr, cacheEvent *event) {
+    event->opCode = hdr->opCode;
+    readBytesInto(ctx, reader, &event->listenerId);
+    event->custom = readByte(ctx, reader);
+    event->retried = readByte(ctx, reader);
+    event->version = 0;
+    readBytesInto(ctx, reader, &event->key);
+    if (!event->custom && (hdr->opCode == CACHE_ENTRY_CREATED_EVENT_RESPONSE || hdr->opCode == CACHE_ENTRY_MODIFIED_EVENT_RESPONSE)) {
+        event->version = readLong(ctx, reader);
+    }
+}
+
+/**
+ * Encode the header and the name of a counter request, the counters have no cache
+ */
+static uint8_t *writeCounterRequest(uint8_t *buff, requestHeader *hdr, const byteArray *counterName) {
+    requestHeader counterHdr = *hdr;
+    counterHdr.cacheName.len = 0;
+    uint8_t *buff1 = buff+writeRequestHeader(buff, &counterHdr);
+    writeBytes(&buff1, counterName->buff, counterName->len);
+    return buff1;
+}
+
+void writeCounterCreate(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *counterName, const counterConfiguration *conf) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(29+5+counterName->len+1+5+3*8);
+    hdr->opCode=COUNTER_CREATE_REQUEST;
+    uint8_t *buff1=writeCounterRequest(buff, hdr, counterName);
+    writeByte(&buff1, conf->flags);
+    if (conf->flags & COUNTER_WEAK) {
+        writeVInt(&buff1, conf->concurrencyLevel);
+    }
+    if (conf->flags & COUNTER_BOUNDED) {
+        writeLong(&buff1, conf->lowerBound);
+        writeLong(&buff1, conf->upperBound);
+    }
+    writeLong(&buff1, conf->initialValue);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+void readCounterCreate(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+}
+
+void writeCounterAddAndGet(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *counterName, int64_t delta) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(29+5+counterName->len+8);
+    hdr->opCode=COUNTER_ADD_AND_GET_REQUEST;
+    uint8_t *buff1=writeCounterRequest(buff, hdr, counterName);
+    writeLong(&buff1, delta);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+void writeCounterGet(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *counterName) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(29+5+counterName->len);
+    hdr->opCode=COUNTER_GET_REQUEST;
+    uint8_t *buff1=writeCounterRequest(buff, hdr, counterName);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+void readCounterValue(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, int64_t *value) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    if (hdr->status == OK_STATUS) {
+        *value = readLong(ctx, reader);
+    }
+}
+
+static int xidSize(const transactionXid *xid) {
+    return 5+5+xid->globalId.len+5+xid->branchId.len;
+}
+
+static void writeXid(uint8_t **buff, const transactionXid *xid) {
+    writeSignedVInt(buff, xid->formatId);
+    writeBytes(buff, xid->globalId.buff, xid->globalId.len);
+    writeBytes(buff, xid->branchId.buff, xid->branchId.len);
+}
+
+void writePrepare(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid, uint8_t onePhaseCommit, uint64_t timeoutMs, const txModification *mods, int modsNum) {
+    int size = hdr->cacheName.len+29+xidSize(xid)+1+1+8+5;
+    for (int i=0; i<modsNum; i++) {
+        size += 5+mods[i].key.len+1+8+EXPIRATION_MAX_SIZE+5+mods[i].value.len;
+    }
+    uint8_t *buff=(uint8_t *)hotrodMalloc(size);
+    hdr->opCode=PREPARE_REQUEST;
+    uint8_t *buff1=buff+writeRequestHeader(buff, hdr);
+    writeXid(&buff1, xid);
+    writeByte(&buff1, onePhaseCommit);
+    writeByte(&buff1, 0);   // not recoverable
+    writeLong(&buff1, timeoutMs);
+    writeVInt(&buff1, modsNum);
+    for (int i=0; i<modsNum; i++) {
+        const txModification *mod = &mods[i];
+        writeBytes(&buff1, mod->key.buff, mod->key.len);
+        writeByte(&buff1, mod->control);
+        if (!(mod->control & (TX_NOT_READ | TX_NON_EXISTING))) {
+            writeLong(&buff1, mod->versionRead);
+        }
+        if (!(mod->control & TX_REMOVE_OP)) {
+            writeExpiration(&buff1, mod->expiration);
+            writeBytes(&buff1, mod->value.buff, mod->value.len);
+        }
+    }
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+/**
+ * Send a COMMIT or ROLLBACK, both carry only the xid
+ */
+static void writeTransactionEnd(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid, uint8_t opCode) {
+    uint8_t *buff=(uint8_t *)hotrodMalloc(hdr->cacheName.len+29+xidSize(xid));
+    hdr->opCode=opCode;
+    uint8_t *buff1=buff+writeRequestHeader(buff, hdr);
+    writeXid(&buff1, xid);
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+void writeCommit(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid) {
+    writeTransactionEnd(ctx, writer, hdr, xid, COMMIT_REQUEST);
+}
+
+void writeRollback(void *ctx, streamWriter writer, requestHeader *hdr, const transactionXid *xid) {
+    writeTransactionEnd(ctx, writer, hdr, xid, ROLLBACK_REQUEST);
+}
+
+void readTransactionResult(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, int32_t *xaCode) {
+    readResponseHeader(ctx, reader, hdr, reqHdr, tInfo);
+    if (hdr->status == OK_STATUS) {
+        *xaCode = readInt(ctx, reader);
+    }
+}
+
+void writeExec(void *ctx, streamWriter writer, requestHeader *hdr, const byteArray *scriptName, const execParam *params, int paramsNum) {
+    int size = hdr->cacheName.len+29+5+scriptName->len+5;
+    for (int i=0; i<paramsNum; i++) {
+        size += 5+params[i].name.len+5+params[i].value.len;
+    }
+    uint8_t *buff=(uint8_t *)hotrodMalloc(size);
+    hdr->opCode=EXEC_REQUEST;
+    uint8_t *buff1=buff+writeRequestHeader(buff, hdr);
+    writeBytes(&buff1, scriptName->buff, scriptName->len);
+    writeVInt(&buff1, paramsNum);
+    for (int i=0; i<paramsNum; i++) {
+        writeBytes(&buff1, params[i].name.buff, params[i].name.len);
+        writeBytes(&buff1, params[i].value.buff, params[i].value.len);
+    }
+    sendRequest(ctx, writer, hdr, buff, buff1-buff);
+}
+
+int readExecInto(void *ctx, streamReader reader, responseHeader *hdr, requestHeader *reqHdr, topologyInfo *tInfo, valueBuffer *result) {
+    // The result is a byte array, as the value of a GET
+    return readGetInto(ctx, reader, hdr, reqHdr, tInfo, result);
+}
+
+/**
+ * \defgroup TopologySnapshot Topology snapshot
+ * @{
+ */
+const uint32_t TOPOLOGY_SNAPSHOT_MAGIC   = 0x53545248; ///< "HRTS" in a little endian file
+const uint32_t TOPOLOGY_SNAPSHOT_VERSION = 1;
+/**@}*/
+
+static int align4(int len) {
+    return (len+3) & ~3;
+}
+
+static uint8_t maxOwners(const topologyInfo *tInfo) {
+    uint8_t max=0;
+    for (int i=0; i<tInfo->segmentsNum; i++) {
+        if (tInfo->ownersNumPerSegment[i]>max) {
+            max=tInfo->ownersNumPerSegment[i];
+        }
+    }
+    return max;
+}
+
+/**
+ * topologySnapshotSize returns the size in bytes of the snapshot of tInfo
+ *
+ * Snapshot layout, all the fields are in native byte order and 4 bytes aligned:
+ *
+ * Field | Size (bytes) or type | Comment
+ * ------|----------------------|--------
+ * Magic | 4 | TOPOLOGY_SNAPSHOT_MAGIC
+ * Version | 4 | TOPOLOGY_SNAPSHOT_VERSION
+ * TopologyId | 4 | |
+ * Servers Num | 4 | |
+ * Hash Func Num | 4 | |
+ * Segments Num | 4 | |
+ * Owners Stride | 4 | max number of owners per segment
+ * Ports | 2 * Servers Num | padded to 4
+ * Servers | 8 * Servers Num | offset and length of the address in the strings area
+ * Owners Num | Segments Num | padded to 4
+ * Owners | 4 * Segments Num * Owners Stride | owners of segment i start at i * Owners Stride
+ * Strings | | server addresses
+ */
+int topologySnapshotSize(const topologyInfo *tInfo) {
+    int size = 7*4;
+    size += align4(2*tInfo->serversNum);
+    size += 8*tInfo->serversNum;
+    size += align4(tInfo->segmentsNum);
+    size += 4*tInfo->segmentsNum*maxOwners(tInfo);
+    for (int i=0; i<tInfo->serversNum; i++) {
+        size += tInfo->servers[i].len;
+    }
+    return align4(size);
+}
+
+/**
+ * writeTopologySnapshot writes the snapshot of tInfo in buff
+ *
+ * buff must be at least topologySnapshotSize() bytes long.
+ * The snapshot can be stored and later used by loadTopologySnapshot()
+ * without parsing.
+ *
+ * @return the number of bytes written
+ */
+int writeTopologySnapshot(uint8_t *buff, const topologyInfo *tInfo) {
+    int size = topologySnapshotSize(tInfo);
+    uint8_t stride = maxOwners(tInfo);
+    memset(buff, 0, size);
+    uint32_t *head = (uint32_t*)buff;
+    head[0] = TOPOLOGY_SNAPSHOT_MAGIC;
+    head[1] = TOPOLOGY_SNAPSHOT_VERSION;
+    head[2] = tInfo->topologyId;
+    head[3] = tInfo->serversNum;
+    head[4] = tInfo->hashFuncNum;
+    head[5] = tInfo->segmentsNum;
+    head[6] = stride;
+    uint8_t *curs = buff+7*4;
+    memcpy(curs, tInfo->ports, 2*tInfo->serversNum);
+    curs += align4(2*tInfo->serversNum);
+    uint32_t *serverTable = (uint32_t*)curs;
+    curs += 8*tInfo->serversNum;
+    memcpy(curs, tInfo->ownersNumPerSegment, tInfo->segmentsNum);
+    curs += align4(tInfo->segmentsNum);
+    uint32_t *owners = (uint32_t*)curs;
+    for (int i=0; i<tInfo->segmentsNum; i++) {
+        memcpy(owners+i*stride, tInfo->ownersPerSegment[i], 4*tInfo->ownersNumPerSegment[i]);
+    }
+    curs += 4*tInfo->segmentsNum*stride;
+    for (int i=0; i<tInfo->serversNum; i++) {
+        serverTable[2*i] = curs-buff;
+        serverTable[2*i+1] = tInfo->servers[i].len;
+        memcpy(curs, tInfo->servers[i].buff, tInfo->servers[i].len);
+        curs += tInfo->servers[i].len;
+    }
+    return size;
+}
+
+/**
+ * loadTopologySnapshot populates tInfo from a snapshot written by writeTopologySnapshot()
+ *
+ * Ports, owners and server addresses point into buff, that must stay valid (typically
+ * memory mapped) while tInfo is in use. Only the servers and the per segment
+ * pointers arrays are allocated, the release is up to the caller.
+ * The snapshot could be stale: send its topologyId in the requests, if the cluster has
+ * changed the server will reply with a new topology that replaces this one.
+ *
+ * @return 0 on success, -1 if buff doesn't contain a valid snapshot
+ */
+int loadTopologySnapshot(uint8_t *buff, int len, topologyInfo *tInfo) {
+    uint32_t *head = (uint32_t*)buff;
+    if (len < 7*4 || head[0] != TOPOLOGY_SNAPSHOT_MAGIC || head[1] != TOPOLOGY_SNAPSHOT_VERSION) {
+        return -1;
+    }
+    uint32_t serversNum = head[3];
+    uint32_t segmentsNum = head[5];
+    uint32_t stride = head[6];
+    uint64_t expected = 7*4 + align4(2*serversNum) + 8*(uint64_t)serversNum + align4(segmentsNum)
+                      + 4*(uint64_t)segmentsNum*stride;
+    if (expected > (uint64_t)len) {
+        return -1;
+    }
+    uint8_t *curs = buff+7*4;
+    uint16_t *ports = (uint16_t*)curs;
+    curs += align4(2*serversNum);
+    uint32_t *serverTable = (uint32_t*)curs;
+    curs += 8*serversNum;
+    uint8_t *ownersNum = curs;
+    curs += align4(segmentsNum);
+    uint32_t *owners = (uint32_t*)curs;
+    for (int i=0; i<serversNum; i++) {
+        if ((uint64_t)serverTable[2*i]+serverTable[2*i+1] > (uint64_t)len) {
+            return -1;
+        }
+    }
+    for (int i=0; i<segmentsNum; i++) {
+        if (ownersNum[i] > stride) {
+            return -1;
+        }
+        for (int j=0; j<ownersNum[i]; j++) {
+            if (owners[i*stride+j] >= serversNum) {
+                return -1;
+            }
+        }
+    }
+    tInfo->topologyId = head[2];
+    tInfo->serversNum = serversNum;
+    tInfo->hashFuncNum = head[4];
+    tInfo->segmentsNum = segmentsNum;
+    tInfo->ports = ports;
+    tInfo->servers = (byteArray*)hotrodMalloc(sizeof(byteArray)*serversNum);
+    for (int i=0; i<serversNum; i++) {
+        tInfo->servers[i].buff = buff+serverTable[2*i];
+        tInfo->servers[i].len = serverTable[2*i+1];
+    }
+    tInfo->ownersNumPerSegment = ownersNum;
+    tInfo->ownersPerSegment = (uint32_t**)hotrodMalloc(sizeof(uint32_t*)*segmentsNum);
+    for (int i=0; i<segmentsNum; i++) {
+        tInfo->ownersPerSegment[i] = owners+i*stride;
+    }
+    tInfo->status = OK_STATUS;
+    tInfo->error.len = 0;
+    tInfo->error.buff = nullptr;
+    tInfo->topologyChanged = 0;
+    return 0;
+}
+
+void releaseTopologySnapshot(topologyInfo *tInfo) {
+    // ports, ownersNumPerSegment and the owners point into the snapshot buffer
+    free(tInfo->servers);
+    free(tInfo->ownersPerSegment);
+    tInfo->servers = nullptr;
+    tInfo->ownersPerSegment = nullptr;
+}
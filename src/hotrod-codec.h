@@ -0,0 +1,44 @@
+#ifndef HOTROD_CODEC_H
+#define HOTROD_CODEC_H
+
+#include "hotrod-c.h"
+
+/**
+ * @file
+ * @brief Encoding primitives used by the operations in hotrod-c.cpp.
+ * They are not part of the public API, but tools and benchmarks that work on the wire
+ * format directly can use them.
+ */
+
+#include <stddef.h>
+
+void *hotrodMalloc(size_t size);
+void *hotrodRealloc(void *ptr, size_t size);
+
+uint8_t readByte(void* ctx, streamReader reader);
+uint16_t readShort(void* ctx, streamReader reader);
+void writeByte(uint8_t **buff, uint8_t val);
+void writeShort(uint8_t **buff, uint16_t val);
+uint32_t readInt(void* ctx, streamReader reader);
+void writeInt(uint8_t **buff, uint32_t val);
+uint64_t readLong(void* ctx, streamReader reader);
+void writeLong(uint8_t **buff, uint64_t val);
+uint32_t readVInt(void *ctx, streamReader reader);
+void writeVInt(uint8_t **buff, uint32_t val);
+uint64_t readVLong(void *ctx, streamReader reader);
+void writeVLong(uint8_t **buff, uint64_t val);
+int32_t readSignedVInt(void *ctx, streamReader reader);
+void writeSignedVInt(uint8_t **buff, int32_t val);
+uint32_t readBytes(void *ctx, streamReader reader, uint8_t **str);
+void skipBytes(void *ctx, streamReader reader, uint32_t size);
+uint32_t readBytesInto(void *ctx, streamReader reader, valueBuffer *buf);
+void writeBytes(uint8_t **buff, uint8_t *str, uint32_t len);
+
+void readNewTopology(void *ctx, streamReader reader, responseHeader *hdr, const requestHeader* const reqHdr, topologyInfo *tInfo);
+void readResponseHeader(void *ctx, streamReader reader, responseHeader *hdr, const requestHeader* const reqHdr, topologyInfo *tInfo);
+void readMediaType(void *ctx, streamReader reader, mediaType *mt);
+void writeMediaType(uint8_t **buff, const mediaType *const mt);
+int writeRequestHeader(uint8_t *buff, requestHeader *hdr);
+void writeRequestWithKey(void *ctx, streamWriter writer, requestHeader *hdr, byteArray *keyName);
+
+#endif // HOTROD_CODEC_H
@@ -0,0 +1,41 @@
+#ifndef HOTROD_TRACE_H
+#define HOTROD_TRACE_H
+
+/**
+ * @file
+ * @brief Static tracepoints on the request lifecycle.
+ *
+ * When built with HOTROD_USDT (sys/sdt.h found at configure time) every HOTROD_TRACE
+ * is a USDT probe of provider hotrod: a single nop in the code plus an ELF note, so a
+ * probe costs nothing until a tracer attaches to it, e.g.
+ *
+ *     bpftrace -e 'usdt:./hotrod-loadgen:hotrod:request__write { @[arg1] = count(); }'
+ *
+ * Without HOTROD_USDT the macros expand to nothing but an unevaluated sizeof of their
+ * arguments, so values computed only for a probe don't raise unused warnings.
+ *
+ * Probes and arguments:
+ * - request__encode (messageId, opCode): request encoding starts
+ * - request__write (messageId, opCode, len): request handed to the stream writer
+ * - response__first__byte (messageId): first byte of the response read
+ * - response__header (messageId, opCode, status, topologyChanged): header decoded
+ * - value__decoded (messageId, len): value of a get read
+ * - client__request (messageId, server): client routed the request to server index
+ * - client__response (messageId, opCode, server, result): client request completed
+ * - topology__applied (topologyId, serversNum, segmentsNum): client installed a new topology
+ */
+
+#ifdef HOTROD_USDT
+#include <sys/sdt.h>
+#define HOTROD_TRACE1(name, a1) DTRACE_PROBE1(hotrod, name, a1)
+#define HOTROD_TRACE2(name, a1, a2) DTRACE_PROBE2(hotrod, name, a1, a2)
+#define HOTROD_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(hotrod, name, a1, a2, a3)
+#define HOTROD_TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(hotrod, name, a1, a2, a3, a4)
+#else
+#define HOTROD_TRACE1(name, a1) ((void)sizeof(a1))
+#define HOTROD_TRACE2(name, a1, a2) ((void)sizeof(a1), (void)sizeof(a2))
+#define HOTROD_TRACE3(name, a1, a2, a3) ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3))
+#define HOTROD_TRACE4(name, a1, a2, a3, a4) ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3), (void)sizeof(a4))
+#endif
+
+#endif // HOTROD_TRACE_H
@@ -1,4 +1,5 @@
 #include <stdint.h>
 
+uint64_t MurmurHash3_x64_64(const void * key, const int32_t len, const int32_t seed);
 uint32_t hashVoidPtr(const void *key, int size);
 uint32_t hash32(uint32_t key);
@@ -1,8 +1,464 @@
+#include <errno.h>
 #include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
 #include "hotrod-c.h"
+#include "hotrod-codec.h"
+#include "faultTransport.h"
 #include "gtest/gtest.h"
 
-// Tests factorial of negative numbers.
-TEST(DemoTest, Connect) {
-ASSERT_EQ(1,1);
-}
\ No newline at end of file
+static void fillHeader(requestHeader *rqh) {
+    memset(rqh, 0, sizeof(*rqh));
+    rqh->magic = 0xA0;
+    rqh->version = 30;
+}
+
+static void fillTopology(topologyInfo *t, byteArray *servers, uint16_t *ports, uint8_t *ownersNum, uint32_t **owners, uint32_t *ownersData) {
+    static const char *addrs[] = {"10.0.0.1", "10.0.0.22", "10.0.0.333"};
+    t->topologyId = 7;
+    t->serversNum = 3;
+    t->servers = servers;
+    t->ports = ports;
+    for (int i=0; i<3; i++) {
+        servers[i].buff = (uint8_t*)addrs[i];
+        servers[i].len = strlen(addrs[i]);
+        ports[i] = 11222+i;
+    }
+    t->hashFuncNum = 3;
+    t->segmentsNum = 5;
+    t->ownersNumPerSegment = ownersNum;
+    t->ownersPerSegment = owners;
+    for (int i=0; i<5; i++) {
+        ownersNum[i] = 1 + i%2;
+        owners[i] = ownersData+2*i;
+        ownersData[2*i] = i%3;
+        ownersData[2*i+1] = (i+1)%3;
+    }
+}
+
+TEST(TopologySnapshot, RoundTrip) {
+    topologyInfo t, loaded;
+    byteArray servers[3];
+    uint16_t ports[3];
+    uint8_t ownersNum[5];
+    uint32_t *owners[5];
+    uint32_t ownersData[10];
+    fillTopology(&t, servers, ports, ownersNum, owners, ownersData);
+
+    int size = topologySnapshotSize(&t);
+    uint8_t *buff = (uint8_t*)malloc(size);
+    ASSERT_EQ(size, writeTopologySnapshot(buff, &t));
+    ASSERT_EQ(0, loadTopologySnapshot(buff, size, &loaded));
+
+    ASSERT_EQ(t.topologyId, loaded.topologyId);
+    ASSERT_EQ(t.serversNum, loaded.serversNum);
+    ASSERT_EQ(t.segmentsNum, loaded.segmentsNum);
+    for (int i=0; i<3; i++) {
+        ASSERT_EQ(t.ports[i], loaded.ports[i]);
+        ASSERT_EQ(t.servers[i].len, loaded.servers[i].len);
+        ASSERT_EQ(0, memcmp(t.servers[i].buff, loaded.servers[i].buff, t.servers[i].len));
+    }
+    for (int i=0; i<5; i++) {
+        ASSERT_EQ(t.ownersNumPerSegment[i], loaded.ownersNumPerSegment[i]);
+        for (int j=0; j<t.ownersNumPerSegment[i]; j++) {
+            ASSERT_EQ(t.ownersPerSegment[i][j], loaded.ownersPerSegment[i][j]);
+        }
+    }
+    releaseTopologySnapshot(&loaded);
+    free(buff);
+}
+
+TEST(Routing, Hash32MatchesLittleEndianBytes) {
+    topologyInfo t;
+    byteArray servers[3];
+    uint16_t ports[3];
+    uint8_t ownersNum[5];
+    uint32_t *owners[5];
+    uint32_t ownersData[10];
+    fillTopology(&t, servers, ports, ownersNum, owners, ownersData);
+    // Integer keys are sent little endian so they can be routed with hash32
+    for (uint32_t key=0; key<100000; key+=97) {
+        uint8_t bytes[4] = {(uint8_t)key, (uint8_t)(key >> 8), (uint8_t)(key >> 16), (uint8_t)(key >> 24)};
+        ASSERT_EQ(getSegmentVoidPtr(bytes, 4, 5), getSegment32(key, 5));
+        ASSERT_EQ(getServerListVoidPtr(&t, bytes, 4), getServerList32(&t, key));
+    }
+}
+
+TEST(TopologySnapshot, RejectsInvalid) {
+    topologyInfo t, loaded;
+    byteArray servers[3];
+    uint16_t ports[3];
+    uint8_t ownersNum[5];
+    uint32_t *owners[5];
+    uint32_t ownersData[10];
+    fillTopology(&t, servers, ports, ownersNum, owners, ownersData);
+
+    int size = topologySnapshotSize(&t);
+    uint8_t *buff = (uint8_t*)malloc(size);
+    writeTopologySnapshot(buff, &t);
+    ASSERT_EQ(-1, loadTopologySnapshot(buff, 16, &loaded));
+    ASSERT_EQ(-1, loadTopologySnapshot(buff, size/2, &loaded));
+    buff[0] ^= 0xff;
+    ASSERT_EQ(-1, loadTopologySnapshot(buff, size, &loaded));
+    free(buff);
+}
+
+typedef struct {
+    uint8_t *buff;
+    int pos;
+    int len;
+} memStream;
+
+static void memReader(void *ctx, uint8_t *val, int len) {
+    memStream *ms = (memStream*)ctx;
+    memcpy(val, ms->buff+ms->pos, len);
+    ms->pos += len;
+}
+
+// GET response (opcode 0x04) with no topology change followed by the value
+static int getResponse(uint8_t *buff, const char *value) {
+    int len = strlen(value);
+    uint8_t head[] = {0xA1, 0x01, 0x04, 0x00, 0x00, (uint8_t)len};
+    memcpy(buff, head, sizeof(head));
+    memcpy(buff+sizeof(head), value, len);
+    return sizeof(head)+len;
+}
+
+TEST(ReadGetInto, ReusesAndGrows) {
+    uint8_t data[64];
+    int len = getResponse(data, "value");
+    len += getResponse(data+len, "a longer value");
+    memStream ms = {data, 0, len};
+    requestHeader rqh;
+    rqh.clientIntelligence = CLIENT_INTELLIGENCE_BASIC;
+    responseHeader rsh;
+    topologyInfo tInfo;
+    valueBuffer buf = {0, 8, (uint8_t*)malloc(8), 1};
+    uint8_t *first = buf.buff;
+
+    ASSERT_EQ(5, readGetInto(&ms, memReader, &rsh, &rqh, &tInfo, &buf));
+    ASSERT_EQ(first, buf.buff);
+    ASSERT_EQ(0, memcmp("value", buf.buff, 5));
+    ASSERT_EQ(14, readGetInto(&ms, memReader, &rsh, &rqh, &tInfo, &buf));
+    ASSERT_EQ(14, buf.len);
+    ASSERT_GE(buf.capacity, 14);
+    ASSERT_EQ(0, memcmp("a longer value", buf.buff, 14));
+    ASSERT_EQ(len, ms.pos);
+    free(buf.buff);
+}
+
+TEST(ReadGetInto, FixedBufferTooSmall) {
+    uint8_t data[64];
+    int len = getResponse(data, "a longer value");
+    len += getResponse(data+len, "value");
+    memStream ms = {data, 0, len};
+    requestHeader rqh;
+    rqh.clientIntelligence = CLIENT_INTELLIGENCE_BASIC;
+    responseHeader rsh;
+    topologyInfo tInfo;
+    uint8_t fixed[8];
+    valueBuffer buf = {0, sizeof(fixed), fixed, 0};
+
+    // Value is reported and skipped, the stream stays in sync for the next response
+    ASSERT_EQ(14, readGetInto(&ms, memReader, &rsh, &rqh, &tInfo, &buf));
+    ASSERT_EQ(0, buf.len);
+    ASSERT_EQ(fixed, buf.buff);
+    ASSERT_EQ(5, readGetInto(&ms, memReader, &rsh, &rqh, &tInfo, &buf));
+    ASSERT_EQ(0, memcmp("value", buf.buff, 5));
+}
+
+static void memWriter(void *ctx, uint8_t *val, int len) {
+    memStream *ms = (memStream*)ctx;
+    memcpy(ms->buff+ms->len, val, len);
+    ms->len += len;
+}
+
+TEST(WritePut, ExpirationEncoding) {
+    requestHeader rqh;
+    fillHeader(&rqh);
+    uint8_t hdrBuff[64];
+    int keyOffset = writeRequestHeader(hdrBuff, &rqh);
+    byteArray key = {1, (uint8_t*)"k"};
+    byteArray value = {1, (uint8_t*)"v"};
+    uint8_t data[128];
+
+    // Lifespan of 300 seconds as vlong, maxIdle from the server has no amount
+    entryExpiration exp = {300, 0, SECONDS, DEFAULT};
+    memStream ms = {data, 0, 0};
+    writePutWithExpiration(&ms, memWriter, &rqh, &key, &value, &exp);
+    uint8_t expected[] = {0x07, 0xAC, 0x02, 0x01, 'v'};
+    ASSERT_EQ(keyOffset+2+(int)sizeof(expected), ms.len);
+    ASSERT_EQ(0, memcmp(expected, data+keyOffset+2, sizeof(expected)));
+
+    // No expiration
+    ms.len = 0;
+    writePut(&ms, memWriter, &rqh, &key, &value);
+    ASSERT_EQ(keyOffset+5, ms.len);
+    ASSERT_EQ(0x88, data[keyOffset+2]);
+}
+
+TEST(WritePrepare, ModificationEncoding) {
+    requestHeader rqh;
+    fillHeader(&rqh);
+    uint8_t hdrBuff[64];
+    int bodyOffset = writeRequestHeader(hdrBuff, &rqh);
+    transactionXid xid = {-1, {1, (uint8_t*)"g"}, {1, (uint8_t*)"b"}};
+    txModification mods[2];
+    memset(mods, 0, sizeof(mods));
+    mods[0].key = {1, (uint8_t*)"k"};
+    mods[0].value = {1, (uint8_t*)"v"};
+    mods[0].versionRead = 7;
+    mods[1].key = {1, (uint8_t*)"r"};
+    mods[1].control = TX_REMOVE_OP | TX_NOT_READ;
+    uint8_t data[128];
+    memStream ms = {data, 0, 0};
+    writePrepare(&ms, memWriter, &rqh, &xid, 1, 1000, mods, 2);
+    uint8_t expected[] = {
+        0x01, 0x01, 'g', 0x01, 'b',             // formatId -1 zigzag encoded, ids
+        0x01, 0x00,                             // one phase, not recoverable
+        0, 0, 0, 0, 0, 0, 0x03, 0xE8,           // timeout
+        0x02,
+        0x01, 'k', 0x00, 0, 0, 0, 0, 0, 0, 0, 0x07, 0x88, 0x01, 'v',
+        0x01, 'r', 0x05};
+    ASSERT_EQ(bodyOffset+(int)sizeof(expected), ms.len);
+    ASSERT_EQ(0, memcmp(expected, data+bodyOffset, sizeof(expected)));
+    ASSERT_EQ(PREPARE_REQUEST, rqh.opCode);
+}
+
+TEST(WriteExec, ParamsEncoding) {
+    requestHeader rqh;
+    fillHeader(&rqh);
+    uint8_t hdrBuff[64];
+    int bodyOffset = writeRequestHeader(hdrBuff, &rqh);
+    byteArray script = {3, (uint8_t*)"sum"};
+    execParam params[2] = {{{1, (uint8_t*)"a"}, {2, (uint8_t*)"12"}}, {{1, (uint8_t*)"b"}, {0, nullptr}}};
+    uint8_t data[64];
+    memStream ms = {data, 0, 0};
+    writeExec(&ms, memWriter, &rqh, &script, params, 2);
+    uint8_t expected[] = {0x03, 's', 'u', 'm', 0x02, 0x01, 'a', 0x02, '1', '2', 0x01, 'b', 0x00};
+    ASSERT_EQ(bodyOffset+(int)sizeof(expected), ms.len);
+    ASSERT_EQ(0, memcmp(expected, data+bodyOffset, sizeof(expected)));
+    ASSERT_EQ(EXEC_REQUEST, rqh.opCode);
+}
+
+TEST(WriteCounter, RequestsEncoding) {
+    requestHeader rqh;
+    fillHeader(&rqh);
+    uint8_t hdrBuff[64];
+    // Counters have no cache, the name of the header is not sent
+    int bodyOffset = writeRequestHeader(hdrBuff, &rqh);
+    rqh.cacheName = {5, (uint8_t*)"cache"};
+    byteArray name = {1, (uint8_t*)"c"};
+    uint8_t data[128];
+    memStream ms = {data, 0, 0};
+
+    counterConfiguration weak = {COUNTER_WEAK, 200, 0, 0, 5};
+    writeCounterCreate(&ms, memWriter, &rqh, &name, &weak);
+    uint8_t expectedWeak[] = {0x01, 'c', 0x01, 0xC8, 0x01, 0, 0, 0, 0, 0, 0, 0, 0x05};
+    ASSERT_EQ(bodyOffset+(int)sizeof(expectedWeak), ms.len);
+    ASSERT_EQ(0, memcmp(expectedWeak, data+bodyOffset, sizeof(expectedWeak)));
+    ASSERT_EQ(COUNTER_CREATE_REQUEST, rqh.opCode);
+    ASSERT_EQ(5, rqh.cacheName.len);
+
+    ms.len = 0;
+    counterConfiguration bounded = {COUNTER_BOUNDED, 0, -1, 10, 0};
+    writeCounterCreate(&ms, memWriter, &rqh, &name, &bounded);
+    uint8_t expectedBounded[] = {0x01, 'c', 0x02,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0, 0, 0, 0, 0, 0, 0, 0x0A,
+        0, 0, 0, 0, 0, 0, 0, 0};
+    ASSERT_EQ(bodyOffset+(int)sizeof(expectedBounded), ms.len);
+    ASSERT_EQ(0, memcmp(expectedBounded, data+bodyOffset, sizeof(expectedBounded)));
+
+    ms.len = 0;
+    writeCounterAddAndGet(&ms, memWriter, &rqh, &name, -2);
+    uint8_t expectedAdd[] = {0x01, 'c', 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE};
+    ASSERT_EQ(bodyOffset+(int)sizeof(expectedAdd), ms.len);
+    ASSERT_EQ(0, memcmp(expectedAdd, data+bodyOffset, sizeof(expectedAdd)));
+    ASSERT_EQ(COUNTER_ADD_AND_GET_REQUEST, rqh.opCode);
+
+    ms.len = 0;
+    writeCounterGet(&ms, memWriter, &rqh, &name);
+    ASSERT_EQ(bodyOffset+2, ms.len);
+    ASSERT_EQ(0, memcmp(expectedAdd, data+bodyOffset, 2));
+    ASSERT_EQ(COUNTER_GET_REQUEST, rqh.opCode);
+}
+
+TEST(ReadCounterValue, ValueOnlyIfDefined) {
+    uint8_t data[] = {
+        0xA1, 0x01, 0x53, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFD,
+        0xA1, 0x02, 0x57, 0x02, 0x00,
+        0xA1, 0x03, 0x57, 0x00, 0x00, 0, 0, 0, 0x01, 0, 0, 0, 0};
+    memStream ms = {data, 0, sizeof(data)};
+    requestHeader rqh;
+    fillHeader(&rqh);
+    rqh.clientIntelligence = CLIENT_INTELLIGENCE_BASIC;
+    responseHeader rsh;
+    topologyInfo tInfo;
+    int64_t value = 0;
+
+    readCounterValue(&ms, memReader, &rsh, &rqh, &tInfo, &value);
+    ASSERT_EQ(OK_STATUS, rsh.status);
+    ASSERT_EQ(-3, value);
+    // An undefined counter has no value, the stream stays in sync for the next response
+    readCounterValue(&ms, memReader, &rsh, &rqh, &tInfo, &value);
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, rsh.status);
+    ASSERT_EQ(-3, value);
+    readCounterValue(&ms, memReader, &rsh, &rqh, &tInfo, &value);
+    ASSERT_EQ(OK_STATUS, rsh.status);
+    ASSERT_EQ(1LL << 32, value);
+    ASSERT_EQ((int)sizeof(data), ms.pos);
+}
+
+// Answers every request with the GET response of the value in arg
+static void getResponder(faultStream *fs, const uint8_t * /*request*/, int /*len*/, void *arg) {
+    uint8_t data[64];
+    faultQueueResponse(fs, data, getResponse(data, (const char*)arg));
+}
+
+static void initGetHeader(requestHeader *rqh) {
+    fillHeader(rqh);
+    rqh->clientIntelligence = CLIENT_INTELLIGENCE_BASIC;
+}
+
+TEST(FaultTransport, ShortReadsAndWrites) {
+    faultProfile profile;
+    memset(&profile, 0, sizeof(profile));
+    profile.maxReadChunk = 1;
+    profile.maxWriteChunk = 3;
+    faultStream fs;
+    initFaultStream(&fs, &profile, 1);
+    fs.responder = getResponder;
+    fs.responderArg = (void*)"value";
+    requestHeader rqh;
+    initGetHeader(&rqh);
+    byteArray key = {3, (uint8_t*)"key"};
+    uint8_t expected[64];
+    memStream ms = {expected, 0, 0};
+    writeGet(&ms, memWriter, &rqh, &key);
+
+    writeGet(&fs, faultWriter, &rqh, &key);
+    ASSERT_EQ(ms.len, fs.outLen);
+    ASSERT_EQ(0, memcmp(expected, fs.out, ms.len));
+    ASSERT_EQ((uint64_t)(ms.len+2)/3, fs.writes);
+    responseHeader rsh;
+    topologyInfo tInfo;
+    valueBuffer buf = {0, 0, nullptr, 1};
+    // One byte per read, the parser must still see the whole response
+    ASSERT_EQ(5, readGetInto(&fs, faultReader, &rsh, &rqh, &tInfo, &buf));
+    ASSERT_EQ(0, memcmp("value", buf.buff, 5));
+    ASSERT_EQ(0, fs.hasError);
+    ASSERT_EQ((uint64_t)fs.inLen, fs.reads);
+    free(buf.buff);
+    freeFaultStream(&fs);
+}
+
+TEST(FaultTransport, DisconnectAndStall) {
+    faultProfile profile;
+    memset(&profile, 0, sizeof(profile));
+    profile.disconnectAfterBytes = 8;
+    faultStream fs;
+    initFaultStream(&fs, &profile, 1);
+    uint8_t data[64];
+    faultQueueResponse(&fs, data, getResponse(data, "value"));
+    requestHeader rqh;
+    initGetHeader(&rqh);
+    responseHeader rsh;
+    topologyInfo tInfo;
+    uint8_t value[8];
+    valueBuffer buf = {0, sizeof(value), value, 0};
+    // The connection drops in the middle of the value
+    readGetInto(&fs, faultReader, &rsh, &rqh, &tInfo, &buf);
+    ASSERT_EQ(ECONNRESET, fs.hasError);
+    ASSERT_EQ(8u, fs.bytesRead);
+    freeFaultStream(&fs);
+
+    // A stall shorter than the timeout only delays the response
+    memset(&profile, 0, sizeof(profile));
+    profile.stallAfterBytes = 3;
+    profile.stallNs = 1000000;
+    profile.timeoutNs = 5000000;
+    initFaultStream(&fs, &profile, 1);
+    faultQueueResponse(&fs, data, getResponse(data, "value"));
+    ASSERT_EQ(5, readGetInto(&fs, faultReader, &rsh, &rqh, &tInfo, &buf));
+    ASSERT_EQ(0, fs.hasError);
+    ASSERT_EQ(1000000u, fs.clockNs);
+    freeFaultStream(&fs);
+
+    profile.stallNs = 10000000;
+    initFaultStream(&fs, &profile, 1);
+    faultQueueResponse(&fs, data, getResponse(data, "value"));
+    readGetInto(&fs, faultReader, &rsh, &rqh, &tInfo, &buf);
+    ASSERT_EQ(ETIMEDOUT, fs.hasError);
+    ASSERT_EQ(5000000u, fs.clockNs);
+    freeFaultStream(&fs);
+}
+
+/**
+ * Run count GETs on a stream per server, reopening a stream after an error, and collect
+ * the response delay of each request for each server
+ */
+static void runGets(const faultProfile *profiles, int serversNum, int count, std::vector<std::vector<uint64_t> > *delays, int *errors) {
+    requestHeader rqh;
+    initGetHeader(&rqh);
+    byteArray key = {3, (uint8_t*)"key"};
+    responseHeader rsh;
+    topologyInfo tInfo;
+    valueBuffer buf = {0, 0, nullptr, 1};
+    delays->assign(serversNum, std::vector<uint64_t>());
+    *errors = 0;
+    for (int s=0; s<serversNum; s++) {
+        faultStream fs;
+        initFaultStream(&fs, &profiles[s], s+1);
+        fs.responder = getResponder;
+        fs.responderArg = (void*)"value";
+        for (int i=0; i<count; i++) {
+            writeGet(&fs, faultWriter, &rqh, &key);
+            readGetInto(&fs, faultReader, &rsh, &rqh, &tInfo, &buf);
+            (*delays)[s].push_back(fs.hasError ? profiles[s].timeoutNs : fs.lastDelayNs);
+            if (fs.hasError) {
+                (*errors)++;
+                uint64_t seed = fs.seed;
+                freeFaultStream(&fs);
+                initFaultStream(&fs, &profiles[s], seed);
+                fs.responder = getResponder;
+                fs.responderArg = (void*)"value";
+            }
+        }
+        freeFaultStream(&fs);
+    }
+    free(buf.buff);
+}
+
+static uint64_t percentile(std::vector<uint64_t> values, double p) {
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p/100*(values.size()-1))];
+}
+
+TEST(FaultTransport, SlowNodeTailAndTimeout) {
+    faultProfile profiles[2];
+    memset(profiles, 0, sizeof(profiles));
+    for (int s=0; s<2; s++) {
+        profiles[s].baseNs = 100000;
+        profiles[s].jitterNs = 50000;
+        profiles[s].slowProbability = 0.02;
+        profiles[s].slowNs = 20000000;
+    }
+    std::vector<std::vector<uint64_t> > delays, again;
+    int errors;
+    runGets(profiles, 2, 10000, &delays, &errors);
+    ASSERT_EQ(0, errors);
+    // The slow responses make the tail, the same seeds make the same run
+    ASSERT_LT(percentile(delays[0], 50), 150000u);
+    ASSERT_EQ(20000000u, percentile(delays[0], 99));
+    runGets(profiles, 2, 10000, &again, &errors);
+    ASSERT_EQ(delays, again);
+
+    // With a timeout the slow responses fail
+    profiles[0].timeoutNs = 1000000;
+    runGets(profiles, 1, 10000, &delays, &errors);
+    ASSERT_GT(errors, 100);
+    ASSERT_LT(errors, 300);
+    ASSERT_EQ(1000000u, percentile(delays[0], 99));
+}
@@ -0,0 +1,826 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "counterAggregator.h"
+#include "hotrodClient.h"
+#include "hotrodTransaction.h"
+#include "listenerStream.h"
+#include "socketTransport.h"
+#include "standInServer.h"
+#include "valueCodec.h"
+#include "gtest/gtest.h"
+
+static void fillHeader(requestHeader *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = 0xA0;
+    hdr->version = 30;
+    hdr->clientIntelligence = CLIENT_INTELLIGENCE_HASH_DISTRIBUTION_AWARE;
+}
+
+static byteArray toArray(const char *s) {
+    byteArray a = {(int)strlen(s), (uint8_t*)s};
+    return a;
+}
+
+/**
+ * Wait up to one second for *counter to reach expected
+ */
+static uint64_t waitCount(uint64_t *counter, uint64_t expected) {
+    for (int i=0; i<1000 && __atomic_load_n(counter, __ATOMIC_ACQUIRE) < expected; i++) {
+        usleep(1000);
+    }
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+typedef struct {
+    uint64_t events;
+    uint64_t created;
+    uint64_t modified;
+    int maxBatch;
+    int slow;               ///< the handler sleeps, so the ring fills
+} listenerCounts;
+
+static void countEvents(cacheEvent *const *events, int count, void *arg) {
+    listenerCounts *counts = (listenerCounts*)arg;
+    for (int i=0; i<count; i++) {
+        if (events[i]->opCode == CACHE_ENTRY_CREATED_EVENT_RESPONSE) {
+            __atomic_add_fetch(&counts->created, 1, __ATOMIC_RELAXED);
+        } else if (events[i]->opCode == CACHE_ENTRY_MODIFIED_EVENT_RESPONSE) {
+            __atomic_add_fetch(&counts->modified, 1, __ATOMIC_RELAXED);
+        }
+    }
+    int max = __atomic_load_n(&counts->maxBatch, __ATOMIC_RELAXED);
+    while (count > max && !__atomic_compare_exchange_n(&counts->maxBatch, &max, count, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    if (__atomic_load_n(&counts->slow, __ATOMIC_RELAXED)) {
+        usleep(500);
+    }
+    __atomic_add_fetch(&counts->events, count, __ATOMIC_RELEASE);
+}
+
+TEST(ListenerStream, RingBatchesIncludeStateAndStop) {
+    standInServer *srv = startStandInServer(12960, 1, 16);
+    ASSERT_NE(nullptr, srv);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12960, &hdr, 1);
+    ASSERT_NE(nullptr, client);
+    char key[16];
+    byteArray value = toArray("v");
+    for (int i=0; i<10; i++) {
+        snprintf(key, sizeof(key), "pre%d", i);
+        byteArray k = toArray(key);
+        ASSERT_EQ(OK_STATUS, clientPut(client, &k, &value));
+    }
+
+    listenerCounts counts;
+    memset(&counts, 0, sizeof(counts));
+    counts.slow = 1;
+    byteArray id = toArray("lsn");
+    // A ring of 8 slots and a slow handler: the decoder waits for free slots
+    listenerStream *ls = startListener("127.0.0.1", 12960, &hdr, &id, 1, 8, 2, 4, countEvents, &counts);
+    ASSERT_NE(nullptr, ls);
+    // includeState delivers the entries already there as created events
+    ASSERT_EQ(10u, waitCount(&counts.events, 10));
+    ASSERT_EQ(10u, counts.created);
+
+    for (int i=0; i<200; i++) {
+        snprintf(key, sizeof(key), "pre%d", i%20);
+        byteArray k = toArray(key);
+        ASSERT_EQ(OK_STATUS, clientPut(client, &k, &value));
+    }
+    ASSERT_EQ(210u, waitCount(&counts.events, 210));
+    ASSERT_EQ(20u, counts.created);
+    ASSERT_EQ(190u, counts.modified);
+
+    listenerStats stats;
+    getListenerStats(ls, &stats);
+    ASSERT_EQ(210u, stats.events);
+    ASSERT_EQ(0u, stats.backlog);
+    ASSERT_GT(stats.ringFullWaits, 0u);
+    // Events pile up behind the slow handler and are claimed several at time
+    ASSERT_LT(stats.batches, stats.events);
+    ASSERT_LE(counts.maxBatch, 4);
+    ASSERT_GT(counts.maxBatch, 1);
+
+    // Consumers and decoder are parked after an idle period, an event wakes them
+    __atomic_store_n(&counts.slow, 0, __ATOMIC_RELAXED);
+    usleep(50000);
+    byteArray k = toArray("late");
+    ASSERT_EQ(OK_STATUS, clientPut(client, &k, &value));
+    ASSERT_EQ(211u, waitCount(&counts.events, 211));
+
+    stopListener(ls);
+    ASSERT_EQ(OK_STATUS, clientPut(client, &k, &value));
+    usleep(20000);
+    ASSERT_EQ(211u, __atomic_load_n(&counts.events, __ATOMIC_ACQUIRE));
+
+    destroyClient(client);
+    stopStandInServer(srv);
+}
+
+static int rleBound(int len) {
+    return 2*len;
+}
+
+/**
+ * Run length encoding, pairs of count and byte: enough to test the framing
+ */
+static int rleCompress(const uint8_t *src, int len, uint8_t *dst, int capacity) {
+    int out = 0;
+    for (int i=0; i<len; ) {
+        int run = 1;
+        while (i+run < len && run < 255 && src[i+run] == src[i]) {
+            run++;
+        }
+        if (out+2 > capacity) {
+            return -1;
+        }
+        dst[out++] = run;
+        dst[out++] = src[i];
+        i += run;
+    }
+    return out;
+}
+
+static int rleDecompress(const uint8_t *src, int len, uint8_t *dst, int originalLen) {
+    int out = 0;
+    for (int i=0; i+1 < len; i+=2) {
+        if (out+src[i] > originalLen) {
+            return -1;
+        }
+        memset(dst+out, src[i+1], src[i]);
+        out += src[i];
+    }
+    return out == originalLen ? 0 : -1;
+}
+
+static const valueCodec rleCodec = {200, "rle", rleBound, rleCompress, rleDecompress};
+
+TEST(ValueCodec, RoundTrip) {
+    registerValueCodec(&rleCodec);
+    ASSERT_EQ(&rleCodec, findValueCodec("rle"));
+    uint8_t original[1000];
+    memset(original, 'a', sizeof(original));
+    byteArray value = {sizeof(original), original};
+    valueBuffer out = {0, 0, nullptr, 1};
+    ASSERT_EQ(1, encodeValue(&rleCodec, 16, &value, &out));
+    ASSERT_TRUE(isFramedValue(out.buff, out.len));
+    ASSERT_LT(out.len, 32);
+
+    // A fixed buffer holding the frame but too small for the original value
+    uint8_t fixed[64];
+    memcpy(fixed, out.buff, out.len);
+    valueBuffer small = {out.len, sizeof(fixed), fixed, 0};
+    ASSERT_EQ(-ENOBUFS, decodeValue(&small));
+    ASSERT_EQ(1000, small.len);
+    ASSERT_EQ(0, memcmp(fixed, out.buff, out.len));
+
+    ASSERT_EQ(1000, decodeValue(&out));
+    ASSERT_EQ(1000, out.len);
+    ASSERT_EQ(0, memcmp(original, out.buff, sizeof(original)));
+
+    // Under the threshold the value is sent as is
+    byteArray shortValue = {8, original};
+    ASSERT_EQ(0, encodeValue(&rleCodec, 16, &shortValue, &out));
+    free(out.buff);
+}
+
+TEST(ValueCodec, ForeignValueWithMagic) {
+    // A raw value that looks like a frame is escaped, and read back unchanged
+    uint8_t foreign[] = {0xF9, 0x5A, 0xC8, 0x00, 0x00, 0x00, 0x03, 'x', 'y', 'z'};
+    byteArray value = {sizeof(foreign), foreign};
+    valueBuffer out = {0, 0, nullptr, 1};
+    ASSERT_EQ(1, encodeValue(nullptr, 0, &value, &out));
+    ASSERT_EQ((int)sizeof(foreign)+VALUE_FRAME_SIZE, out.len);
+    ASSERT_EQ(0, out.buff[2]);
+    ASSERT_EQ((int)sizeof(foreign), decodeValue(&out));
+    ASSERT_EQ((int)sizeof(foreign), out.len);
+    ASSERT_EQ(0, memcmp(foreign, out.buff, sizeof(foreign)));
+
+    // Stored frames must match their length, sizes over INT_MAX are corrupted
+    uint8_t badStored[] = {0xF9, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x05, 'x'};
+    valueBuffer bad = {sizeof(badStored), sizeof(badStored), badStored, 0};
+    ASSERT_EQ(-1, decodeValue(&bad));
+    uint8_t huge[] = {0xF9, 0x5A, 0xC8, 0x80, 0x00, 0x00, 0x00, 'x'};
+    valueBuffer hugeBuf = {sizeof(huge), sizeof(huge), huge, 0};
+    ASSERT_EQ(-1, decodeValue(&hugeBuf));
+    free(out.buff);
+}
+
+TEST(ClientGet, FixedBufferTooSmall) {
+    registerValueCodec(&rleCodec);
+    standInServer *srv = startStandInServer(12962, 1, 16);
+    ASSERT_NE(nullptr, srv);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12962, &hdr, 1);
+    ASSERT_NE(nullptr, client);
+    uint8_t raw[100];
+    for (int i=0; i<100; i++) {
+        raw[i] = i;
+    }
+    byteArray key = toArray("raw");
+    byteArray value = {sizeof(raw), raw};
+    ASSERT_EQ(OK_STATUS, clientPut(client, &key, &value));
+    uint8_t fixed[64];
+    valueBuffer small = {0, sizeof(fixed), fixed, 0};
+    ASSERT_EQ(-ENOBUFS, clientGet(client, &key, &small));
+    ASSERT_EQ(100, small.len);
+    uint64_t version;
+    ASSERT_EQ(-ENOBUFS, clientGetWithVersion(client, &key, &small, &version));
+    ASSERT_EQ(100, small.len);
+
+    // The previous value of a write is reported the same way
+    writeOptions opts = {nullptr, 0, &small};
+    ASSERT_EQ(-ENOBUFS, clientPutWithOptions(client, &key, &value, &opts));
+    ASSERT_EQ(100, small.len);
+
+    // A compressed value fits as a frame, not once decompressed
+    setClientCompression(client, &rleCodec, 16);
+    uint8_t repeated[1000];
+    memset(repeated, 'r', sizeof(repeated));
+    byteArray compressible = {sizeof(repeated), repeated};
+    key = toArray("rle");
+    ASSERT_EQ(OK_STATUS, clientPut(client, &key, &compressible));
+    ASSERT_EQ(-ENOBUFS, clientGet(client, &key, &small));
+    ASSERT_EQ(1000, small.len);
+    valueBuffer grown = {0, 0, nullptr, 1};
+    ASSERT_EQ(OK_STATUS, clientGet(client, &key, &grown));
+    ASSERT_EQ(1000, grown.len);
+    ASSERT_EQ(0, memcmp(repeated, grown.buff, sizeof(repeated)));
+    free(grown.buff);
+
+    destroyClient(client);
+    stopStandInServer(srv);
+}
+
+typedef struct {
+    counterHandle *counter;
+    int adds;
+} counterAdder;
+
+static void *addToCounter(void *arg) {
+    counterAdder *adder = (counterAdder*)arg;
+    for (int i=0; i<adder->adds; i++) {
+        counterHandleAdd(adder->counter, 1);
+    }
+    return nullptr;
+}
+
+/**
+ * Poll the counter on the server for up to one second until it reaches expected
+ */
+static int64_t waitCounter(hotrodClient *client, const byteArray *name, int64_t expected) {
+    int64_t value = 0;
+    for (int i=0; i<1000; i++) {
+        if (clientCounterGet(client, name, &value) == OK_STATUS && value >= expected) {
+            break;
+        }
+        usleep(1000);
+    }
+    return value;
+}
+
+TEST(CounterAggregator, ThresholdIntervalAndDestroy) {
+    standInServer *srv = startStandInServer(12964, 1, 16);
+    ASSERT_NE(nullptr, srv);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12964, &hdr, 1);
+    ASSERT_NE(nullptr, client);
+    byteArray name = toArray("hits");
+    counterConfiguration conf = {0, 0, 0, 0, 0};
+    ASSERT_EQ(OK_STATUS, clientCounterCreate(client, &name, &conf));
+
+    // An interval far beyond the test, only the threshold triggers a flush
+    counterAggregator *agg = createCounterAggregator(client, 60000, 1000);
+    counterHandle *counter = counterGet(agg, "hits");
+    ASSERT_EQ(counter, counterGet(agg, "hits"));
+    // Handles stay valid while more counters are added
+    counterHandle *others[40];
+    char other[16];
+    for (int i=0; i<40; i++) {
+        snprintf(other, sizeof(other), "other%d", i);
+        others[i] = counterGet(agg, other);
+    }
+    for (int i=0; i<40; i++) {
+        snprintf(other, sizeof(other), "other%d", i);
+        ASSERT_EQ(others[i], counterGet(agg, other));
+    }
+    ASSERT_EQ(counter, counterGet(agg, "hits"));
+    counterAdd(agg, "hits", 999);
+    usleep(20000);
+    int64_t value = -1;
+    ASSERT_EQ(OK_STATUS, clientCounterGet(client, &name, &value));
+    ASSERT_EQ(0, value);
+    counterHandleAdd(counter, 1);
+    ASSERT_EQ(1000, waitCounter(client, &name, 1000));
+
+    // Concurrent adders on the same handle, no increment is lost
+    pthread_t threads[4];
+    counterAdder adders[4];
+    for (int i=0; i<4; i++) {
+        adders[i] = {counter, 10000};
+        pthread_create(&threads[i], nullptr, addToCounter, &adders[i]);
+    }
+    for (int i=0; i<4; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    // The flush thread may be sending a part of the deltas meanwhile
+    ASSERT_EQ(0, counterFlush(agg));
+    ASSERT_EQ(41000, waitCounter(client, &name, 41000));
+
+    // Destroy flushes what is still pending
+    counterHandleAdd(counter, -1);
+    destroyCounterAggregator(agg);
+    ASSERT_EQ(OK_STATUS, clientCounterGet(client, &name, &value));
+    ASSERT_EQ(40999, value);
+
+    // Without threshold nothing is flushed before the interval, a delta refused by the server is dropped
+    agg = createCounterAggregator(client, 60000, 0);
+    counterAdd(agg, "undefined", 5);
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, counterFlush(agg));
+    ASSERT_EQ(0, counterFlush(agg));
+    destroyCounterAggregator(agg);
+
+    destroyClient(client);
+    stopStandInServer(srv);
+}
+
+typedef struct {
+    hotrodClient *client;
+    int updates;
+    uint64_t calls;         ///< calls of the update function, conflicts included
+    int failures;
+} counterUpdater;
+
+/**
+ * Increment a decimal value, an absent key counts from 0
+ */
+static int incrementValue(const valueBuffer *current, valueBuffer *next, void *arg) {
+    counterUpdater *updater = (counterUpdater*)arg;
+    __atomic_add_fetch(&updater->calls, 1, __ATOMIC_RELAXED);
+    char text[24];
+    long value = 0;
+    if (current != nullptr) {
+        snprintf(text, sizeof(text), "%.*s", current->len, (const char*)current->buff);
+        value = atol(text);
+    }
+    int len = snprintf(text, sizeof(text), "%ld", value+1);
+    if (next->capacity < len) {
+        next->buff = (uint8_t*)realloc(next->buff, len);
+        next->capacity = len;
+    }
+    memcpy(next->buff, text, len);
+    next->len = len;
+    return 1;
+}
+
+static int giveUp(const valueBuffer * /*current*/, valueBuffer * /*next*/, void * /*arg*/) {
+    return 0;
+}
+
+static void *updateCounter(void *arg) {
+    counterUpdater *updater = (counterUpdater*)arg;
+    byteArray key = toArray("updated");
+    for (int i=0; i<updater->updates; i++) {
+        if (clientUpdate(updater->client, &key, incrementValue, updater, 1000) != OK_STATUS) {
+            updater->failures++;
+        }
+    }
+    return nullptr;
+}
+
+TEST(ClientUpdate, ConditionalWritesAndContention) {
+    standInServer *srv = startStandInServer(12966, 1, 16);
+    ASSERT_NE(nullptr, srv);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12966, &hdr, 4);
+    ASSERT_NE(nullptr, client);
+    byteArray key = toArray("versioned");
+    byteArray v1 = toArray("v1");
+    byteArray v2 = toArray("v2");
+    valueBuffer value = {0, 0, nullptr, 1};
+    uint64_t version, stale;
+
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, clientGetWithVersion(client, &key, &value, &version));
+    ASSERT_EQ(OK_STATUS, clientPut(client, &key, &v1));
+    ASSERT_EQ(OK_STATUS, clientGetWithVersion(client, &key, &value, &stale));
+    ASSERT_EQ(OK_STATUS, clientReplaceIfUnmodified(client, &key, &v2, stale));
+    ASSERT_EQ(OK_STATUS, clientGetWithVersion(client, &key, &value, &version));
+    ASSERT_NE(stale, version);
+    ASSERT_EQ(2, value.len);
+    ASSERT_EQ(0, memcmp("v2", value.buff, 2));
+    // A write based on a stale version is refused and leaves the value unchanged
+    ASSERT_EQ(NOT_PUT_REMOVED_REPLACED_STATUS, clientReplaceIfUnmodified(client, &key, &v1, stale));
+    ASSERT_EQ(NOT_PUT_REMOVED_REPLACED_STATUS, clientRemoveIfUnmodified(client, &key, stale));
+    ASSERT_EQ(OK_STATUS, clientGet(client, &key, &value));
+    ASSERT_EQ(0, memcmp("v2", value.buff, 2));
+    ASSERT_EQ(OK_STATUS, clientRemoveIfUnmodified(client, &key, version));
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, clientReplaceIfUnmodified(client, &key, &v1, version));
+    ASSERT_EQ(-ECANCELED, clientUpdate(client, &key, giveUp, nullptr, 10));
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, clientGet(client, &key, &value));
+
+    // Concurrent increments of the same key, the first one inserts it: none is lost
+    pthread_t threads[4];
+    counterUpdater updaters[4];
+    for (int i=0; i<4; i++) {
+        updaters[i] = {client, 200, 0, 0};
+        pthread_create(&threads[i], nullptr, updateCounter, &updaters[i]);
+    }
+    uint64_t calls = 0;
+    for (int i=0; i<4; i++) {
+        pthread_join(threads[i], nullptr);
+        ASSERT_EQ(0, updaters[i].failures);
+        calls += updaters[i].calls;
+    }
+    ASSERT_GE(calls, 800u);
+    key = toArray("updated");
+    ASSERT_EQ(OK_STATUS, clientGet(client, &key, &value));
+    ASSERT_EQ(3, value.len);
+    ASSERT_EQ(0, memcmp("800", value.buff, 3));
+    free(value.buff);
+
+    destroyClient(client);
+    stopStandInServer(srv);
+}
+
+TEST(CorkStream, ZeroDelayFlushesOnlyOnThresholdOrExplicitFlush) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    transportCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    streamCtx ctx = {};
+    ctx.socket = fds[0];
+    ctx.counters = &counters;
+    uint8_t request[100];
+    memset(request, 'r', sizeof(request));
+
+    corkStream(&ctx, 256, 0);
+    corkedWriter(&ctx, request, sizeof(request));
+    corkedWriter(&ctx, request, sizeof(request));
+    flushIfDue(&ctx);
+    ASSERT_EQ(0u, counters.sendCalls);
+    ASSERT_EQ(200, ctx.outLen);
+    // The third request doesn't fit, everything leaves in one send
+    corkedWriter(&ctx, request, sizeof(request));
+    ASSERT_EQ(1u, counters.sendCalls);
+    ASSERT_EQ(300u, counters.bytesSent);
+    corkedWriter(&ctx, request, sizeof(request));
+    flushStream(&ctx);
+    ASSERT_EQ(2u, counters.sendCalls);
+
+    // With a delay the pending requests leave once a later write finds them due
+    uncorkStream(&ctx);
+    corkStream(&ctx, 256, 1000);
+    corkedWriter(&ctx, request, 10);
+    ASSERT_EQ(2u, counters.sendCalls);
+    usleep(2000);
+    corkedWriter(&ctx, request, 10);
+    ASSERT_EQ(3u, counters.sendCalls);
+    ASSERT_EQ(420u, counters.bytesSent);
+    uncorkStream(&ctx);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(ClientGetAll, PipelinedPerOwner) {
+    standInServer *srv = startStandInServer(12970, 2, 16);
+    ASSERT_NE(nullptr, srv);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12970, &hdr, 1);
+    ASSERT_NE(nullptr, client);
+    enableClientMetrics(client);
+    const int keysNum = 1000;
+    uint32_t keys[keysNum];
+    char text[16];
+    // Only the even keys have a value
+    for (int i=0; i<keysNum; i++) {
+        keys[i] = i*7919;
+        if (i%2 == 0) {
+            byteArray value = {snprintf(text, sizeof(text), "v%d", i), (uint8_t*)text};
+            ASSERT_EQ(OK_STATUS, cachePut32(&client->defaultCache, keys[i], &value));
+        }
+    }
+    clientMetrics before, after;
+    ASSERT_EQ(0, getClientMetrics(client, &before));
+    valueBuffer values[keysNum];
+    int statuses[keysNum];
+    memset(values, 0, sizeof(values));
+    for (int i=0; i<keysNum; i++) {
+        values[i].growable = 1;
+    }
+    ASSERT_EQ(OK_STATUS, cacheGetAll32(&client->defaultCache, keys, keysNum, values, statuses));
+    ASSERT_EQ(0, getClientMetrics(client, &after));
+    for (int i=0; i<keysNum; i++) {
+        if (i%2 == 0) {
+            ASSERT_EQ(OK_STATUS, statuses[i]);
+            int len = snprintf(text, sizeof(text), "v%d", i);
+            ASSERT_EQ(len, values[i].len);
+            ASSERT_EQ(0, memcmp(text, values[i].buff, len));
+        } else {
+            ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, statuses[i]);
+        }
+        free(values[i].buff);
+    }
+    // The GETs of a window refill leave together
+    ASSERT_LT(after.transport.sendCalls-before.transport.sendCalls, (uint64_t)keysNum/10);
+    freeMetrics(&before);
+    freeMetrics(&after);
+
+    destroyClient(client);
+    stopStandInServer(srv);
+}
+
+typedef struct {
+    const byteArray *key;
+    int topologies;         ///< responses that carried a topology
+} probeArgs;
+
+static void probeOperation(void *ctx, requestHeader *hdr, responseHeader *rsh, topologyInfo *newTopology, void *opArgs) {
+    probeArgs *args = (probeArgs*)opArgs;
+    valueBuffer value = {0, 0, nullptr, 1};
+    writeGet(ctx, writer, hdr, (byteArray*)args->key);
+    readGetInto(ctx, reader, rsh, hdr, newTopology, &value);
+    free(value.buff);
+    args->topologies += rsh->topologyChanged;
+}
+
+TEST(OpenCache, TopologyPerCache) {
+    standInServer *srv = startStandInServer(12972, 3, 16);
+    ASSERT_NE(nullptr, srv);
+    setStandInCacheTopology(srv, "small", 2, 8);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12972, &hdr, 1);
+    ASSERT_NE(nullptr, client);
+    hotrodCache *cache = openCache(client, "small");
+    ASSERT_EQ(0u, cache->tInfo.serversNum);
+    byteArray key = toArray("k");
+    byteArray value = toArray("v");
+    // The first response brings the topology of the cache
+    ASSERT_EQ(OK_STATUS, cachePut(cache, &key, &value));
+    ASSERT_EQ(100u, cache->tInfo.topologyId);
+    ASSERT_EQ(2u, cache->tInfo.serversNum);
+    ASSERT_EQ(8u, cache->tInfo.segmentsNum);
+    ASSERT_EQ(1u, client->defaultCache.tInfo.topologyId);
+    ASSERT_EQ(3u, client->defaultCache.tInfo.serversNum);
+    ASSERT_EQ(16u, client->defaultCache.tInfo.segmentsNum);
+    // The servers of the cache are the first two of the client, connections are shared
+    ASSERT_EQ(3, client->serversNum);
+    ASSERT_EQ(0u, cache->slots[0]);
+    ASSERT_EQ(1u, cache->slots[1]);
+
+    // Interleaved requests keep their topologies, no response brings one again
+    probeArgs args = {&key, 0};
+    for (int i=0; i<20; i++) {
+        ASSERT_EQ(OK_STATUS, cacheExecute(cache, key.buff, key.len, probeOperation, &args));
+        ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, cacheExecute(&client->defaultCache, key.buff, key.len, probeOperation, &args));
+    }
+    ASSERT_EQ(0, args.topologies);
+    ASSERT_EQ(100u, cache->tInfo.topologyId);
+    ASSERT_EQ(1u, client->defaultCache.tInfo.topologyId);
+    char name[16];
+    for (int i=0; i<100; i++) {
+        snprintf(name, sizeof(name), "key%d", i);
+        ASSERT_LT(cachePrimaryOwner(cache, name, strlen(name)), 2u);
+    }
+
+    closeCache(cache);
+    destroyClient(client);
+    stopStandInServer(srv);
+}
+
+/**
+ * Requests with opCode sent by client, metrics must be enabled
+ */
+static uint64_t requestsOf(hotrodClient *client, uint8_t opCode) {
+    clientMetrics m;
+    getClientMetrics(client, &m);
+    uint64_t count = m.latency[opCode] != nullptr ? m.latency[opCode]->total : 0;
+    freeMetrics(&m);
+    return count;
+}
+
+/**
+ * Find count keys named prefix<n>, owned by distinct servers if distinct or else by the same one
+ */
+static void findKeys(hotrodClient *client, const char *prefix, int distinct, char keys[][16], int count) {
+    uint32_t owners[8];
+    int found = 0;
+    for (int n=0; found < count; n++) {
+        snprintf(keys[found], 16, "%s%d", prefix, n);
+        uint32_t owner = clientPrimaryOwner(client, keys[found], strlen(keys[found]));
+        int ok = 1;
+        for (int i=0; i<found; i++) {
+            ok = ok && (distinct ? owner != owners[i] : owner == owners[i]);
+        }
+        if (ok) {
+            owners[found++] = owner;
+        }
+    }
+}
+
+static int valueIs(hotrodClient *client, const char *key, const char *expected) {
+    byteArray k = toArray(key);
+    valueBuffer value = {0, 0, nullptr, 1};
+    int res = clientGet(client, &k, &value);
+    int same = expected == nullptr ? res == KEY_DOES_NOT_EXIST_STATUS
+        : res == OK_STATUS && value.len == (int)strlen(expected) && memcmp(value.buff, expected, value.len) == 0;
+    free(value.buff);
+    return same;
+}
+
+class TransactionTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        srv = startStandInServer(12974, 3, 16);
+        ASSERT_NE(nullptr, srv);
+        requestHeader hdr;
+        fillHeader(&hdr);
+        client = createClient("127.0.0.1", 12974, &hdr, 1);
+        ASSERT_NE(nullptr, client);
+        enableClientMetrics(client);
+    }
+
+    void TearDown() override {
+        destroyClient(client);
+        stopStandInServer(srv);
+    }
+
+    standInServer *srv;
+    hotrodClient *client;
+};
+
+TEST_F(TransactionTest, ReadYourWritesAndOnePhaseCommit) {
+    char keys[2][16];
+    findKeys(client, "one", 0, keys, 2);
+    byteArray a = toArray(keys[0]);
+    byteArray b = toArray(keys[1]);
+    byteArray v1 = toArray("1");
+    byteArray v2 = toArray("2");
+    ASSERT_EQ(OK_STATUS, clientPut(client, &a, &v1));
+    ASSERT_EQ(OK_STATUS, clientPut(client, &b, &v1));
+
+    hotrodTransaction *tx = beginTransaction(&client->defaultCache, 1000);
+    valueBuffer value = {0, 0, nullptr, 1};
+    ASSERT_EQ(OK_STATUS, txGet(tx, &a, &value));
+    ASSERT_EQ(0, memcmp("1", value.buff, 1));
+    txPut(tx, &a, &v2);
+    txRemove(tx, &b);
+    // Served by the transaction, the server still has the values before it
+    uint64_t gets = requestsOf(client, GET_WITH_VERSION_REQUEST);
+    ASSERT_EQ(OK_STATUS, txGet(tx, &a, &value));
+    ASSERT_EQ(0, memcmp("2", value.buff, 1));
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, txGet(tx, &b, &value));
+    ASSERT_EQ(gets, requestsOf(client, GET_WITH_VERSION_REQUEST));
+    ASSERT_TRUE(valueIs(client, keys[0], "1"));
+    ASSERT_TRUE(valueIs(client, keys[1], "1"));
+
+    // A single owner: one PREPARE committing in one phase
+    ASSERT_EQ(OK_STATUS, commitTransaction(tx));
+    ASSERT_EQ(1u, requestsOf(client, PREPARE_REQUEST));
+    ASSERT_EQ(0u, requestsOf(client, COMMIT_REQUEST));
+    ASSERT_TRUE(valueIs(client, keys[0], "2"));
+    ASSERT_TRUE(valueIs(client, keys[1], nullptr));
+    free(value.buff);
+}
+
+TEST_F(TransactionTest, OnePrepareAndCommitPerOwner) {
+    char keys[3][16];
+    findKeys(client, "multi", 1, keys, 3);
+    hotrodTransaction *tx = beginTransaction(&client->defaultCache, 1000);
+    byteArray value = toArray("v");
+    for (int i=0; i<3; i++) {
+        byteArray k = toArray(keys[i]);
+        txPut(tx, &k, &value);
+    }
+    ASSERT_EQ(OK_STATUS, commitTransaction(tx));
+    ASSERT_EQ(3u, requestsOf(client, PREPARE_REQUEST));
+    ASSERT_EQ(3u, requestsOf(client, COMMIT_REQUEST));
+    ASSERT_EQ(0u, requestsOf(client, ROLLBACK_REQUEST));
+    for (int i=0; i<3; i++) {
+        ASSERT_TRUE(valueIs(client, keys[i], "v"));
+    }
+}
+
+TEST_F(TransactionTest, RollbackWhenAKeyReadIsModified) {
+    char keys[2][16];
+    findKeys(client, "rb", 1, keys, 2);
+    byteArray read = toArray(keys[0]);
+    byteArray other = toArray(keys[1]);
+    byteArray v1 = toArray("1");
+    byteArray v2 = toArray("2");
+    byteArray v3 = toArray("3");
+    ASSERT_EQ(OK_STATUS, clientPut(client, &read, &v1));
+    hotrodTransaction *tx = beginTransaction(&client->defaultCache, 1000);
+    valueBuffer value = {0, 0, nullptr, 1};
+    ASSERT_EQ(OK_STATUS, txGet(tx, &read, &value));
+    txPut(tx, &read, &v3);
+    txPut(tx, &other, &v3);
+    ASSERT_EQ(OK_STATUS, clientPut(client, &read, &v2));
+
+    // The owner of the key read refuses to prepare, the other branch is rolled back
+    ASSERT_EQ(NOT_PUT_REMOVED_REPLACED_STATUS, commitTransaction(tx));
+    ASSERT_EQ(0u, requestsOf(client, COMMIT_REQUEST));
+    ASSERT_TRUE(valueIs(client, keys[0], "2"));
+    ASSERT_TRUE(valueIs(client, keys[1], nullptr));
+    free(value.buff);
+}
+
+TEST_F(TransactionTest, KeysOnlyReadAreNotWritten) {
+    byteArray read = toArray("readOnly");
+    byteArray written = toArray("written");
+    byteArray v1 = toArray("1");
+    byteArray v2 = toArray("2");
+    ASSERT_EQ(OK_STATUS, clientPut(client, &read, &v1));
+    valueBuffer value = {0, 0, nullptr, 1};
+    uint64_t before, after;
+    ASSERT_EQ(OK_STATUS, clientGetWithVersion(client, &read, &value, &before));
+
+    hotrodTransaction *tx = beginTransaction(&client->defaultCache, 1000);
+    ASSERT_EQ(OK_STATUS, txGet(tx, &read, &value));
+    txPut(tx, &written, &v1);
+    ASSERT_EQ(OK_STATUS, commitTransaction(tx));
+    ASSERT_EQ(OK_STATUS, clientGetWithVersion(client, &read, &value, &after));
+    ASSERT_EQ(before, after);
+
+    // A key read and modified before the commit fails it, nothing is written
+    tx = beginTransaction(&client->defaultCache, 1000);
+    ASSERT_EQ(OK_STATUS, txGet(tx, &read, &value));
+    txPut(tx, &written, &v2);
+    ASSERT_EQ(OK_STATUS, clientPut(client, &read, &v2));
+    ASSERT_EQ(NOT_PUT_REMOVED_REPLACED_STATUS, commitTransaction(tx));
+    ASSERT_TRUE(valueIs(client, "written", "1"));
+    free(value.buff);
+}
+
+static int tempFile(int flags) {
+    char path[] = "/tmp/clientTestXXXXXX";
+    int fd = mkostemp(path, flags);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+TEST(ClientFile, PutAndGetAtOffsets) {
+    standInServer *srv = startStandInServer(12976, 1, 16);
+    ASSERT_NE(nullptr, srv);
+    requestHeader hdr;
+    fillHeader(&hdr);
+    hotrodClient *client = createClient("127.0.0.1", 12976, &hdr, 1);
+    ASSERT_NE(nullptr, client);
+    const uint32_t size = 200*1024;
+    uint8_t *data = (uint8_t*)malloc(size);
+    uint8_t *read = (uint8_t*)malloc(size);
+    for (uint32_t i=0; i<size; i++) {
+        data[i] = (uint8_t)(i*31 + i/251);
+    }
+    int src = tempFile(0);
+    ASSERT_LE(0, src);
+    ASSERT_EQ(6, pwrite(src, "header", 6, 4090));
+    ASSERT_EQ((ssize_t)size, pwrite(src, data, size, 4096));
+    byteArray key = toArray("file");
+    ASSERT_EQ(OK_STATUS, clientPutFile(client, &key, src, 4096, size));
+
+    // Spliced into a regular file at an offset
+    int dst = tempFile(0);
+    ASSERT_LE(0, dst);
+    uint32_t len = 0;
+    ASSERT_EQ(OK_STATUS, clientGetFile(client, &key, dst, 100, &len));
+    ASSERT_EQ(size, len);
+    ASSERT_EQ((ssize_t)size, pread(dst, read, size, 100));
+    ASSERT_EQ(0, memcmp(data, read, size));
+
+    // splice() refuses O_APPEND files, the value is copied through user space
+    int appended = tempFile(O_APPEND);
+    ASSERT_LE(0, appended);
+    len = 0;
+    ASSERT_EQ(OK_STATUS, clientGetFile(client, &key, appended, 0, &len));
+    ASSERT_EQ(size, len);
+    memset(read, 0, size);
+    ASSERT_EQ((ssize_t)size, pread(appended, read, size, 0));
+    ASSERT_EQ(0, memcmp(data, read, size));
+
+    // The connection is still in step after the values
+    byteArray missing = toArray("missing");
+    ASSERT_EQ(KEY_DOES_NOT_EXIST_STATUS, clientGetFile(client, &missing, dst, 0, &len));
+    ASSERT_EQ(0u, len);
+    close(src);
+    close(dst);
+    close(appended);
+    free(data);
+    free(read);
+    destroyClient(client);
+    stopStandInServer(srv);
+}
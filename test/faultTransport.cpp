@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "faultTransport.h"
+
+// xorshift64*, one state per stream
+static uint64_t nextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double nextDouble(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+static void reserve(uint8_t **buff, int *capacity, int len) {
+    if (*capacity < len) {
+        *capacity = len*2 > 256 ? len*2 : 256;
+        *buff = (uint8_t*)realloc(*buff, *capacity);
+    }
+}
+
+void initFaultStream(faultStream *fs, const faultProfile *profile, uint64_t seed) {
+    memset(fs, 0, sizeof(*fs));
+    fs->profile = *profile;
+    // xorshift never leaves 0
+    fs->seed = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+void freeFaultStream(faultStream *fs) {
+    free(fs->in);
+    free(fs->out);
+    fs->in = nullptr;
+    fs->out = nullptr;
+}
+
+void faultQueueResponse(faultStream *fs, const uint8_t *data, int len) {
+    reserve(&fs->in, &fs->inCapacity, fs->inLen+len);
+    memcpy(fs->in+fs->inLen, data, len);
+    fs->inLen += len;
+}
+
+/**
+ * Advance the clock by ns, or by the timeout if ns is longer
+ *
+ * @return 0 or -1 if the wait timed out
+ */
+static int waitNs(faultStream *fs, uint64_t ns) {
+    int timedOut = fs->profile.timeoutNs > 0 && ns > fs->profile.timeoutNs;
+    if (timedOut) {
+        ns = fs->profile.timeoutNs;
+    }
+    fs->clockNs += ns;
+    if (fs->realTime && ns > 0) {
+        struct timespec ts = {(time_t)(ns/1000000000), (long)(ns%1000000000)};
+        nanosleep(&ts, nullptr);
+    }
+    return timedOut ? -1 : 0;
+}
+
+static uint64_t responseDelay(faultStream *fs) {
+    const faultProfile *p = &fs->profile;
+    fs->responses++;
+    if (p->slowProbability > 0 && nextDouble(&fs->seed) < p->slowProbability) {
+        fs->slowResponses++;
+        return p->slowNs;
+    }
+    return p->baseNs + (p->jitterNs > 0 ? nextRandom(&fs->seed) % p->jitterNs : 0);
+}
+
+static void failRead(faultStream *fs, int error, uint8_t *val, int len) {
+    if (!fs->hasError) {
+        fs->hasError = error;
+    }
+    memset(val, 0, len);
+}
+
+void faultReader(void *ctx, uint8_t *val, int len) {
+    faultStream *fs = (faultStream*)ctx;
+    const faultProfile *p = &fs->profile;
+    if (fs->hasError) {
+        memset(val, 0, len);
+        return;
+    }
+    while (len > 0) {
+        if (fs->awaitingResponse) {
+            fs->awaitingResponse = 0;
+            fs->lastDelayNs = responseDelay(fs);
+            if (waitNs(fs, fs->lastDelayNs) != 0) {
+                failRead(fs, ETIMEDOUT, val, len);
+                return;
+            }
+        }
+        if (p->stallAfterBytes > 0 && !fs->stalled && fs->bytesRead >= p->stallAfterBytes) {
+            fs->stalled = 1;
+            if (waitNs(fs, p->stallNs) != 0) {
+                failRead(fs, ETIMEDOUT, val, len);
+                return;
+            }
+        }
+        if (p->disconnectAfterBytes > 0 && fs->bytesRead >= p->disconnectAfterBytes) {
+            failRead(fs, ECONNRESET, val, len);
+            return;
+        }
+        if (fs->inPos == fs->inLen) {
+            // The server never answers
+            waitNs(fs, p->timeoutNs);
+            failRead(fs, ETIMEDOUT, val, len);
+            return;
+        }
+        // A read stops at the available bytes, at the chunk limit and at the next fault
+        uint64_t chunk = fs->inLen-fs->inPos < len ? fs->inLen-fs->inPos : len;
+        if (p->maxReadChunk > 0 && chunk > (uint64_t)p->maxReadChunk) {
+            chunk = p->maxReadChunk;
+        }
+        if (p->stallAfterBytes > 0 && !fs->stalled && chunk > p->stallAfterBytes-fs->bytesRead) {
+            chunk = p->stallAfterBytes-fs->bytesRead;
+        }
+        if (p->disconnectAfterBytes > 0 && chunk > p->disconnectAfterBytes-fs->bytesRead) {
+            chunk = p->disconnectAfterBytes-fs->bytesRead;
+        }
+        memcpy(val, fs->in+fs->inPos, chunk);
+        fs->inPos += chunk;
+        fs->bytesRead += chunk;
+        fs->reads++;
+        val += chunk;
+        len -= chunk;
+    }
+}
+
+void faultWriter(void *ctx, uint8_t *val, int len) {
+    faultStream *fs = (faultStream*)ctx;
+    if (fs->hasError) {
+        return;
+    }
+    reserve(&fs->out, &fs->outCapacity, fs->outLen+len);
+    for (int pos=0; pos<len; ) {
+        int chunk = fs->profile.maxWriteChunk > 0 && len-pos > fs->profile.maxWriteChunk ? fs->profile.maxWriteChunk : len-pos;
+        memcpy(fs->out+fs->outLen, val+pos, chunk);
+        fs->outLen += chunk;
+        pos += chunk;
+        fs->writes++;
+    }
+    fs->awaitingResponse = 1;
+    if (fs->responder != nullptr) {
+        fs->responder(fs, val, len, fs->responderArg);
+    }
+}
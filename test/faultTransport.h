@@ -0,0 +1,93 @@
+#ifndef FAULT_TRANSPORT_H
+#define FAULT_TRANSPORT_H
+
+#include <stdint.h>
+#include "hotrod-c.h"
+
+/** @file */
+
+/**
+ * Faults injected by a faultStream, all zero is a perfect transport
+ *
+ * The response delay is drawn when the first byte of a response is read after a request:
+ * baseNs plus a uniform jitter, or slowNs with slowProbability to model a slow node.
+ */
+typedef struct {
+    uint64_t baseNs;                ///< delay of every response
+    uint64_t jitterNs;              ///< uniform extra delay in [0, jitterNs)
+    double slowProbability;         ///< fraction of the responses that are slow
+    uint64_t slowNs;                ///< delay of a slow response
+    int maxReadChunk;               ///< most bytes returned by a read, 0 is no limit
+    int maxWriteChunk;              ///< most bytes accepted by a write, 0 is no limit
+    uint64_t stallAfterBytes;       ///< stall once when this many bytes have been read, 0 never
+    uint64_t stallNs;               ///< duration of the stall
+    uint64_t disconnectAfterBytes;  ///< the connection drops when this many bytes have been read, 0 never
+    uint64_t timeoutNs;             ///< a read waiting longer fails with ETIMEDOUT, 0 never
+} faultProfile;
+
+typedef struct faultStream faultStream;
+
+/**
+ * faultResponder plays the server: it's called with every request written on the stream
+ * and answers with faultQueueResponse()
+ */
+typedef void (*faultResponder)(faultStream *fs, const uint8_t *request, int len, void *arg);
+
+/**
+ * An in-memory connection to one server with injected latency and faults
+ *
+ * The bytes written by the client are kept in out, the bytes the server sends are queued
+ * in in. Time is virtual: delays, stalls and timeouts advance clockNs, so runs are fast
+ * and, for a given seed, repeatable; with realTime the delays are also slept.
+ * Errors follow the socket transport: the first one is kept in hasError, failed reads
+ * return zeros.
+ */
+struct faultStream {
+    faultProfile profile;
+    uint64_t seed;              ///< random state, the same seed injects the same faults
+    int realTime;               ///< sleep the delays
+    faultResponder responder;   ///< nullptr if the responses are queued in advance
+    void *responderArg;
+    uint8_t *in;                ///< bytes sent by the server
+    int inLen;
+    int inPos;                  ///< next byte to read
+    int inCapacity;
+    uint8_t *out;               ///< bytes written by the client
+    int outLen;
+    int outCapacity;
+    int awaitingResponse;       ///< a request has been written, the next read waits the response delay
+    int stalled;                ///< the stall has happened
+    uint64_t bytesRead;
+    uint64_t reads;             ///< read calls of the transport, more than the reader calls with short reads
+    uint64_t writes;            ///< write calls of the transport
+    uint64_t responses;         ///< response delays drawn
+    uint64_t slowResponses;
+    uint64_t clockNs;           ///< virtual time spent waiting on the transport
+    uint64_t lastDelayNs;       ///< delay of the last response
+    int hasError;               ///< errno value of the first error, 0 if none
+};
+
+/**
+ * initFaultStream prepares an empty stream, release it with freeFaultStream
+ */
+void initFaultStream(faultStream *fs, const faultProfile *profile, uint64_t seed);
+void freeFaultStream(faultStream *fs);
+
+/**
+ * faultQueueResponse appends bytes sent by the server
+ */
+void faultQueueResponse(faultStream *fs, const uint8_t *data, int len);
+
+/**
+ * faultReader is the streamReader of a faultStream
+ *
+ * When no byte is left the responder has not answered: the read fails with ETIMEDOUT.
+ */
+void faultReader(void *ctx, uint8_t *val, int len);
+
+/**
+ * faultWriter is the streamWriter of a faultStream, short writes are resumed
+ */
+void faultWriter(void *ctx, uint8_t *val, int len);
+
+#endif // FAULT_TRANSPORT_H